@@ -18,15 +18,24 @@
 
 #include "l1sign.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "l1sign_gcrypt.h"
+#include "l1sign_hash.h"
+#include "l1sign_io.h"
+#include "l1sign_pool.h"
 
+#include "l1sign_cmd_audit.h"
 #include "l1sign_cmd_genkey.h"
+#include "l1sign_cmd_keyring.h"
 #include "l1sign_cmd_pubkey.h"
 #include "l1sign_cmd_sign.h"
+#include "l1sign_cmd_tree.h"
 #include "l1sign_cmd_verify.h"
 
 #include <config.h>
@@ -36,26 +45,55 @@ static const struct command commands[] = {
 		"genkey",
 		"Generate a random private key",
 		l1_cmd_genkey,
+		true,
 	},
 	{
 		"pubkey",
 		"Generate a public key from a private key",
 		l1_cmd_pubkey,
+		true,
+	},
+	{
+		"keyring",
+		"Update the public key index of a keyring directory",
+		l1_cmd_keyring,
+		false,
 	},
 	{
 		"sign",
 		"Sign a message with a private key",
 		l1_cmd_sign,
+		true,
 	},
 	{
 		"verify",
 		"Verify a message signature",
 		l1_cmd_verify,
+		false,
+	},
+	{
+		"sign-tree",
+		"Sign the files of a directory tree with a private key",
+		l1_cmd_sign_tree,
+		true,
+	},
+	{
+		"verify-tree",
+		"Verify the files of a directory tree against a signed manifest",
+		l1_cmd_verify_tree,
+		false,
+	},
+	{
+		"audit",
+		"Find reused keys in a directory of signatures",
+		l1_cmd_audit,
+		false,
 	},
 	{
 		NULL,
 		NULL,
 		NULL,
+		false,
 	},
 };
 
@@ -84,13 +122,21 @@ void print_usage(FILE *out) {
 	char usage[] =
 			"Usage: " PACKAGE_NAME " [options] <command> [args]\n\n"
 			"Commands:\n";
+	int width = 0;
+
 	fputs(usage, out);
 
+	for (size_t i = 0; commands[i].name; ++i) {
+		if ((int) strlen(commands[i].name) > width) {
+			width = strlen(commands[i].name);
+		}
+	}
+
 	for (size_t i = 0; commands[i].name; ++i) {
 		fprintf(out,
 				"  %s: %*s%s\n",
 				commands[i].name,
-				8 - (int) strlen(commands[i].name), "",
+				width - (int) strlen(commands[i].name), "",
 				commands[i].description);
 	}
 }
@@ -107,10 +153,36 @@ void print_opt_reject(char *cmd, char *opt) {
 	fprintf(stderr, "Command '%s' does not accept option '--%s'\n", cmd, opt);
 }
 
+/*
+ * Parse a positive integer option argument.
+ */
+static bool parse_count(const char *opt, const char *arg, unsigned int *val) {
+	char *end;
+	unsigned long count;
+
+	if (!arg) {
+		print_arg_required((char *) opt);
+		return false;
+	}
+
+	errno = 0;
+	count = strtoul(arg, &end, 10);
+
+	if (errno || end == arg || *end || !count || count > UINT_MAX
+			|| arg[0] == '-') {
+		fprintf(stderr, "Invalid argument for option '%s': %s\n", opt, arg);
+		return false;
+	}
+
+	*val = count;
+	return true;
+}
+
 int main(int argc, char **argv) {
 	const struct command *cmd;
 	struct options opts = { 0 };
 	int next = 0;
+	int retval;
 
 	while (argv[++next] && argv[next][0] == '-') {
 		if (!strcmp(argv[next], "-H") || !strcmp(argv[next], "--hash")) {
@@ -125,6 +197,129 @@ int main(int argc, char **argv) {
 				fprintf(stderr, "Unknown hash algorithm: %s\n", hash_name);
 				return EXIT_FAILURE;
 			}
+
+			opts.key_explicit |= L1_KEY_EXPLICIT_HASH;
+		} else if (!strcmp(argv[next], "--digest")) {
+			char *digest_name = argv[++next];
+
+			if (!digest_name) {
+				print_arg_required(argv[next - 1]);
+				return EXIT_FAILURE;
+			}
+
+			if (!(opts.digest = gcry_md_map_name(digest_name))) {
+				fprintf(stderr, "Unknown hash algorithm: %s\n", digest_name);
+				return EXIT_FAILURE;
+			}
+
+			opts.key_explicit |= L1_KEY_EXPLICIT_DIGEST;
+		} else if (!strcmp(argv[next], "--hash-backend")) {
+			char *backend_name = argv[++next];
+
+			if (!backend_name) {
+				print_arg_required(argv[next - 1]);
+				return EXIT_FAILURE;
+			}
+
+			if (!(opts.hash_backend = l1_hash_find_backend(backend_name))) {
+				fprintf(stderr, "Unknown hash backend: %s\n", backend_name);
+				return EXIT_FAILURE;
+			}
+		} else if (!strcmp(argv[next], "--hash-bytes")) {
+			if (!parse_count(argv[next], argv[next + 1], &opts.hash_nbytes)) {
+				return EXIT_FAILURE;
+			}
+
+			++next;
+		} else if (!strcmp(argv[next], "--bundle")) {
+			opts.bundle = true;
+		} else if (!strcmp(argv[next], "--burn")) {
+			opts.burn = true;
+		} else if (!strcmp(argv[next], "-C") || !strcmp(argv[next], "--cache")) {
+			opts.cache = argv[++next];
+
+			if (!opts.cache) {
+				print_arg_required(argv[next - 1]);
+				return EXIT_FAILURE;
+			}
+		} else if (!strcmp(argv[next], "--checkpoint")) {
+			opts.checkpoint = argv[++next];
+
+			if (!opts.checkpoint) {
+				print_arg_required(argv[next - 1]);
+				return EXIT_FAILURE;
+			}
+		} else if (!strcmp(argv[next], "--chunked")) {
+			opts.chunked = true;
+		} else if (!strcmp(argv[next], "--format")) {
+			char *format_name = argv[++next];
+
+			if (!format_name) {
+				print_arg_required(argv[next - 1]);
+				return EXIT_FAILURE;
+			}
+
+			if (!strcmp(format_name, "raw")) {
+				opts.key_format = L1_KEY_FORMAT_RAW;
+			} else if (!strcmp(format_name, "v1")) {
+				opts.key_format = L1_KEY_FORMAT_V1;
+			} else {
+				fprintf(stderr, "Unknown key format: %s\n", format_name);
+				return EXIT_FAILURE;
+			}
+		} else if (!strcmp(argv[next], "--io-engine")) {
+			char *engine_name = argv[++next];
+
+			if (!engine_name) {
+				print_arg_required(argv[next - 1]);
+				return EXIT_FAILURE;
+			}
+
+			if (!(opts.io_engine = l1_io_find_engine(engine_name))) {
+				fprintf(stderr, "Unknown I/O engine: %s\n", engine_name);
+				return EXIT_FAILURE;
+			}
+		} else if (!strcmp(argv[next], "-j") || !strcmp(argv[next], "--jobs")) {
+			if (!parse_count(argv[next], argv[next + 1], &opts.jobs)) {
+				return EXIT_FAILURE;
+			}
+
+			++next;
+		} else if (!strcmp(argv[next], "-k") || !strcmp(argv[next], "--key")) {
+			char *key = argv[++next];
+			char **keys;
+
+			if (!key) {
+				print_arg_required(argv[next - 1]);
+				return EXIT_FAILURE;
+			}
+
+			if (!(keys = realloc(opts.keys, (opts.nkeys + 1) * sizeof *keys))) {
+				fprintf(stderr, "Failed to allocate memory\n");
+				return EXIT_FAILURE;
+			}
+
+			opts.keys = keys;
+			opts.keys[opts.nkeys++] = key;
+		} else if (!strcmp(argv[next], "--key-fd")) {
+			if (!parse_count(argv[next], argv[next + 1], &opts.key_fd)) {
+				return EXIT_FAILURE;
+			}
+
+			if (fcntl(opts.key_fd, F_GETFD) < 0) {
+				fprintf(stderr, "Invalid argument for option '%s': %s (%s)\n",
+						argv[next], argv[next + 1], strerror(errno));
+				return EXIT_FAILURE;
+			}
+
+			++next;
+		} else if (!strcmp(argv[next], "-K") || !strcmp(argv[next], "--keyring")) {
+			opts.keyring = argv[++next];
+
+			if (!opts.keyring) {
+				print_arg_required(argv[next - 1]);
+				return EXIT_FAILURE;
+			}
 		} else if (!strcmp(argv[next], "-m") || !strcmp(argv[next], "--message")) {
 			opts.message = argv[++next];
 
@@ -132,6 +327,77 @@ int main(int argc, char **argv) {
 				print_arg_required(argv[next - 1]);
 				return EXIT_FAILURE;
 			}
+		} else if (!strcmp(argv[next], "-p") || !strcmp(argv[next], "--pubkey")) {
+			opts.pubkey = argv[++next];
+
+			if (!opts.pubkey) {
+				print_arg_required(argv[next - 1]);
+				return EXIT_FAILURE;
+			}
+		} else if (!strcmp(argv[next], "--scheme")) {
+			char *scheme_name = argv[++next];
+
+			if (!scheme_name) {
+				print_arg_required(argv[next - 1]);
+				return EXIT_FAILURE;
+			}
+
+			if (!strcmp(scheme_name, "ld")) {
+				opts.scheme = L1_KEY_SCHEME_LD;
+			} else if (!strcmp(scheme_name, "hors")) {
+				opts.scheme = L1_KEY_SCHEME_HORS;
+			} else {
+				fprintf(stderr, "Unknown signature scheme: %s\n", scheme_name);
+				return EXIT_FAILURE;
+			}
+		} else if (!strcmp(argv[next], "--stats")) {
+			opts.stats = argv[++next];
+
+			if (!opts.stats) {
+				print_arg_required(argv[next - 1]);
+				return EXIT_FAILURE;
+			}
+		} else if (!strcmp(argv[next], "--stats-format")) {
+			char *format_name = argv[++next];
+
+			if (!format_name) {
+				print_arg_required(argv[next - 1]);
+				return EXIT_FAILURE;
+			}
+
+			if (!strcmp(format_name, "json")) {
+				opts.stats_format = L1_STATS_FORMAT_JSON;
+			} else if (!strcmp(format_name, "prometheus")) {
+				opts.stats_format = L1_STATS_FORMAT_PROMETHEUS;
+			} else {
+				fprintf(stderr, "Unknown statistics format: %s\n", format_name);
+				return EXIT_FAILURE;
+			}
+		} else if (!strcmp(argv[next], "--tee")) {
+			opts.tee = argv[++next];
+
+			if (!opts.tee) {
+				print_arg_required(argv[next - 1]);
+				return EXIT_FAILURE;
+			}
+		} else if (!strcmp(argv[next], "--tee-fd")) {
+			if (!parse_count(argv[next], argv[next + 1], &opts.tee_fd)) {
+				return EXIT_FAILURE;
+			}
+
+			if (fcntl(opts.tee_fd, F_GETFD) < 0) {
+				fprintf(stderr, "Invalid argument for option '%s': %s (%s)\n",
+						argv[next], argv[next + 1], strerror(errno));
+				return EXIT_FAILURE;
+			}
+
+			++next;
+		} else if (!strcmp(argv[next], "-t") || !strcmp(argv[next], "--threshold")) {
+			if (!parse_count(argv[next], argv[next + 1], &opts.threshold)) {
+				return EXIT_FAILURE;
+			}
+
+			++next;
 		} else if (!strcmp(argv[next], "-v") || !strcmp(argv[next], "--verbose")) {
 			opts.verbose = true;
 		} else if (!strcmp(argv[next], "-h") || !strcmp(argv[next], "--help")) {
@@ -163,18 +429,60 @@ int main(int argc, char **argv) {
 
 	++next;
 
+	if (opts.stats) {
+		l1_stats_start();
+	}
+
 	if (!opts.hash) {
 		opts.hash = GCRY_MD_BLAKE2B_512;
 	}
 
-	if (opts.verbose) {
-		unsigned int hash_bytes = l1_gcry_hash_nbytes(opts.hash);
-		fprintf(stderr, "Hash: %s (%d bits)\n",
+	/*
+	 * Only extendable-output functions have a configurable output length.
+	 */
+	if (opts.hash_nbytes && !l1_gcry_hash_is_xof(opts.hash)) {
+		fprintf(stderr, "Option '--%s' requires an extendable-output hash "
+				"function\n", L1_OPT_NAME_HASH_BYTES);
+		return EXIT_FAILURE;
+	}
+
+	if (!opts.hash_nbytes) {
+		opts.hash_nbytes = l1_gcry_hash_nbytes(opts.hash);
+	}
+
+	if (!opts.digest) {
+		opts.digest = opts.hash;
+	}
+
+	if (!opts.hash_backend) {
+		opts.hash_backend = l1_hash_find_backend(L1_DEFAULT_HASH_BACKEND);
+	}
+
+	if (!opts.io_engine) {
+		opts.io_engine = l1_io_find_engine("auto");
+	}
+
+	if (!opts.jobs) {
+		opts.jobs = l1_pool_default_jobs();
+	}
+
+	/*
+	 * Commands that read keys report the hash function of the key instead.
+	 */
+	if (opts.verbose && (opts.key_explicit & L1_KEY_EXPLICIT_HASH)) {
+		fprintf(stderr, "Hash: %s (%u bits)\n",
 				gcry_md_algo_name(opts.hash),
-				hash_bytes * 8);
+				opts.hash_nbytes * 8);
+	}
+
+	if (opts.verbose && (opts.key_explicit & L1_KEY_EXPLICIT_DIGEST)) {
+		fprintf(stderr, "Digest: %s (%u bits)\n",
+				gcry_md_algo_name(opts.digest),
+				l1_gcry_digest_nbytes(opts.digest, opts.hash,
+					opts.hash_nbytes) * 8);
 	}
 
-	if (!l1_gcry_init(opts.hash)) {
+	if (!l1_gcry_init(opts.digest, opts.hash, opts.hash_nbytes)) {
 		return EXIT_FAILURE;
 	}
 
@@ -184,5 +492,23 @@ int main(int argc, char **argv) {
 		return EXIT_FAILURE;
 	}
 
-	return cmd->invoke(&opts, argc - next, &argv[next]);
+	/*
+	 * Commands that use secure memory complete the initialization once they
+	 * have set it up.
+	 */
+	if (!cmd->secmem && !l1_gcry_finish()) {
+		return EXIT_FAILURE;
+	}
+
+	retval = cmd->invoke(&opts, argc - next, &argv[next]);
+
+	if (opts.stats && !l1_stats_report(opts.stats, opts.stats_format,
+				cmd->name, l1_stats.hash
+					? l1_stats.hash
+					: gcry_md_algo_name(opts.hash))) {
+		retval = EXIT_FAILURE;
+	}
+
+	free(opts.keys);
+	return retval;
 }
@@ -19,13 +19,37 @@
 #ifndef L1SIGN_H
 #define L1SIGN_H
 
+#define L1_OPT_NAME_BUNDLE "bundle"
+#define L1_OPT_NAME_BURN "burn"
+#define L1_OPT_NAME_CACHE "cache"
+#define L1_OPT_NAME_CHECKPOINT "checkpoint"
+#define L1_OPT_NAME_CHUNKED "chunked"
+#define L1_OPT_NAME_DIGEST "digest"
+#define L1_OPT_NAME_FORMAT "format"
 #define L1_OPT_NAME_HASH "hash"
+#define L1_OPT_NAME_HASH_BACKEND "hash-backend"
+#define L1_OPT_NAME_HASH_BYTES "hash-bytes"
+#define L1_OPT_NAME_IO_ENGINE "io-engine"
+#define L1_OPT_NAME_JOBS "jobs"
+#define L1_OPT_NAME_KEY "key"
+#define L1_OPT_NAME_KEY_FD "key-fd"
+#define L1_OPT_NAME_KEYRING "keyring"
 #define L1_OPT_NAME_MESSAGE "message"
+#define L1_OPT_NAME_PUBKEY "pubkey"
+#define L1_OPT_NAME_SCHEME "scheme"
+#define L1_OPT_NAME_STATS "stats"
+#define L1_OPT_NAME_STATS_FORMAT "stats-format"
+#define L1_OPT_NAME_TEE "tee"
+#define L1_OPT_NAME_TEE_FD "tee-fd"
+#define L1_OPT_NAME_THRESHOLD "threshold"
 #define L1_OPT_NAME_VERBOSE "verbose"
 
 #include <stdbool.h>
 #include <stdio.h>
 
+#include "l1sign_key.h"
+#include "l1sign_stats.h"
+
 #define L1_OPT_ACCEPT(cmd, val, name) \
 	do { \
 		if (!val) { \
@@ -42,9 +66,35 @@
 		} \
 	} while(0)
 
+struct l1_hash_backend;
+struct l1_io_engine;
+
 struct options {
+	int digest;
 	int hash;
+	unsigned int hash_nbytes;
+	unsigned int key_explicit;
+	enum l1_key_format key_format;
+	enum l1_key_scheme scheme;
+	const struct l1_hash_backend *hash_backend;
+	const struct l1_io_engine *io_engine;
+	char *cache;
+	char *checkpoint;
+	char **keys;
+	size_t nkeys;
+	unsigned int key_fd;
+	char *keyring;
 	char *message;
+	char *pubkey;
+	char *stats;
+	enum l1_stats_format stats_format;
+	char *tee;
+	unsigned int tee_fd;
+	unsigned int jobs;
+	unsigned int threshold;
+	bool bundle;
+	bool burn;
+	bool chunked;
 	bool verbose;
 };
 
@@ -52,6 +102,7 @@ struct command {
 	char *name;
 	char *description;
 	int (*invoke)(const struct options *opts, int argc, char **argv);
+	bool secmem;
 };
 
 const struct command *find_command(const char *name);
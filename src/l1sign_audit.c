@@ -0,0 +1,290 @@
+/*
+ * l1sign - Implementation of the Lamport-Diffie one-time signature scheme
+ * Copyright (c) 2019  Janik Rabe <info@janikrabe.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "l1sign_audit.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static size_t audit_nbytes(uint32_t nslots) {
+	return sizeof (struct l1_audit_header)
+		+ (size_t) nslots * sizeof (struct l1_audit_slot);
+}
+
+/*
+ * Create an empty index with 'nslots' slots in the file 'fd', which must not
+ * contain any data beyond the header.  The slots are left as a hole, so
+ * unused slots do not occupy any disk space.
+ */
+static bool audit_init(int fd, uint32_t nslots) {
+	struct l1_audit_header header = { 0 };
+
+	memcpy(header.magic, L1_AUDIT_MAGIC, sizeof header.magic);
+	header.version = L1_AUDIT_VERSION;
+	header.nslots = nslots;
+
+	if (ftruncate(fd, audit_nbytes(nslots))) {
+		return false;
+	}
+
+	return pwrite(fd, &header, sizeof header, 0) == sizeof header;
+}
+
+static bool audit_check(int fd, off_t nbytes) {
+	struct l1_audit_header header;
+
+	if (pread(fd, &header, sizeof header, 0) != sizeof header) {
+		return false;
+	}
+
+	return !memcmp(header.magic, L1_AUDIT_MAGIC, sizeof header.magic)
+		&& header.version == L1_AUDIT_VERSION
+		&& header.nslots > 0
+		&& !(header.nslots & (header.nslots - 1))
+		&& header.nkeys <= header.nslots / 2
+		&& header.nreused <= header.nkeys
+		&& (size_t) nbytes == audit_nbytes(header.nslots);
+}
+
+static bool audit_map(struct l1_audit *audit) {
+	struct stat st;
+
+	if (fstat(audit->fd, &st)) {
+		return false;
+	}
+
+	audit->nbytes = st.st_size;
+	audit->header = mmap(NULL, audit->nbytes, PROT_READ | PROT_WRITE,
+			MAP_SHARED, audit->fd, 0);
+
+	if (audit->header == MAP_FAILED) {
+		audit->header = NULL;
+		return false;
+	}
+
+	audit->slots = (struct l1_audit_slot *) (audit->header + 1);
+	return true;
+}
+
+static void audit_unmap(struct l1_audit *audit) {
+	if (audit->header) {
+		munmap(audit->header, audit->nbytes);
+		audit->header = NULL;
+		audit->slots = NULL;
+	}
+}
+
+/*
+ * Open or create the audit index 'filename' and map it into memory.  The
+ * index stays locked until it is closed, so that concurrent audits do not
+ * update it at the same time.
+ */
+struct l1_audit *l1_audit_open(const char *filename) {
+	struct l1_audit *audit = calloc(1, sizeof *audit);
+	struct stat st;
+	bool ok;
+
+	if (!audit) {
+		fprintf(stderr, "Failed to allocate memory\n");
+		return NULL;
+	}
+
+	if ((audit->fd = open(filename, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) < 0) {
+		perror("Failed to open audit index");
+		free(audit);
+		return NULL;
+	}
+
+	if (flock(audit->fd, LOCK_EX) || fstat(audit->fd, &st)) {
+		perror("Failed to lock audit index");
+		l1_audit_close(audit);
+		return NULL;
+	}
+
+	if (st.st_size == 0) {
+		ok = audit_init(audit->fd, L1_AUDIT_INITIAL_NSLOTS);
+	} else {
+		ok = audit_check(audit->fd, st.st_size);
+	}
+
+	if (!ok) {
+		fprintf(stderr, "Invalid audit index\n");
+		l1_audit_close(audit);
+		return NULL;
+	}
+
+	if (!audit_map(audit)) {
+		perror("Failed to map audit index");
+		l1_audit_close(audit);
+		return NULL;
+	}
+
+	return audit;
+}
+
+void l1_audit_close(struct l1_audit *audit) {
+	audit_unmap(audit);
+	close(audit->fd);
+	free(audit);
+}
+
+/*
+ * Find the slot of the key 'key_fpr', or the empty slot where it belongs.
+ * NULL is returned if neither exists, which only happens if the index is
+ * corrupt, as it is never more than half full.
+ */
+static struct l1_audit_slot *audit_slot(const struct l1_audit *audit,
+		const unsigned char *key_fpr) {
+	uint32_t nslots = audit->header->nslots;
+	uint32_t mask = nslots - 1;
+	uint64_t tag;
+
+	memcpy(&tag, key_fpr, sizeof tag);
+
+	for (uint32_t n = 0; n < nslots; ++n) {
+		struct l1_audit_slot *slot = &audit->slots[(tag + n) & mask];
+
+		if (!slot->in_use
+				|| !memcmp(slot->key_fpr, key_fpr, sizeof slot->key_fpr)) {
+			return slot;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Double the number of slots.  The index is marked as incomplete while its
+ * slots are moved, so that an interrupted audit is repeated in full.
+ */
+static bool audit_grow(struct l1_audit *audit) {
+	uint32_t nslots = audit->header->nslots;
+	uint64_t nkeys = audit->header->nkeys;
+	uint64_t nreused = audit->header->nreused;
+	struct l1_audit_slot *used = malloc(nkeys * sizeof *used);
+	size_t n = 0;
+	bool ret = false;
+
+	if (!used || nslots > UINT32_MAX / 2) {
+		fprintf(stderr, "Failed to allocate memory\n");
+		free(used);
+		return false;
+	}
+
+	for (uint32_t i = 0; i < nslots && n < nkeys; ++i) {
+		if (audit->slots[i].in_use) {
+			used[n++] = audit->slots[i];
+		}
+	}
+
+	audit->header->since_sec = 0;
+	audit->header->since_nsec = 0;
+
+	if (msync(audit->header, sizeof *audit->header, MS_SYNC)) {
+		perror("Failed to update audit index");
+		goto out;
+	}
+
+	audit_unmap(audit);
+
+	if (ftruncate(audit->fd, sizeof *audit->header)
+			|| !audit_init(audit->fd, nslots * 2)) {
+		perror("Failed to resize audit index");
+		goto out;
+	}
+
+	if (!audit_map(audit)) {
+		perror("Failed to map audit index");
+		goto out;
+	}
+
+	for (size_t i = 0; i < n; ++i) {
+		*audit_slot(audit, used[i].key_fpr) = used[i];
+	}
+
+	audit->header->nkeys = n;
+	audit->header->nreused = nreused;
+	ret = true;
+
+out:
+	free(used);
+	return ret;
+}
+
+/*
+ * Record that the key 'key_fpr' signed the digest 'digest_fpr'.  The first
+ * digest of each key is kept; any other digest marks the key as reused.
+ */
+enum l1_audit_result l1_audit_record(struct l1_audit *audit,
+		const unsigned char *key_fpr, const unsigned char *digest_fpr) {
+	struct l1_audit_slot *slot = audit_slot(audit, key_fpr);
+
+	if (!slot) {
+		fprintf(stderr, "Audit index is corrupt\n");
+		return L1_AUDIT_ERROR;
+	}
+
+	if (slot->in_use) {
+		if (!memcmp(slot->digest_fpr, digest_fpr, sizeof slot->digest_fpr)) {
+			return L1_AUDIT_SEEN;
+		}
+
+		if (!slot->reused) {
+			slot->reused = 1;
+			++audit->header->nreused;
+		}
+
+		return L1_AUDIT_REUSED;
+	}
+
+	if ((audit->header->nkeys + 1) * 2 > audit->header->nslots) {
+		if (!audit_grow(audit)) {
+			return L1_AUDIT_ERROR;
+		}
+
+		slot = audit_slot(audit, key_fpr);
+	}
+
+	memcpy(slot->key_fpr, key_fpr, sizeof slot->key_fpr);
+	memcpy(slot->digest_fpr, digest_fpr, sizeof slot->digest_fpr);
+	slot->in_use = 1;
+	++audit->header->nkeys;
+	return L1_AUDIT_NEW;
+}
+
+/*
+ * Check whether a signature file whose status last changed at 'ctime' has
+ * been recorded by an earlier audit.
+ */
+bool l1_audit_is_recorded(const struct l1_audit *audit,
+		const struct timespec *ctime) {
+	return ctime->tv_sec < audit->header->since_sec
+		|| (ctime->tv_sec == audit->header->since_sec
+			&& ctime->tv_nsec < audit->header->since_nsec);
+}
+
+void l1_audit_set_since(struct l1_audit *audit, const struct timespec *since) {
+	audit->header->since_sec = since->tv_sec;
+	audit->header->since_nsec = since->tv_nsec;
+}
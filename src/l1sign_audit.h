@@ -0,0 +1,84 @@
+/*
+ * l1sign - Implementation of the Lamport-Diffie one-time signature scheme
+ * Copyright (c) 2019  Janik Rabe <info@janikrabe.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef L1SIGN_AUDIT_H
+#define L1SIGN_AUDIT_H
+
+#include <config.h>
+
+#include "l1sign_gcrypt.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#define L1_AUDIT_MAGIC "L1AUDIDX"
+#define L1_AUDIT_VERSION 1
+#define L1_AUDIT_INITIAL_NSLOTS 65536
+
+/*
+ * The audit index maps the fingerprint of each public key that has been seen
+ * in a signature to a fingerprint of the message digest that it signed.  It
+ * consists of a header and an open-addressing hash table of 'nslots' slots,
+ * which is kept at most half full.  'nreused' counts the keys that signed more
+ * than one digest.  All integers are stored in host byte order.
+ *
+ * Signature files whose status changed before 'since', the start of the last
+ * completed audit, have already been recorded.
+ */
+struct l1_audit_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t nslots;
+	uint64_t nkeys;
+	uint64_t nreused;
+	int64_t since_sec;
+	int64_t since_nsec;
+};
+
+struct l1_audit_slot {
+	unsigned char key_fpr[L1_FPR_NBYTES];
+	unsigned char digest_fpr[L1_FPR_NBYTES];
+	uint32_t in_use;
+	uint32_t reused;
+};
+
+struct l1_audit {
+	int fd;
+	struct l1_audit_header *header;
+	struct l1_audit_slot *slots;
+	size_t nbytes;
+};
+
+enum l1_audit_result {
+	L1_AUDIT_ERROR,
+	L1_AUDIT_NEW,
+	L1_AUDIT_SEEN,
+	L1_AUDIT_REUSED,
+};
+
+struct l1_audit *l1_audit_open(const char *filename);
+void l1_audit_close(struct l1_audit *audit);
+enum l1_audit_result l1_audit_record(struct l1_audit *audit,
+		const unsigned char *key_fpr, const unsigned char *digest_fpr);
+bool l1_audit_is_recorded(const struct l1_audit *audit,
+		const struct timespec *ctime);
+void l1_audit_set_since(struct l1_audit *audit, const struct timespec *since);
+
+#endif
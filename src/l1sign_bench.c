@@ -0,0 +1,457 @@
+/*
+ * l1sign - Implementation of the Lamport-Diffie one-time signature scheme
+ * Copyright (c) 2019  Janik Rabe <info@janikrabe.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "l1sign_gcrypt.h"
+#include "l1sign_hash.h"
+#include "l1sign_ots.h"
+#include "l1sign_util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_REPEAT 5
+#define BENCH_MIN_SECONDS 0.1
+#define BENCH_MAX_RESULTS 128
+#define BENCH_NAME_LEN 64
+#define BENCH_THRESHOLD 10.0
+
+struct result {
+	char name[BENCH_NAME_LEN];
+	double ns_per_op;
+};
+
+struct hash_file_arg {
+	FILE *file;
+	gcry_md_hd_t hd;
+	size_t buf_nbytes;
+};
+
+struct ots_arg {
+	struct l1_hash *hash;
+	unsigned int hash_nbytes;
+	unsigned char *digest;
+	unsigned char *sec;
+	unsigned char *pub;
+	unsigned char *sig;
+	unsigned char *sel;
+};
+
+typedef void (*bench_fn)(void *arg, unsigned long iterations);
+
+static struct result results[BENCH_MAX_RESULTS];
+static size_t nresults;
+
+static double min_seconds = BENCH_MIN_SECONDS;
+static const char *filter;
+
+static volatile unsigned long sink;
+
+static double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Double the number of iterations until a run takes at least 'min_seconds',
+ * then repeat the run and keep the fastest time per iteration.
+ */
+static void bench_run(const char *name, bench_fn fn, void *arg) {
+	unsigned long iterations = 1;
+	double best;
+
+	if ((filter && !strstr(name, filter)) || nresults == BENCH_MAX_RESULTS) {
+		return;
+	}
+
+	for (;;) {
+		double start = now();
+
+		fn(arg, iterations);
+		best = (now() - start) / iterations;
+
+		if (best * iterations >= min_seconds) {
+			break;
+		}
+
+		iterations *= 2;
+	}
+
+	for (int i = 1; i < BENCH_REPEAT; ++i) {
+		double start = now();
+
+		fn(arg, iterations);
+
+		double elapsed = (now() - start) / iterations;
+
+		if (elapsed < best) {
+			best = elapsed;
+		}
+	}
+
+	snprintf(results[nresults].name, BENCH_NAME_LEN, "%s", name);
+	results[nresults++].ns_per_op = best * 1e9;
+
+	printf("%-44s %14.1f ns/op\n", name, best * 1e9);
+	fflush(stdout);
+}
+
+static void bench_bit_get(void *arg, unsigned long iterations) {
+	unsigned char *digest = arg;
+	unsigned long sum = 0;
+
+	for (unsigned long n = 0; n < iterations; ++n) {
+		for (size_t i = 0; i < 512; ++i) {
+			sum += l1_bit_get(digest, 64, i);
+		}
+	}
+
+	sink = sum;
+}
+
+static void bench_hash_file(void *arg, unsigned long iterations) {
+	struct hash_file_arg *hf = arg;
+
+	for (unsigned long n = 0; n < iterations; ++n) {
+		rewind(hf->file);
+		gcry_md_reset(hf->hd);
+		l1_gcry_hash_file_bufsize(hf->hd, hf->file, hf->buf_nbytes);
+	}
+}
+
+static void bench_pubkey(void *arg, unsigned long iterations) {
+	struct ots_arg *ots = arg;
+
+	for (unsigned long n = 0; n < iterations; ++n) {
+		l1_ots_pubkey(ots->hash, ots->sec, ots->pub, ots->hash_nbytes,
+				ots->hash_nbytes * 16);
+	}
+}
+
+static void bench_sign(void *arg, unsigned long iterations) {
+	struct ots_arg *ots = arg;
+
+	for (unsigned long n = 0; n < iterations; ++n) {
+		l1_ots_select(ots->sec, ots->digest, ots->hash_nbytes,
+				ots->hash_nbytes * 8, ots->sig);
+	}
+}
+
+static void bench_verify(void *arg, unsigned long iterations) {
+	struct ots_arg *ots = arg;
+
+	for (unsigned long n = 0; n < iterations; ++n) {
+		l1_ots_select(ots->pub, ots->digest, ots->hash_nbytes,
+				ots->hash_nbytes * 8, ots->sel);
+		sink = l1_ots_verify(ots->hash, ots->sig, ots->sel, ots->hash_nbytes,
+				ots->hash_nbytes * 8);
+	}
+}
+
+static void format_size(char *buf, size_t len, size_t nbytes) {
+	if (nbytes >= 1 << 20) {
+		snprintf(buf, len, "%zuM", nbytes >> 20);
+	} else if (nbytes >= 1 << 10) {
+		snprintf(buf, len, "%zuK", nbytes >> 10);
+	} else {
+		snprintf(buf, len, "%zu", nbytes);
+	}
+}
+
+static bool bench_hash_files(void) {
+	static const size_t msg_sizes[] = { 4 << 10, 1 << 20, 16 << 20 };
+	static const size_t buf_sizes[] = { 4 << 10, 64 << 10, 1 << 20 };
+	struct hash_file_arg hf;
+	char *data = gcry_malloc(msg_sizes[2]);
+
+	if (!data || !(hf.hd = l1_gcry_hash_hd_create(GCRY_MD_BLAKE2B_512, false))) {
+		fprintf(stderr, "Failed to set up message hashing benchmark\n");
+		gcry_free(data);
+		return false;
+	}
+
+	gcry_randomize(data, msg_sizes[2], GCRY_WEAK_RANDOM);
+
+	for (size_t m = 0; m < sizeof msg_sizes / sizeof *msg_sizes; ++m) {
+		if (!(hf.file = tmpfile())
+				|| fwrite(data, 1, msg_sizes[m], hf.file) != msg_sizes[m]) {
+			perror("Failed to create message file");
+			return false;
+		}
+
+		for (size_t b = 0; b < sizeof buf_sizes / sizeof *buf_sizes; ++b) {
+			char name[BENCH_NAME_LEN];
+			char msg_size[16];
+			char buf_size[16];
+
+			format_size(msg_size, sizeof msg_size, msg_sizes[m]);
+			format_size(buf_size, sizeof buf_size, buf_sizes[b]);
+			snprintf(name, sizeof name, "hash_file/msg=%s/buf=%s",
+					msg_size, buf_size);
+
+			hf.buf_nbytes = buf_sizes[b];
+			bench_run(name, bench_hash_file, &hf);
+		}
+
+		fclose(hf.file);
+	}
+
+	l1_gcry_hash_hd_destroy(hf.hd);
+	gcry_free(data);
+	return true;
+}
+
+/*
+ * Benchmark the block hashes of hash function 'algo' with 'backend'.  Results
+ * of backends other than the default have the backend name appended.
+ */
+static bool bench_ots_backend(struct ots_arg *ots, int algo,
+		const char *backend_name) {
+	const struct l1_hash_backend *backend;
+	const char *suffix = strcmp(backend_name, "gcrypt") ? backend_name : "";
+	char name[BENCH_NAME_LEN];
+
+	if (!(backend = l1_hash_find_backend(backend_name))) {
+		return true;
+	}
+
+	if (!(ots->hash = l1_hash_create(backend, algo, ots->hash_nbytes,
+			false))) {
+		return false;
+	}
+
+	snprintf(name, sizeof name, "pubkey/%s%s%s", gcry_md_algo_name(algo),
+			*suffix ? "/" : "", suffix);
+	bench_run(name, bench_pubkey, ots);
+
+	snprintf(name, sizeof name, "verify/%s%s%s", gcry_md_algo_name(algo),
+			*suffix ? "/" : "", suffix);
+	bench_run(name, bench_verify, ots);
+
+	l1_hash_destroy(ots->hash);
+	return true;
+}
+
+static bool bench_ots(int algo) {
+	struct ots_arg ots;
+	unsigned int key_nbytes = l1_gcry_key_nbytes(l1_gcry_hash_nbytes(algo),
+			l1_gcry_hash_nbytes(algo));
+	char name[BENCH_NAME_LEN];
+
+	ots.hash_nbytes = l1_gcry_hash_nbytes(algo);
+	ots.digest = gcry_malloc(ots.hash_nbytes);
+	ots.sec = gcry_malloc(key_nbytes);
+	ots.pub = gcry_malloc(key_nbytes);
+	ots.sig = gcry_malloc(key_nbytes / 2);
+	ots.sel = gcry_malloc(key_nbytes / 2);
+
+	if (!ots.digest || !ots.sec || !ots.pub || !ots.sig || !ots.sel
+			|| !(ots.hash = l1_hash_create(l1_hash_find_backend("gcrypt"),
+					algo, ots.hash_nbytes, false))) {
+		fprintf(stderr, "Failed to set up %s benchmarks\n",
+				gcry_md_algo_name(algo));
+		return false;
+	}
+
+	gcry_randomize(ots.digest, ots.hash_nbytes, GCRY_WEAK_RANDOM);
+	gcry_randomize(ots.sec, key_nbytes, GCRY_WEAK_RANDOM);
+	l1_ots_pubkey(ots.hash, ots.sec, ots.pub, ots.hash_nbytes,
+			ots.hash_nbytes * 16);
+	l1_ots_select(ots.sec, ots.digest, ots.hash_nbytes,
+			ots.hash_nbytes * 8, ots.sig);
+
+	l1_hash_destroy(ots.hash);
+
+	snprintf(name, sizeof name, "sign/%s", gcry_md_algo_name(algo));
+	bench_run(name, bench_sign, &ots);
+
+	if (!bench_ots_backend(&ots, algo, "gcrypt")
+			|| !bench_ots_backend(&ots, algo, "openssl")) {
+		fprintf(stderr, "Failed to set up %s benchmarks\n",
+				gcry_md_algo_name(algo));
+		return false;
+	}
+
+	gcry_free(ots.digest);
+	gcry_free(ots.sec);
+	gcry_free(ots.pub);
+	gcry_free(ots.sig);
+	gcry_free(ots.sel);
+	return true;
+}
+
+static bool write_results(const char *filename) {
+	FILE *out = fopen(filename, "w");
+
+	if (!out) {
+		perror("Failed to open output file");
+		return false;
+	}
+
+	fprintf(out, "{\n  \"benchmarks\": [\n");
+
+	for (size_t i = 0; i < nresults; ++i) {
+		fprintf(out, "    {\"name\":\"%s\",\"ns_per_op\":%.1f}%s\n",
+				results[i].name, results[i].ns_per_op,
+				i + 1 < nresults ? "," : "");
+	}
+
+	fprintf(out, "  ]\n}\n");
+
+	if (fclose(out)) {
+		perror("Failed to write output file");
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Compare the results to a baseline written by a previous run.  Returns the
+ * number of benchmarks that are slower than the baseline by more than
+ * 'threshold' percent, or -1 if the baseline cannot be read.
+ */
+static int compare_results(const char *filename, double threshold) {
+	FILE *in = fopen(filename, "r");
+	char line[256];
+	int nregressions = 0;
+
+	if (!in) {
+		perror("Failed to open baseline file");
+		return -1;
+	}
+
+	printf("\nComparison with %s (threshold %.1f%%):\n", filename, threshold);
+
+	while (fgets(line, sizeof line, in)) {
+		char name[BENCH_NAME_LEN];
+		double base;
+
+		if (sscanf(line, " {\"name\":\"%63[^\"]\",\"ns_per_op\":%lf",
+					name, &base) != 2 || base <= 0) {
+			continue;
+		}
+
+		for (size_t i = 0; i < nresults; ++i) {
+			if (strcmp(name, results[i].name)) {
+				continue;
+			}
+
+			double change = (results[i].ns_per_op - base) / base * 100;
+			bool regression = change > threshold;
+
+			printf("%-44s %+8.1f%%%s\n", name, change,
+					regression ? "  REGRESSION" : "");
+			nregressions += regression;
+		}
+	}
+
+	fclose(in);
+	return nregressions;
+}
+
+static void print_usage(void) {
+	fprintf(stderr, "Usage: l1sign-bench [-o output.json] "
+			"[-b baseline.json] [-t threshold-percent] [-s min-seconds] "
+			"[-f filter]\n");
+}
+
+int main(int argc, char **argv) {
+	static const int algos[] = {
+		GCRY_MD_BLAKE2B_512,
+		GCRY_MD_BLAKE2S_256,
+		GCRY_MD_SHA256,
+		GCRY_MD_SHA512,
+		GCRY_MD_SHA3_256,
+		GCRY_MD_SHAKE128,
+	};
+	const char *output = NULL;
+	const char *baseline = NULL;
+	double threshold = BENCH_THRESHOLD;
+	unsigned char digest[64];
+	int nregressions = 0;
+
+	for (int i = 1; i < argc; ++i) {
+		if (!argv[i + 1] || argv[i][0] != '-' || strlen(argv[i]) != 2) {
+			print_usage();
+			return EXIT_FAILURE;
+		}
+
+		switch (argv[i++][1]) {
+		case 'o':
+			output = argv[i];
+			break;
+		case 'b':
+			baseline = argv[i];
+			break;
+		case 't':
+			threshold = atof(argv[i]);
+			break;
+		case 's':
+			min_seconds = atof(argv[i]);
+			break;
+		case 'f':
+			filter = argv[i];
+			break;
+		default:
+			print_usage();
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (!l1_gcry_init(GCRY_MD_BLAKE2B_512, GCRY_MD_BLAKE2B_512,
+				l1_gcry_hash_nbytes(GCRY_MD_BLAKE2B_512))
+			|| !l1_gcry_secmem_init(
+				l1_gcry_key_nbytes(l1_gcry_hash_nbytes(GCRY_MD_BLAKE2B_512),
+					l1_gcry_hash_nbytes(GCRY_MD_BLAKE2B_512)), 1)) {
+		return EXIT_FAILURE;
+	}
+
+	atexit(l1_gcry_term);
+
+	gcry_randomize(digest, sizeof digest, GCRY_WEAK_RANDOM);
+	bench_run("bit_get/512", bench_bit_get, digest);
+
+	if (!bench_hash_files()) {
+		return EXIT_FAILURE;
+	}
+
+	for (size_t i = 0; i < sizeof algos / sizeof *algos; ++i) {
+		if (!bench_ots(algos[i])) {
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (output && !write_results(output)) {
+		return EXIT_FAILURE;
+	}
+
+	if (baseline && (nregressions = compare_results(baseline, threshold)) < 0) {
+		return EXIT_FAILURE;
+	}
+
+	if (nregressions) {
+		printf("\n%d benchmark(s) regressed\n", nregressions);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,226 @@
+/*
+ * l1sign - Implementation of the Lamport-Diffie one-time signature scheme
+ * Copyright (c) 2019  Janik Rabe <info@janikrabe.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "l1sign_bundle.h"
+
+#include "l1sign_stats.h"
+#include "l1sign_util.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define OFF_VERSION 8
+#define OFF_SIG_NBYTES 12
+#define OFF_MSG_NBYTES 16
+#define OFF_ALGO 24
+#define OFF_DIGEST (OFF_ALGO + L1_BUNDLE_ALGO_NAME_LEN)
+
+#define BUNDLE_BUFFER_LEN 65536
+
+/*
+ * Encode the header of a bundle into 'buf', which must hold
+ * L1_BUNDLE_HEADER_NBYTES bytes.
+ */
+void l1_bundle_encode_header(const struct l1_bundle *bundle,
+		unsigned char *buf) {
+	memset(buf, 0, L1_BUNDLE_HEADER_NBYTES);
+	memcpy(buf, L1_BUNDLE_MAGIC, strlen(L1_BUNDLE_MAGIC));
+
+	l1_put_le32(buf + OFF_VERSION, L1_BUNDLE_VERSION);
+	l1_put_le32(buf + OFF_SIG_NBYTES, bundle->sig_nbytes);
+	l1_put_le64(buf + OFF_MSG_NBYTES, bundle->msg_nbytes);
+	strncpy((char *) buf + OFF_ALGO, gcry_md_algo_name(bundle->algo),
+			L1_BUNDLE_ALGO_NAME_LEN - 1);
+	strncpy((char *) buf + OFF_DIGEST, gcry_md_algo_name(bundle->digest),
+			L1_BUNDLE_ALGO_NAME_LEN - 1);
+}
+
+/*
+ * Map the NUL-padded algorithm name at 'name' to an algorithm.
+ */
+static int decode_algo(const unsigned char *name, const char *desc) {
+	char algo_name[L1_BUNDLE_ALGO_NAME_LEN + 1] = { 0 };
+	int algo;
+
+	memcpy(algo_name, name, L1_BUNDLE_ALGO_NAME_LEN);
+
+	if (!(algo = gcry_md_map_name(algo_name))) {
+		fprintf(stderr, "Unknown hash algorithm in %s: %s\n", desc, algo_name);
+	}
+
+	return algo;
+}
+
+bool l1_bundle_decode_header(struct l1_bundle *bundle, const unsigned char *buf,
+		const char *desc) {
+	if (memcmp(buf, L1_BUNDLE_MAGIC, strlen(L1_BUNDLE_MAGIC))) {
+		fprintf(stderr, "The %s is not a bundle\n", desc);
+		return false;
+	}
+
+	if (l1_get_le32(buf + OFF_VERSION) != L1_BUNDLE_VERSION) {
+		fprintf(stderr, "Unsupported format version %u of %s\n",
+				l1_get_le32(buf + OFF_VERSION), desc);
+		return false;
+	}
+
+	if (!(bundle->algo = decode_algo(buf + OFF_ALGO, desc))
+			|| !(bundle->digest = decode_algo(buf + OFF_DIGEST, desc))) {
+		return false;
+	}
+
+	bundle->sig_nbytes = l1_get_le32(buf + OFF_SIG_NBYTES);
+	bundle->msg_nbytes = l1_get_le64(buf + OFF_MSG_NBYTES);
+	return true;
+}
+
+void l1_bundle_spool_init(struct l1_bundle_spool *spool, struct l1_out *out) {
+	memset(spool, 0, sizeof *spool);
+	spool->out = out && out->tmp_filename ? out : NULL;
+}
+
+/*
+ * Keep 'len' bytes of the message at 'buf', in memory until the spool
+ * outgrows L1_BUNDLE_SPOOL_NBYTES.
+ */
+static bool spool_write(struct l1_bundle_spool *spool, const unsigned char *buf,
+		size_t len) {
+	if (spool->out) {
+		return l1_out_write(spool->out, buf, len);
+	}
+
+	if (!spool->file && spool->len + len <= L1_BUNDLE_SPOOL_NBYTES) {
+		unsigned char *grown = realloc(spool->buf, spool->len + len);
+
+		if (!grown) {
+			return false;
+		}
+
+		memcpy(grown + spool->len, buf, len);
+		spool->buf = grown;
+		spool->len += len;
+		return true;
+	}
+
+	if (!spool->file) {
+		if (!(spool->file = tmpfile())) {
+			return false;
+		}
+
+		if (fwrite(spool->buf, 1, spool->len, spool->file) != spool->len) {
+			return false;
+		}
+
+		free(spool->buf);
+		spool->buf = NULL;
+		spool->len = 0;
+	}
+
+	return fwrite(buf, 1, len, spool->file) == len;
+}
+
+/*
+ * Hash the message that can be read from 'in', up to 'max_nbytes' bytes, and
+ * keep it in the spool.  The number of bytes read is stored in
+ * spool->nbytes.
+ */
+bool l1_bundle_spool_hash(struct l1_bundle_spool *spool, FILE *in,
+		gcry_md_hd_t hd, uint64_t max_nbytes) {
+	unsigned char *buf = malloc(BUNDLE_BUFFER_LEN);
+	bool ret = false;
+
+	if (!buf) {
+		return false;
+	}
+
+	for (;;) {
+		size_t len = BUNDLE_BUFFER_LEN;
+
+		if (spool->nbytes == max_nbytes) {
+			ret = true;
+			break;
+		}
+
+		if (max_nbytes - spool->nbytes < len) {
+			len = max_nbytes - spool->nbytes;
+		}
+
+		if (!(len = fread(buf, 1, len, in))) {
+			ret = !ferror(in);
+			break;
+		}
+
+		l1_stats_read(len);
+		gcry_md_write(hd, buf, len);
+		spool->nbytes += len;
+
+		if (!spool_write(spool, buf, len)) {
+			break;
+		}
+	}
+
+	free(buf);
+	return ret;
+}
+
+/*
+ * Write the spooled message to 'out', unless it has been written already.
+ */
+bool l1_bundle_spool_flush(struct l1_bundle_spool *spool, struct l1_out *out) {
+	unsigned char *buf;
+	uint64_t remaining = spool->nbytes;
+	bool ret = true;
+
+	if (spool->out) {
+		return true;
+	}
+
+	if (!spool->file) {
+		return l1_out_write(out, spool->buf, spool->len);
+	}
+
+	if (fflush(spool->file) || fseeko(spool->file, 0, SEEK_SET)
+			|| !(buf = malloc(BUNDLE_BUFFER_LEN))) {
+		return false;
+	}
+
+	while (ret && remaining) {
+		size_t len = remaining < BUNDLE_BUFFER_LEN
+			? remaining
+			: BUNDLE_BUFFER_LEN;
+
+		if (fread(buf, 1, len, spool->file) != len) {
+			ret = false;
+		} else if (!l1_out_write(out, buf, len)) {
+			ret = false;
+		}
+
+		remaining -= len;
+	}
+
+	free(buf);
+	return ret;
+}
+
+void l1_bundle_spool_free(struct l1_bundle_spool *spool) {
+	if (spool->file) {
+		fclose(spool->file);
+	}
+
+	free(spool->buf);
+}
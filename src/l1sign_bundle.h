@@ -0,0 +1,90 @@
+/*
+ * l1sign - Implementation of the Lamport-Diffie one-time signature scheme
+ * Copyright (c) 2019  Janik Rabe <info@janikrabe.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef L1SIGN_BUNDLE_H
+#define L1SIGN_BUNDLE_H
+
+#include <config.h>
+
+#include "l1sign_gcrypt.h"
+#include "l1sign_out.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define L1_BUNDLE_MAGIC "L1BUNDLE"
+#define L1_BUNDLE_VERSION 1
+#define L1_BUNDLE_HEADER_NBYTES 96
+#define L1_BUNDLE_ALGO_NAME_LEN 32
+
+/*
+ * Messages up to this size are spooled in memory, larger ones in a temporary
+ * file.
+ */
+#define L1_BUNDLE_SPOOL_NBYTES (4 << 20)
+
+/*
+ * A bundle holds a message along with its signature, so that it can be
+ * verified in a single pass.  It consists of a header of
+ * L1_BUNDLE_HEADER_NBYTES bytes, the signature, and the message.  All
+ * integers in the header are stored in little-endian byte order:
+ *
+ *     0  magic             8 bytes
+ *     8  version           uint32
+ *    12  signature size    uint32
+ *    16  message size      uint64
+ *    24  hash algorithm    L1_BUNDLE_ALGO_NAME_LEN bytes, NUL-padded name
+ *    56  message digest    L1_BUNDLE_ALGO_NAME_LEN bytes, NUL-padded name
+ *
+ * The remainder of the header is zero.
+ */
+struct l1_bundle {
+	int digest;
+	int algo;
+	unsigned int sig_nbytes;
+	uint64_t msg_nbytes;
+};
+
+/*
+ * The message of a bundle, which is kept until it is known whether it may be
+ * released.  It is written directly to 'out' if that is written to a
+ * temporary file, which only replaces the output once it is committed, and
+ * otherwise copied to 'buf' or the temporary file 'file'.  Only the bytes
+ * that have been hashed are kept, so the message that is released is always
+ * the one that was verified.
+ */
+struct l1_bundle_spool {
+	struct l1_out *out;
+	FILE *file;
+	unsigned char *buf;
+	size_t len;
+	uint64_t nbytes;
+};
+
+void l1_bundle_encode_header(const struct l1_bundle *bundle,
+		unsigned char *buf);
+bool l1_bundle_decode_header(struct l1_bundle *bundle, const unsigned char *buf,
+		const char *desc);
+void l1_bundle_spool_init(struct l1_bundle_spool *spool, struct l1_out *out);
+bool l1_bundle_spool_hash(struct l1_bundle_spool *spool, FILE *in,
+		gcry_md_hd_t hd, uint64_t max_nbytes);
+bool l1_bundle_spool_flush(struct l1_bundle_spool *spool, struct l1_out *out);
+void l1_bundle_spool_free(struct l1_bundle_spool *spool);
+
+#endif
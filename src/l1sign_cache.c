@@ -0,0 +1,242 @@
+/*
+ * l1sign - Implementation of the Lamport-Diffie one-time signature scheme
+ * Copyright (c) 2019  Janik Rabe <info@janikrabe.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "l1sign_cache.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+static size_t cache_nbytes(uint32_t nsets) {
+	return sizeof (struct l1_cache_header)
+		+ (size_t) nsets * L1_CACHE_NWAYS * sizeof (struct l1_cache_entry);
+}
+
+/*
+ * Create an empty cache in the zero-length file 'fd'.  The entries are left
+ * as a hole, so an unused cache does not occupy any disk space.
+ */
+static bool cache_init(int fd) {
+	struct l1_cache_header header = { 0 };
+
+	memcpy(header.magic, L1_CACHE_MAGIC, sizeof header.magic);
+	header.version = L1_CACHE_VERSION;
+	header.nsets = L1_CACHE_NSETS;
+	header.entry_nbytes = sizeof (struct l1_cache_entry);
+
+	if (ftruncate(fd, cache_nbytes(header.nsets))) {
+		return false;
+	}
+
+	return pwrite(fd, &header, sizeof header, 0) == sizeof header;
+}
+
+static bool cache_check(int fd, off_t nbytes) {
+	struct l1_cache_header header;
+
+	if (pread(fd, &header, sizeof header, 0) != sizeof header) {
+		return false;
+	}
+
+	return !memcmp(header.magic, L1_CACHE_MAGIC, sizeof header.magic)
+		&& header.version == L1_CACHE_VERSION
+		&& header.entry_nbytes == sizeof (struct l1_cache_entry)
+		&& header.nsets > 0
+		&& (size_t) nbytes == cache_nbytes(header.nsets);
+}
+
+/*
+ * Open or create the verification cache 'filename' and map it into memory.
+ * Returns NULL (after printing a warning) if the cache cannot be used.
+ */
+struct l1_cache *l1_cache_open(const char *filename) {
+	struct l1_cache *cache = calloc(1, sizeof *cache);
+	struct stat st;
+	bool ok;
+
+	if (!cache) {
+		fprintf(stderr, "Failed to allocate memory\n");
+		return NULL;
+	}
+
+	if ((cache->fd = open(filename, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) < 0) {
+		perror("Warning: Failed to open verification cache");
+		free(cache);
+		return NULL;
+	}
+
+	if (flock(cache->fd, LOCK_EX) || fstat(cache->fd, &st)) {
+		perror("Warning: Failed to lock verification cache");
+		l1_cache_close(cache);
+		return NULL;
+	}
+
+	if (st.st_size == 0) {
+		ok = cache_init(cache->fd) && !fstat(cache->fd, &st);
+	} else {
+		ok = cache_check(cache->fd, st.st_size);
+	}
+
+	flock(cache->fd, LOCK_UN);
+
+	if (!ok) {
+		fprintf(stderr, "Warning: Ignoring invalid verification cache\n");
+		l1_cache_close(cache);
+		return NULL;
+	}
+
+	cache->nbytes = st.st_size;
+	cache->header = mmap(NULL, cache->nbytes, PROT_READ | PROT_WRITE,
+			MAP_SHARED, cache->fd, 0);
+
+	if (cache->header == MAP_FAILED) {
+		perror("Warning: Failed to map verification cache");
+		cache->header = NULL;
+		l1_cache_close(cache);
+		return NULL;
+	}
+
+	cache->entries = (struct l1_cache_entry *) (cache->header + 1);
+	return cache;
+}
+
+void l1_cache_close(struct l1_cache *cache) {
+	if (cache->header) {
+		munmap(cache->header, cache->nbytes);
+	}
+
+	close(cache->fd);
+	free(cache);
+}
+
+static struct l1_cache_entry *cache_set(struct l1_cache *cache,
+		const unsigned char *key) {
+	uint64_t idx;
+
+	memcpy(&idx, key, sizeof idx);
+	return &cache->entries[(idx % cache->header->nsets) * L1_CACHE_NWAYS];
+}
+
+/*
+ * A message modified within the second in which the entry was stored may
+ * still have the recorded size and timestamp, so only older files are trusted.
+ */
+static bool cache_identity_matches(const struct l1_cache_entry *entry,
+		const struct stat *st) {
+	return entry->msg_dev == (uint64_t) st->st_dev
+		&& entry->msg_ino == (uint64_t) st->st_ino
+		&& entry->msg_size == (uint64_t) st->st_size
+		&& entry->msg_mtime_sec == st->st_mtim.tv_sec
+		&& entry->msg_mtime_nsec == st->st_mtim.tv_nsec
+		&& entry->msg_mtime_sec < entry->stored_sec;
+}
+
+/*
+ * Look up the verdict for 'key'.  An entry is only considered a hit if the
+ * message matches the one it was stored for, either by file identity
+ * ('msg_st') or by the fingerprint of its digest ('msg_fpr').  Either may be
+ * NULL.
+ */
+bool l1_cache_lookup(struct l1_cache *cache, const unsigned char *key,
+		const struct stat *msg_st, const unsigned char *msg_fpr,
+		bool *valid) {
+	struct l1_cache_entry *set = cache_set(cache, key);
+	bool hit = false;
+
+	flock(cache->fd, LOCK_EX);
+
+	for (unsigned int i = 0; i < L1_CACHE_NWAYS; ++i) {
+		struct l1_cache_entry *entry = &set[i];
+
+		if (!entry->in_use || memcmp(entry->key, key, sizeof entry->key)) {
+			continue;
+		}
+
+		if ((msg_st && cache_identity_matches(entry, msg_st))
+				|| (msg_fpr && !memcmp(entry->msg_fpr, msg_fpr,
+						sizeof entry->msg_fpr))) {
+			entry->last_used = ++cache->header->clock;
+			*valid = entry->valid;
+			hit = true;
+		}
+
+		break;
+	}
+
+	flock(cache->fd, LOCK_UN);
+	return hit;
+}
+
+/*
+ * Record a verdict, replacing the entry for the same key or, if there is
+ * none, the least recently used entry of its set.
+ */
+void l1_cache_store(struct l1_cache *cache, const unsigned char *key,
+		const struct stat *msg_st, const unsigned char *msg_fpr,
+		bool valid) {
+	struct l1_cache_entry *set = cache_set(cache, key);
+	struct l1_cache_entry *victim = NULL;
+
+	flock(cache->fd, LOCK_EX);
+
+	for (unsigned int i = 0; i < L1_CACHE_NWAYS && !victim; ++i) {
+		if (set[i].in_use && !memcmp(set[i].key, key, sizeof set[i].key)) {
+			victim = &set[i];
+		}
+	}
+
+	for (unsigned int i = 0; i < L1_CACHE_NWAYS && !victim; ++i) {
+		if (!set[i].in_use) {
+			victim = &set[i];
+		}
+	}
+
+	if (!victim) {
+		victim = &set[0];
+
+		for (unsigned int i = 1; i < L1_CACHE_NWAYS; ++i) {
+			if (set[i].last_used < victim->last_used) {
+				victim = &set[i];
+			}
+		}
+	}
+
+	memset(victim, 0, sizeof *victim);
+	memcpy(victim->key, key, sizeof victim->key);
+	memcpy(victim->msg_fpr, msg_fpr, sizeof victim->msg_fpr);
+
+	if (msg_st) {
+		victim->msg_dev = msg_st->st_dev;
+		victim->msg_ino = msg_st->st_ino;
+		victim->msg_size = msg_st->st_size;
+		victim->msg_mtime_sec = msg_st->st_mtim.tv_sec;
+		victim->msg_mtime_nsec = msg_st->st_mtim.tv_nsec;
+		victim->stored_sec = time(NULL);
+	}
+
+	victim->valid = valid;
+	victim->last_used = ++cache->header->clock;
+	victim->in_use = 1;
+
+	flock(cache->fd, LOCK_UN);
+}
@@ -0,0 +1,79 @@
+/*
+ * l1sign - Implementation of the Lamport-Diffie one-time signature scheme
+ * Copyright (c) 2019  Janik Rabe <info@janikrabe.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef L1SIGN_CACHE_H
+#define L1SIGN_CACHE_H
+
+#include <config.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#define L1_CACHE_MAGIC "L1VCACHE"
+#define L1_CACHE_VERSION 1
+#define L1_CACHE_NSETS 4096
+#define L1_CACHE_NWAYS 8
+
+#define L1_CACHE_KEY_NBYTES 32
+
+/*
+ * The cache file consists of a header followed by 'nsets' sets of
+ * L1_CACHE_NWAYS entries each.  All integers are stored in host byte order.
+ */
+struct l1_cache_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t nsets;
+	uint32_t entry_nbytes;
+	uint32_t reserved;
+	uint64_t clock;
+};
+
+struct l1_cache_entry {
+	unsigned char key[L1_CACHE_KEY_NBYTES];
+	unsigned char msg_fpr[L1_CACHE_KEY_NBYTES];
+	uint64_t msg_dev;
+	uint64_t msg_ino;
+	uint64_t msg_size;
+	int64_t msg_mtime_sec;
+	int64_t msg_mtime_nsec;
+	int64_t stored_sec;
+	uint64_t last_used;
+	uint32_t in_use;
+	uint32_t valid;
+};
+
+struct l1_cache {
+	int fd;
+	struct l1_cache_header *header;
+	struct l1_cache_entry *entries;
+	size_t nbytes;
+};
+
+struct l1_cache *l1_cache_open(const char *filename);
+void l1_cache_close(struct l1_cache *cache);
+bool l1_cache_lookup(struct l1_cache *cache, const unsigned char *key,
+		const struct stat *msg_st, const unsigned char *msg_fpr,
+		bool *valid);
+void l1_cache_store(struct l1_cache *cache, const unsigned char *key,
+		const struct stat *msg_st, const unsigned char *msg_fpr,
+		bool valid);
+
+#endif
@@ -0,0 +1,318 @@
+/*
+ * l1sign - Implementation of the Lamport-Diffie one-time signature scheme
+ * Copyright (c) 2019  Janik Rabe <info@janikrabe.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "l1sign_checkpoint.h"
+
+#include "l1sign_out.h"
+#include "l1sign_stats.h"
+#include "l1sign_util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+struct chunks {
+	unsigned char *digests;
+	uint64_t nchunks;
+	uint64_t capacity;
+	unsigned int digest_nbytes;
+};
+
+static bool checkpoint_checksum(const struct l1_checkpoint_header *header,
+		const struct chunks *chunks, unsigned char *out) {
+	struct l1_checkpoint_header copy = *header;
+	gcry_md_hd_t hd;
+
+	if (!(hd = l1_gcry_hash_hd_create(L1_FPR_ALGO, false))) {
+		return false;
+	}
+
+	memset(copy.checksum, 0, sizeof copy.checksum);
+	gcry_md_write(hd, &copy, sizeof copy);
+	gcry_md_write(hd, chunks->digests,
+			(size_t) chunks->nchunks * chunks->digest_nbytes);
+	memcpy(out, gcry_md_read(hd, GCRY_MD_NONE), L1_FPR_NBYTES);
+
+	l1_gcry_hash_hd_destroy(hd);
+	return true;
+}
+
+static bool chunks_reserve(struct chunks *chunks, uint64_t nchunks) {
+	unsigned char *digests;
+	uint64_t capacity = chunks->capacity ? chunks->capacity : 64;
+
+	if (nchunks <= chunks->capacity) {
+		return true;
+	}
+
+	while (capacity < nchunks) {
+		capacity *= 2;
+	}
+
+	if (capacity > SIZE_MAX / chunks->digest_nbytes || !(digests = realloc(
+					chunks->digests, capacity * chunks->digest_nbytes))) {
+		fprintf(stderr, "Failed to allocate memory\n");
+		return false;
+	}
+
+	chunks->digests = digests;
+	chunks->capacity = capacity;
+	return true;
+}
+
+/*
+ * Load the chunk digests of checkpoint file 'filename'.  A missing or invalid
+ * checkpoint is treated like an empty one.  Returns false if the checkpoint
+ * is invalid and should be replaced.
+ */
+static bool checkpoint_load(const char *filename, int digest,
+		struct chunks *chunks) {
+	struct l1_checkpoint_header header;
+	unsigned char checksum[L1_FPR_NBYTES];
+	size_t nbytes;
+	struct stat st;
+	bool valid = false;
+	int fd;
+
+	if ((fd = open(filename, O_RDONLY | O_CLOEXEC)) < 0) {
+		if (errno != ENOENT) {
+			perror("Warning: Failed to open checkpoint file");
+		}
+
+		return true;
+	}
+
+	if (fstat(fd, &st) || pread(fd, &header, sizeof header, 0)
+			!= sizeof header) {
+		goto out;
+	}
+
+	l1_stats_read(sizeof header);
+
+	if (memcmp(header.magic, L1_CHECKPOINT_MAGIC, sizeof header.magic)
+			|| header.version != L1_CHECKPOINT_VERSION
+			|| header.digest != digest
+			|| header.digest_nbytes != chunks->digest_nbytes
+			|| header.chunk_nbytes != L1_CHECKPOINT_CHUNK_NBYTES
+			|| header.nchunks > (SIZE_MAX - sizeof header)
+				/ chunks->digest_nbytes) {
+		goto out;
+	}
+
+	nbytes = header.nchunks * chunks->digest_nbytes;
+
+	if ((uint64_t) st.st_size != sizeof header + nbytes
+			|| !chunks_reserve(chunks, header.nchunks)
+			|| pread(fd, chunks->digests, nbytes, sizeof header)
+				!= (ssize_t) nbytes) {
+		goto out;
+	}
+
+	l1_stats_read(nbytes);
+	chunks->nchunks = header.nchunks;
+
+	if (checkpoint_checksum(&header, chunks, checksum)
+			&& !memcmp(checksum, header.checksum, sizeof checksum)) {
+		valid = true;
+	}
+
+out:
+	if (!valid) {
+		fprintf(stderr, "Warning: Ignoring invalid checkpoint file\n");
+		chunks->nchunks = 0;
+	}
+
+	close(fd);
+	return valid;
+}
+
+/*
+ * Replace the checkpoint file 'filename'.  Failures only cause a warning,
+ * since the checkpoint can be recreated at any time.
+ */
+static void checkpoint_save(const char *filename, int digest,
+		const struct chunks *chunks) {
+	struct l1_checkpoint_header header = { 0 };
+	struct l1_out out;
+
+	memcpy(header.magic, L1_CHECKPOINT_MAGIC, sizeof header.magic);
+	header.version = L1_CHECKPOINT_VERSION;
+	header.digest = digest;
+	header.digest_nbytes = chunks->digest_nbytes;
+	header.chunk_nbytes = L1_CHECKPOINT_CHUNK_NBYTES;
+	header.nchunks = chunks->nchunks;
+
+	if (!checkpoint_checksum(&header, chunks, header.checksum)) {
+		return;
+	}
+
+	struct iovec iov[2] = {
+		{ &header, sizeof header },
+		{ chunks->digests, (size_t) chunks->nchunks * chunks->digest_nbytes },
+	};
+
+	if (!l1_out_open(&out, filename)) {
+		perror("Warning: Failed to open checkpoint file");
+	} else if (!l1_out_writev(&out, iov, 2)) {
+		perror("Warning: Failed to write checkpoint file");
+		l1_out_abort(&out);
+	} else if (!l1_out_commit(&out)) {
+		perror("Warning: Failed to write checkpoint file");
+	}
+}
+
+/*
+ * Read the chunk at 'offset', which is only shorter than a full chunk at the
+ * end of the file.
+ */
+static ssize_t read_chunk(int fd, unsigned char *buf, off_t offset) {
+	size_t nbytes = 0;
+
+	while (nbytes < L1_CHECKPOINT_CHUNK_NBYTES) {
+		ssize_t len = pread(fd, buf + nbytes,
+				L1_CHECKPOINT_CHUNK_NBYTES - nbytes, offset + nbytes);
+
+		if (len < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if (len < 0) {
+			return -1;
+		}
+
+		if (!len) {
+			break;
+		}
+
+		l1_stats_read(len);
+		nbytes += len;
+	}
+
+	return nbytes;
+}
+
+/*
+ * Compute the chunked message digest of 'in', which must be a regular file,
+ * and write its first 'nbytes' bytes to 'out'.  Only chunks that are not
+ * covered by the checkpoint file 'filename' are hashed, and the checkpoint is
+ * updated to cover all complete chunks.  The last chunk of the checkpoint is
+ * hashed again to detect files that have been replaced or rewritten.  If
+ * 'filename' is NULL, all chunks are hashed.
+ */
+bool l1_checkpoint_hash_file(int digest, FILE *in, const char *filename,
+		unsigned char *out, unsigned int nbytes) {
+	struct chunks chunks = { NULL, 0, 0, nbytes };
+	unsigned char tail[L1_MAX_HASH_NBYTES];
+	unsigned char chunk_nbytes[4];
+	unsigned char *buf = NULL;
+	gcry_md_hd_t hd = NULL;
+	ssize_t tail_nbytes = 0;
+	uint64_t nsaved;
+	struct stat st;
+	bool rewrite;
+	bool ret = false;
+	int fd = fileno(in);
+
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+		fprintf(stderr, "The chunked message digest requires a regular "
+				"message file\n");
+		return false;
+	}
+
+	if (!(buf = malloc(L1_CHECKPOINT_CHUNK_NBYTES))) {
+		fprintf(stderr, "Failed to allocate memory\n");
+		return false;
+	}
+
+	rewrite = filename && !checkpoint_load(filename, digest, &chunks);
+
+	if (chunks.nchunks) {
+		off_t offset = (off_t) (chunks.nchunks - 1)
+			* L1_CHECKPOINT_CHUNK_NBYTES;
+		unsigned char *last = chunks.digests
+			+ (size_t) (chunks.nchunks - 1) * nbytes;
+
+		if (read_chunk(fd, buf, offset) != L1_CHECKPOINT_CHUNK_NBYTES
+				|| !l1_gcry_hash_buffer(digest, tail, nbytes, buf,
+					L1_CHECKPOINT_CHUNK_NBYTES)
+				|| memcmp(tail, last, nbytes)) {
+			fprintf(stderr, "Warning: Ignoring checkpoint of a different "
+					"message\n");
+			chunks.nchunks = 0;
+			rewrite = true;
+		}
+	}
+
+	nsaved = chunks.nchunks;
+
+	for (;;) {
+		ssize_t len = read_chunk(fd, buf,
+				(off_t) chunks.nchunks * L1_CHECKPOINT_CHUNK_NBYTES);
+
+		if (len < 0) {
+			perror("Failed to read message");
+			goto out;
+		}
+
+		if (len < L1_CHECKPOINT_CHUNK_NBYTES) {
+			tail_nbytes = len;
+			break;
+		}
+
+		if (!chunks_reserve(&chunks, chunks.nchunks + 1)
+				|| !l1_gcry_hash_buffer(digest, chunks.digests
+					+ (size_t) chunks.nchunks * nbytes, nbytes, buf, len)) {
+			goto out;
+		}
+
+		++chunks.nchunks;
+	}
+
+	if ((tail_nbytes && !l1_gcry_hash_buffer(digest, tail, nbytes, buf,
+					tail_nbytes))
+			|| !(hd = l1_gcry_hash_hd_create(digest, false))) {
+		goto out;
+	}
+
+	l1_put_le32(chunk_nbytes, L1_CHECKPOINT_CHUNK_NBYTES);
+	gcry_md_write(hd, L1_CHECKPOINT_PREFIX, sizeof L1_CHECKPOINT_PREFIX);
+	gcry_md_write(hd, chunk_nbytes, sizeof chunk_nbytes);
+	gcry_md_write(hd, chunks.digests, (size_t) chunks.nchunks * nbytes);
+
+	if (tail_nbytes) {
+		gcry_md_write(hd, tail, nbytes);
+	}
+
+	l1_gcry_hash_read(hd, out, nbytes);
+	l1_gcry_hash_hd_destroy(hd);
+
+	if (filename && (rewrite || chunks.nchunks != nsaved)) {
+		checkpoint_save(filename, digest, &chunks);
+	}
+
+	ret = true;
+
+out:
+	free(chunks.digests);
+	free(buf);
+	return ret;
+}
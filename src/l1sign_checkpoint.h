@@ -0,0 +1,60 @@
+/*
+ * l1sign - Implementation of the Lamport-Diffie one-time signature scheme
+ * Copyright (c) 2019  Janik Rabe <info@janikrabe.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef L1SIGN_CHECKPOINT_H
+#define L1SIGN_CHECKPOINT_H
+
+#include <config.h>
+
+#include "l1sign_gcrypt.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define L1_CHECKPOINT_MAGIC "L1CHKPNT"
+#define L1_CHECKPOINT_VERSION 1
+#define L1_CHECKPOINT_CHUNK_NBYTES (1 << 20)
+#define L1_CHECKPOINT_PREFIX "l1sign-chunked"
+
+/*
+ * The chunked message digest of a file is the digest of L1_CHECKPOINT_PREFIX
+ * (including its terminating NUL), the chunk size as a little-endian uint32,
+ * and the digests of all chunks of L1_CHECKPOINT_CHUNK_NBYTES bytes, where
+ * only the last chunk may be shorter.  An empty file has no chunks.
+ *
+ * A checkpoint file stores the digests of the complete chunks of a file, so
+ * that only data appended since can be hashed.  It consists of the following
+ * header, in host byte order, followed by 'nchunks' chunk digests of
+ * 'digest_nbytes' bytes each.  The checksum is the SHA-256 hash of the header,
+ * with the checksum set to zero, and the chunk digests.
+ */
+struct l1_checkpoint_header {
+	char magic[8];
+	uint32_t version;
+	int32_t digest;
+	uint32_t digest_nbytes;
+	uint32_t chunk_nbytes;
+	uint64_t nchunks;
+	unsigned char checksum[L1_FPR_NBYTES];
+};
+
+bool l1_checkpoint_hash_file(int digest, FILE *in, const char *filename,
+		unsigned char *out, unsigned int nbytes);
+
+#endif
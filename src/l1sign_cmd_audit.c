@@ -0,0 +1,423 @@
+/*
+ * l1sign - Implementation of the Lamport-Diffie one-time signature scheme
+ * Copyright (c) 2019  Janik Rabe <info@janikrabe.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "l1sign_cmd_audit.h"
+
+#include "l1sign_audit.h"
+#include "l1sign_gcrypt.h"
+#include "l1sign_hash.h"
+#include "l1sign_keyring.h"
+#include "l1sign_manifest.h"
+#include "l1sign_msig.h"
+#include "l1sign_ots.h"
+#include "l1sign_pool.h"
+#include "l1sign_stats.h"
+#include "l1sign_util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CMD_NAME "audit"
+
+/*
+ * Signature files are scanned in batches, which bounds the memory used for
+ * results that have not been recorded yet.
+ */
+#define AUDIT_BATCH_NFILES 4096
+
+struct audit_sig {
+	unsigned char key_fpr[L1_FPR_NBYTES];
+	unsigned char digest_fpr[L1_FPR_NBYTES];
+};
+
+struct audit_file {
+	struct audit_sig *sigs;
+	unsigned int nsigs;
+	unsigned int nunknown;
+	unsigned int ninvalid;
+	bool recorded;
+	bool ignored;
+	bool failed;
+};
+
+struct audit_ctx {
+	const struct l1_hash_backend *backend;
+	struct l1_keyring *ring;
+	const struct l1_audit *audit;
+	const struct l1_manifest *files;
+	struct audit_file *results;
+	size_t first;
+	int root_fd;
+	unsigned int hash_nbytes;
+	unsigned int nbits;
+	unsigned int sig_nbytes;
+	unsigned int key_nbytes;
+};
+
+struct audit_match_ctx {
+	const unsigned char *hash;
+	unsigned int hash_nbytes;
+	unsigned int key_nbytes;
+	struct l1_map *map;
+	unsigned char *pubkey;
+};
+
+/*
+ * Accept a keyring candidate if the hash of the first signature block matches
+ * either of its first two blocks.
+ */
+static bool audit_keyring_match(const char *filename, off_t offset,
+		void *arg) {
+	struct audit_match_ctx *ctx = arg;
+	struct stat st;
+	unsigned char *pubkey = NULL;
+	int fd;
+
+	if ((fd = open(filename, O_RDONLY | O_CLOEXEC)) < 0) {
+		return false;
+	}
+
+	if (!fstat(fd, &st) && st.st_size >= offset + ctx->key_nbytes) {
+		pubkey = l1_map_range(fd, offset, ctx->key_nbytes, ctx->map);
+	}
+
+	close(fd);
+
+	if (!pubkey) {
+		return false;
+	}
+
+	if (memcmp(pubkey, ctx->hash, ctx->hash_nbytes)
+			&& memcmp(pubkey + ctx->hash_nbytes, ctx->hash, ctx->hash_nbytes)) {
+		l1_unmap(ctx->map);
+		return false;
+	}
+
+	ctx->pubkey = pubkey;
+	return true;
+}
+
+/*
+ * Identify the key of signature 'sig' and the digest that it signed.
+ * Signatures of keys outside the keyring are counted as unknown.
+ */
+static void audit_signature(struct audit_ctx *ctx, struct l1_hash *hash,
+		const unsigned char *sig, struct audit_file *file) {
+	unsigned char block[L1_MAX_HASH_NBYTES];
+	unsigned char digest[L1_MAX_HASH_NBYTES];
+	struct l1_map map = { 0 };
+	struct audit_match_ctx match = {
+		block, ctx->hash_nbytes, ctx->key_nbytes, &map, NULL,
+	};
+	struct audit_sig *out = &file->sigs[file->nsigs];
+
+	if (!l1_ots_hash_block(hash, sig, ctx->hash_nbytes, block)) {
+		++file->ninvalid;
+		return;
+	}
+
+	if (!l1_keyring_find(ctx->ring, block, audit_keyring_match, &match)) {
+		++file->nunknown;
+		return;
+	}
+
+	if (!l1_ots_recover(hash, sig, match.pubkey, ctx->hash_nbytes, ctx->nbits,
+				digest)) {
+		++file->ninvalid;
+	} else {
+		gcry_md_hash_buffer(L1_FPR_ALGO, out->key_fpr, match.pubkey,
+				ctx->key_nbytes);
+		gcry_md_hash_buffer(L1_FPR_ALGO, out->digest_fpr, digest,
+				ctx->nbits / 8);
+		++file->nsigs;
+	}
+
+	l1_unmap(&map);
+}
+
+/*
+ * Scan file 'idx' of the current batch.  Files that are neither signatures
+ * nor multi-signature files of the keyring's parameters are ignored.
+ */
+static bool audit_file(size_t idx, void *arg) {
+	struct audit_ctx *ctx = arg;
+	struct audit_file *file = &ctx->results[idx];
+	const char *path = ctx->files->entries[ctx->first + idx].path;
+
+	struct l1_map map = { 0 };
+	struct l1_msig msig = { 0, 0, 1, ctx->sig_nbytes };
+	const unsigned char *data;
+	struct l1_hash *hash = NULL;
+	size_t offset = 0;
+	struct stat st;
+	int fd;
+
+	if ((fd = openat(ctx->root_fd, path, O_RDONLY | O_CLOEXEC)) < 0
+			|| fstat(fd, &st)) {
+		fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+		file->failed = true;
+
+		if (fd >= 0) {
+			close(fd);
+		}
+
+		return true;
+	}
+
+	if (l1_audit_is_recorded(ctx->audit, &st.st_ctim)) {
+		file->recorded = true;
+		close(fd);
+		return true;
+	}
+
+	if (!S_ISREG(st.st_mode) || st.st_size < (off_t) ctx->sig_nbytes
+			|| !(data = l1_map_range(fd, 0, st.st_size, &map))) {
+		file->ignored = true;
+		close(fd);
+		return true;
+	}
+
+	close(fd);
+	l1_stats_read(st.st_size);
+
+	if ((size_t) st.st_size >= L1_MSIG_HEADER_NBYTES
+			&& !memcmp(data, L1_MSIG_MAGIC, strlen(L1_MSIG_MAGIC))) {
+		offset = L1_MSIG_HEADER_NBYTES;
+
+		if (!l1_msig_decode_header(&msig, data, path)
+				|| msig.digest != ctx->ring->digest
+				|| msig.algo != ctx->ring->algo) {
+			msig.sig_nbytes = 0;
+		}
+	}
+
+	if (msig.sig_nbytes != ctx->sig_nbytes || (size_t) st.st_size
+			!= offset + (size_t) msig.nsigs * ctx->sig_nbytes) {
+		file->ignored = true;
+		l1_unmap(&map);
+		return true;
+	}
+
+	if (!(file->sigs = calloc(msig.nsigs, sizeof *file->sigs))
+			|| !(hash = l1_hash_create(ctx->backend,
+					ctx->ring->algo, ctx->hash_nbytes, false))) {
+		fprintf(stderr, "Failed to scan %s\n", path);
+		file->failed = true;
+		l1_unmap(&map);
+		return true;
+	}
+
+	for (unsigned int i = 0; i < msig.nsigs; ++i) {
+		audit_signature(ctx, hash, data + offset
+				+ (size_t) i * ctx->sig_nbytes, file);
+	}
+
+	l1_hash_destroy(hash);
+	l1_unmap(&map);
+	return true;
+}
+
+struct audit_totals {
+	size_t nsigs;
+	size_t nrecorded;
+	size_t nignored;
+	size_t nunknown;
+	size_t ninvalid;
+	bool failed;
+};
+
+/*
+ * Record the signatures of a scanned batch in file order and report reused
+ * keys.
+ */
+static void record_batch(struct l1_audit *audit, const struct audit_ctx *ctx,
+		size_t nfiles, struct audit_totals *totals) {
+	for (size_t i = 0; i < nfiles; ++i) {
+		struct audit_file *file = &ctx->results[i];
+		const char *path = ctx->files->entries[ctx->first + i].path;
+
+		totals->nrecorded += file->recorded;
+		totals->nignored += file->ignored;
+		totals->nunknown += file->nunknown;
+		totals->failed |= file->failed;
+
+		for (unsigned int j = 0; j < file->ninvalid; ++j) {
+			fprintf(stderr, "Invalid signature: %s\n", path);
+			++totals->ninvalid;
+		}
+
+		for (unsigned int j = 0; j < file->nsigs && !totals->failed; ++j) {
+			struct audit_sig *sig = &file->sigs[j];
+
+			switch (l1_audit_record(audit, sig->key_fpr, sig->digest_fpr)) {
+			case L1_AUDIT_ERROR:
+				totals->failed = true;
+				break;
+			case L1_AUDIT_REUSED:
+				printf("Key reuse in %s, key fingerprint: ", path);
+				l1_gcry_print_digest(stdout, sig->key_fpr, L1_FPR_NBYTES);
+				break;
+			case L1_AUDIT_NEW:
+			case L1_AUDIT_SEEN:
+				break;
+			}
+
+			++totals->nsigs;
+		}
+
+		free(file->sigs);
+	}
+}
+
+int l1_cmd_audit(const struct options *opts, int argc, char **argv) {
+	L1_OPT_ACCEPT(CMD_NAME, opts->keyring, L1_OPT_NAME_KEYRING);
+	L1_OPT_REJECT(CMD_NAME, opts->bundle, L1_OPT_NAME_BUNDLE);
+	L1_OPT_REJECT(CMD_NAME, opts->burn, L1_OPT_NAME_BURN);
+	L1_OPT_REJECT(CMD_NAME, opts->key_fd, L1_OPT_NAME_KEY_FD);
+	L1_OPT_REJECT(CMD_NAME, opts->cache, L1_OPT_NAME_CACHE);
+	L1_OPT_REJECT(CMD_NAME, opts->checkpoint, L1_OPT_NAME_CHECKPOINT);
+	L1_OPT_REJECT(CMD_NAME, opts->chunked, L1_OPT_NAME_CHUNKED);
+	L1_OPT_REJECT(CMD_NAME, opts->nkeys, L1_OPT_NAME_KEY);
+	L1_OPT_REJECT(CMD_NAME, opts->message, L1_OPT_NAME_MESSAGE);
+	L1_OPT_REJECT(CMD_NAME, opts->pubkey, L1_OPT_NAME_PUBKEY);
+	L1_OPT_REJECT(CMD_NAME, opts->threshold, L1_OPT_NAME_THRESHOLD);
+	L1_OPT_REJECT(CMD_NAME, opts->key_format, L1_OPT_NAME_FORMAT);
+	L1_OPT_REJECT(CMD_NAME, opts->scheme, L1_OPT_NAME_SCHEME);
+	L1_OPT_REJECT(CMD_NAME, opts->tee, L1_OPT_NAME_TEE);
+	L1_OPT_REJECT(CMD_NAME, opts->tee_fd, L1_OPT_NAME_TEE_FD);
+
+	if (argc != 2) {
+		print_cmd_usage(CMD_NAME " <index-file> <directory>");
+		return EXIT_FAILURE;
+	}
+
+	char *index_filename = argv[0];
+	char *dirname = argv[1];
+
+	int retval = EXIT_FAILURE;
+
+	struct audit_totals totals = { 0 };
+	struct audit_ctx ctx = { 0 };
+	struct l1_manifest files;
+	struct l1_keyring *ring;
+	struct l1_audit *audit;
+	struct timespec start;
+	enum l1_stats_phase phase;
+
+	/*
+	 * Signature files that change while they are scanned are scanned again
+	 * by the next audit.
+	 */
+	clock_gettime(CLOCK_REALTIME, &start);
+
+	/*
+	 * The keyring is searched from several threads, so it cannot be updated
+	 * on demand; keys appended to existing files are picked up here.
+	 */
+	if (!(ring = l1_keyring_open(opts->keyring, opts->digest, opts->hash,
+					opts->hash_nbytes, true))) {
+		return EXIT_FAILURE;
+	}
+
+	if (!(audit = l1_audit_open(index_filename))) {
+		l1_keyring_close(ring);
+		return EXIT_FAILURE;
+	}
+
+	l1_manifest_init(&files, 0);
+	l1_manifest_exclude(&files, index_filename);
+
+	ctx.backend = opts->hash_backend;
+	ctx.ring = ring;
+	ctx.audit = audit;
+	ctx.files = &files;
+	ctx.hash_nbytes = opts->hash_nbytes;
+	ctx.nbits = l1_gcry_digest_nbytes(opts->digest, opts->hash,
+			opts->hash_nbytes) * 8;
+	ctx.sig_nbytes = ctx.hash_nbytes * ctx.nbits;
+	ctx.key_nbytes = ctx.sig_nbytes * 2;
+
+	if ((ctx.root_fd = l1_manifest_collect(&files, dirname)) == -1
+			|| !l1_manifest_sort(&files)) {
+		goto out;
+	}
+
+	if (!(ctx.results = calloc(AUDIT_BATCH_NFILES, sizeof *ctx.results))) {
+		fprintf(stderr, "Failed to allocate memory\n");
+		goto out;
+	}
+
+	phase = l1_stats_phase(L1_PHASE_BLOCK_HASH);
+
+	for (ctx.first = 0; ctx.first < files.nentries && !totals.failed;
+			ctx.first += AUDIT_BATCH_NFILES) {
+		size_t nfiles = files.nentries - ctx.first;
+
+		if (nfiles > AUDIT_BATCH_NFILES) {
+			nfiles = AUDIT_BATCH_NFILES;
+		}
+
+		memset(ctx.results, 0, nfiles * sizeof *ctx.results);
+		l1_pool_run(opts->jobs, nfiles, audit_file, &ctx);
+		record_batch(audit, &ctx, nfiles, &totals);
+	}
+
+	l1_stats_phase(phase);
+
+	if (opts->verbose) {
+		fprintf(stderr, "Signatures: %zu (%zu invalid, %zu unknown keys)\n",
+				totals.nsigs + totals.ninvalid + totals.nunknown,
+				totals.ninvalid, totals.nunknown);
+		fprintf(stderr, "Files: %zu already audited, %zu ignored\n",
+				totals.nrecorded, totals.nignored);
+		fprintf(stderr, "Keys: %llu (%llu reused)\n",
+				(unsigned long long) audit->header->nkeys,
+				(unsigned long long) audit->header->nreused);
+	}
+
+	/*
+	 * Files that could not be scanned must be scanned by the next audit.
+	 */
+	if (!totals.failed) {
+		l1_audit_set_since(audit, &start);
+	}
+
+	/*
+	 * Reused keys keep failing the audit once they have been reported.
+	 */
+	if (!totals.failed && !audit->header->nreused) {
+		retval = EXIT_SUCCESS;
+	}
+
+out:
+	if (ctx.root_fd >= 0) {
+		close(ctx.root_fd);
+	}
+
+	free(ctx.results);
+	l1_manifest_free(&files);
+	l1_audit_close(audit);
+	l1_keyring_close(ring);
+	return retval;
+}
@@ -19,6 +19,11 @@
 #include "l1sign_cmd_genkey.h"
 
 #include "l1sign_gcrypt.h"
+#include "l1sign_hash.h"
+#include "l1sign_key.h"
+#include "l1sign_ots.h"
+#include "l1sign_out.h"
+#include "l1sign_stats.h"
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -29,19 +34,47 @@
 #define CMD_NAME "genkey"
 
 int l1_cmd_genkey(const struct options *opts, int argc, char **argv) {
+	L1_OPT_REJECT(CMD_NAME, opts->bundle, L1_OPT_NAME_BUNDLE);
+	L1_OPT_REJECT(CMD_NAME, opts->burn, L1_OPT_NAME_BURN);
+	L1_OPT_REJECT(CMD_NAME, opts->cache, L1_OPT_NAME_CACHE);
+	L1_OPT_REJECT(CMD_NAME, opts->checkpoint, L1_OPT_NAME_CHECKPOINT);
+	L1_OPT_REJECT(CMD_NAME, opts->chunked, L1_OPT_NAME_CHUNKED);
+	L1_OPT_REJECT(CMD_NAME, opts->nkeys, L1_OPT_NAME_KEY);
+	L1_OPT_REJECT(CMD_NAME, opts->keyring, L1_OPT_NAME_KEYRING);
 	L1_OPT_REJECT(CMD_NAME, opts->message, L1_OPT_NAME_MESSAGE);
-
-	if (argc > 1) {
-		print_cmd_usage(CMD_NAME " [output-file]");
+	L1_OPT_REJECT(CMD_NAME, opts->tee, L1_OPT_NAME_TEE);
+	L1_OPT_REJECT(CMD_NAME, opts->tee_fd, L1_OPT_NAME_TEE_FD);
+	L1_OPT_REJECT(CMD_NAME, opts->threshold, L1_OPT_NAME_THRESHOLD);
+
+	if (argc > (opts->key_fd ? 0 : 1)) {
+		print_cmd_usage(opts->key_fd
+				? CMD_NAME " --" L1_OPT_NAME_KEY_FD " <fd>"
+				: CMD_NAME " [output-file]");
 		return EXIT_FAILURE;
 	}
 
 	char *sec_filename = argv[0];
-	FILE *sec_file = stdout;
+	char *pub_filename = opts->pubkey;
+	struct l1_out sec_out;
+	struct l1_out pub_out;
+
+	int retval = EXIT_SUCCESS;
+
+	struct l1_hash *hash = NULL;
+	void *pubbuf = NULL;
 
-	unsigned int key_nbytes = l1_gcry_key_nbytes(opts->hash);
+	enum l1_key_format format = opts->key_format == L1_KEY_FORMAT_V1
+			|| (opts->key_format == L1_KEY_FORMAT_AUTO
+				&& opts->scheme == L1_KEY_SCHEME_HORS)
+		? L1_KEY_FORMAT_V1
+		: L1_KEY_FORMAT_RAW;
+	struct l1_key sec_key;
+	struct l1_key pub_key;
 
-	if (!sec_filename && isatty(STDOUT_FILENO)) {
+	unsigned int hash_nbytes = opts->hash_nbytes;
+	unsigned int key_nbytes;
+
+	if (!opts->key_fd && !sec_filename && isatty(STDOUT_FILENO)) {
 		fprintf(stderr, "Refusing implicit write to terminal\n");
 		return EXIT_FAILURE;
 	}
@@ -50,30 +83,157 @@ int l1_cmd_genkey(const struct options *opts, int argc, char **argv) {
 		sec_filename = NULL;
 	}
 
-	setvbuf(sec_file, NULL, _IONBF, 0);
+	if (pub_filename && !strcmp(pub_filename, "-")) {
+		if (!opts->key_fd && !sec_filename) {
+			fprintf(stderr, "Unable to write both secret and public key to "
+					"standard output\n");
+			return EXIT_FAILURE;
+		}
+
+		if (isatty(STDOUT_FILENO)) {
+			fprintf(stderr, "Refusing implicit write to terminal\n");
+			return EXIT_FAILURE;
+		}
+
+		pub_filename = NULL;
+	}
+
+	l1_key_init(&sec_key, format, L1_KEY_TYPE_SECRET, opts->digest,
+			opts->hash, hash_nbytes);
+	l1_key_init(&pub_key, format, L1_KEY_TYPE_PUBLIC, opts->digest,
+			opts->hash, hash_nbytes);
+
+	if (!l1_key_set_scheme(&sec_key, opts->scheme)
+			|| !l1_key_set_scheme(&pub_key, opts->scheme)) {
+		return EXIT_FAILURE;
+	}
+
+	key_nbytes = hash_nbytes * sec_key.nblocks;
+
+	if (!l1_gcry_secmem_init(key_nbytes, 1)) {
+		return EXIT_FAILURE;
+	}
+
+	/*
+	 * Version 1 keys carry the fingerprint of the public key, so it is
+	 * derived even if it is not saved.
+	 */
+	if (opts->pubkey || format == L1_KEY_FORMAT_V1) {
+		pubbuf = gcry_malloc(key_nbytes);
+
+		if (!pubbuf || !(hash = l1_hash_create(opts->hash_backend,
+				opts->hash, hash_nbytes, true))) {
+			fprintf(stderr, "Failed to prepare public key derivation\n");
+			gcry_free(pubbuf);
+			return EXIT_FAILURE;
+		}
+	}
+
 	umask(0177);
 
-	if (sec_filename && !(sec_file = fopen(sec_filename, "w"))) {
+	/*
+	 * With --key-fd, the secret key is written to a descriptor provided by
+	 * the caller, such as a memfd, and never reaches a named file.
+	 */
+	if (!opts->key_fd && !l1_out_open(&sec_out, sec_filename)) {
 		perror("Failed to open output file");
-		return EXIT_FAILURE;
+		retval = EXIT_FAILURE;
+		goto out;
 	}
 
+	l1_stats_phase(L1_PHASE_RANDOM);
+
 	void *key = gcry_random_bytes_secure(key_nbytes, GCRY_VERY_STRONG_RANDOM);
 
 	if (!key) {
 		fprintf(stderr, "Failed to generate key\n");
-		return EXIT_FAILURE;
+
+		if (!opts->key_fd) {
+			l1_out_abort(&sec_out);
+		}
+
+		retval = EXIT_FAILURE;
+		goto out;
 	}
 
-	if (!fwrite(key, key_nbytes, 1, sec_file)) {
-		fprintf(stderr, "Failed to write secret key\n");
-		return EXIT_FAILURE;
+	l1_stats_secmem(key_nbytes, 0);
+
+	/*
+	 * Derive the public key while the secret key is still in secure memory
+	 * rather than reading it back from the output file.
+	 */
+	if (pubbuf) {
+		l1_stats_phase(L1_PHASE_BLOCK_HASH);
+
+		if (!l1_ots_pubkey(hash, key, pubbuf, hash_nbytes,
+					key_nbytes / hash_nbytes)) {
+			fprintf(stderr, "Failed to derive public key\n");
+			l1_gcry_secmem_free(key, key_nbytes);
+
+			if (!opts->key_fd) {
+				l1_out_abort(&sec_out);
+			}
+
+			retval = EXIT_FAILURE;
+			goto out;
+		}
+
+		l1_stats.block_hashes += key_nbytes / hash_nbytes;
+
+		l1_key_set_fingerprint(&pub_key, pubbuf);
+		memcpy(sec_key.fingerprint, pub_key.fingerprint, L1_FPR_NBYTES);
 	}
 
-	if (sec_filename && fclose(sec_file)) {
-		perror("Failed to close output file");
-		return EXIT_FAILURE;
+	l1_stats_phase(L1_PHASE_WRITE);
+
+	if (opts->key_fd) {
+		if (!l1_key_write_fd(&sec_key, opts->key_fd, key)) {
+			perror("Failed to write secret key");
+			l1_gcry_secmem_free(key, key_nbytes);
+			retval = EXIT_FAILURE;
+			goto out;
+		}
+	} else if (!l1_key_write(&sec_key, &sec_out, key)) {
+		perror("Failed to write secret key");
+		l1_gcry_secmem_free(key, key_nbytes);
+		l1_out_abort(&sec_out);
+		retval = EXIT_FAILURE;
+		goto out;
+	}
+
+	l1_gcry_secmem_free(key, key_nbytes);
+
+	if (opts->verbose) {
+		l1_key_print_info(&sec_key, "Secret key");
+	}
+
+	if (!opts->key_fd && !l1_out_commit(&sec_out)) {
+		perror("Failed to save output file");
+		retval = EXIT_FAILURE;
+		goto out;
+	}
+
+	if (opts->pubkey) {
+		umask(0133);
+
+		if (!l1_out_open(&pub_out, pub_filename)) {
+			perror("Failed to open public key file");
+			retval = EXIT_FAILURE;
+		} else if (!l1_key_write(&pub_key, &pub_out, pubbuf)) {
+			perror("Failed to write to public key file");
+			l1_out_abort(&pub_out);
+			retval = EXIT_FAILURE;
+		} else if (!l1_out_commit(&pub_out)) {
+			perror("Failed to save public key file");
+			retval = EXIT_FAILURE;
+		}
+	}
+
+out:
+	if (hash) {
+		l1_hash_destroy(hash);
 	}
 
-	return EXIT_SUCCESS;
+	gcry_free(pubbuf);
+	return retval;
 }
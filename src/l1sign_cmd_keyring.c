@@ -0,0 +1,70 @@
+/*
+ * l1sign - Implementation of the Lamport-Diffie one-time signature scheme
+ * Copyright (c) 2019  Janik Rabe <info@janikrabe.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "l1sign_cmd_keyring.h"
+
+#include "l1sign_keyring.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#define CMD_NAME "keyring"
+
+int l1_cmd_keyring(const struct options *opts, int argc, char **argv) {
+	L1_OPT_REJECT(CMD_NAME, opts->bundle, L1_OPT_NAME_BUNDLE);
+	L1_OPT_REJECT(CMD_NAME, opts->burn, L1_OPT_NAME_BURN);
+	L1_OPT_REJECT(CMD_NAME, opts->key_fd, L1_OPT_NAME_KEY_FD);
+	L1_OPT_REJECT(CMD_NAME, opts->cache, L1_OPT_NAME_CACHE);
+	L1_OPT_REJECT(CMD_NAME, opts->checkpoint, L1_OPT_NAME_CHECKPOINT);
+	L1_OPT_REJECT(CMD_NAME, opts->chunked, L1_OPT_NAME_CHUNKED);
+	L1_OPT_REJECT(CMD_NAME, opts->nkeys, L1_OPT_NAME_KEY);
+	L1_OPT_REJECT(CMD_NAME, opts->keyring, L1_OPT_NAME_KEYRING);
+	L1_OPT_REJECT(CMD_NAME, opts->message, L1_OPT_NAME_MESSAGE);
+	L1_OPT_REJECT(CMD_NAME, opts->pubkey, L1_OPT_NAME_PUBKEY);
+	L1_OPT_REJECT(CMD_NAME, opts->tee, L1_OPT_NAME_TEE);
+	L1_OPT_REJECT(CMD_NAME, opts->tee_fd, L1_OPT_NAME_TEE_FD);
+	L1_OPT_REJECT(CMD_NAME, opts->threshold, L1_OPT_NAME_THRESHOLD);
+	L1_OPT_REJECT(CMD_NAME, opts->key_format, L1_OPT_NAME_FORMAT);
+	L1_OPT_REJECT(CMD_NAME, opts->scheme, L1_OPT_NAME_SCHEME);
+
+	if (argc != 1) {
+		print_cmd_usage(CMD_NAME " <keyring-directory>");
+		return EXIT_FAILURE;
+	}
+
+	struct l1_keyring *ring = l1_keyring_open(argv[0], opts->digest,
+			opts->hash, opts->hash_nbytes, true);
+
+	if (!ring) {
+		return EXIT_FAILURE;
+	}
+
+	if (opts->verbose) {
+		unsigned long long nkeys = 0;
+
+		for (uint32_t i = 0; i < ring->header->nfiles; ++i) {
+			nkeys += ring->files[i].nkeys;
+		}
+
+		fprintf(stderr, "Keyring contains %llu keys in %u files\n",
+				nkeys, ring->header->nfiles);
+	}
+
+	l1_keyring_close(ring);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,583 @@
+/*
+ * l1sign - Implementation of the Lamport-Diffie one-time signature scheme
+ * Copyright (c) 2019  Janik Rabe <info@janikrabe.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "l1sign_cmd_multi.h"
+
+#include "l1sign_checkpoint.h"
+#include "l1sign_gcrypt.h"
+#include "l1sign_hash.h"
+#include "l1sign_io.h"
+#include "l1sign_key.h"
+#include "l1sign_msig.h"
+#include "l1sign_ots.h"
+#include "l1sign_out.h"
+#include "l1sign_pool.h"
+#include "l1sign_stats.h"
+#include "l1sign_tee.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct multi_key {
+	char *filename;
+	int fd;
+	struct l1_key key;
+};
+
+struct sign_ctx {
+	const struct options *opts;
+	struct multi_key *keys;
+	unsigned char *digest;
+	unsigned char *sigs;
+	unsigned int sig_nbytes;
+};
+
+struct verify_ctx {
+	const struct options *opts;
+	struct multi_key *keys;
+	unsigned char *digest;
+	unsigned char *sigs;
+	unsigned char *sig_hashes;
+	unsigned int nsigs;
+	unsigned int hash_nbytes;
+	long *matches;
+	unsigned long *block_hashes;
+};
+
+static void close_keys(struct multi_key *keys, size_t nkeys) {
+	for (size_t i = 0; i < nkeys; ++i) {
+		close(keys[i].fd);
+	}
+
+	free(keys);
+}
+
+/*
+ * Open the key files given with --key.  All keys must use the same message
+ * digest, hash algorithm, and block size, which are inferred from the first
+ * key unless they are specified.
+ */
+static struct multi_key *open_keys(const struct options *opts,
+		enum l1_key_type type, const char *desc) {
+	struct multi_key *keys = calloc(opts->nkeys, sizeof *keys);
+	int digest = opts->digest;
+	int algo = opts->hash;
+	unsigned int block_nbytes = opts->hash_nbytes;
+	unsigned int explicit = opts->key_explicit;
+
+	if (!keys) {
+		fprintf(stderr, "Failed to allocate memory\n");
+		return NULL;
+	}
+
+	for (size_t i = 0; i < opts->nkeys; ++i) {
+		struct multi_key *key = &keys[i];
+
+		key->filename = opts->keys[i];
+
+		if ((key->fd = open(key->filename, O_RDONLY | O_CLOEXEC)) < 0) {
+			fprintf(stderr, "Failed to open %s %s: %s\n", desc,
+					key->filename, strerror(errno));
+			close_keys(keys, i);
+			return NULL;
+		}
+
+		if (!l1_key_open(&key->key, key->fd, key->filename, type, digest,
+					algo, block_nbytes, explicit)) {
+			close_keys(keys, i + 1);
+			return NULL;
+		}
+
+		if (key->key.scheme == L1_KEY_SCHEME_HORS) {
+			fprintf(stderr, "Option '--%s' does not support HORS key %s\n",
+					L1_OPT_NAME_KEY, key->filename);
+			close_keys(keys, i + 1);
+			return NULL;
+		}
+
+		if (opts->verbose) {
+			l1_key_print_info(&key->key, key->filename);
+		}
+
+		digest = key->key.digest;
+		algo = key->key.algo;
+		block_nbytes = key->key.block_nbytes;
+		explicit = L1_KEY_EXPLICIT_HASH | L1_KEY_EXPLICIT_DIGEST;
+	}
+
+	return keys;
+}
+
+/*
+ * Hash the message given with --message (or standard input) into 'digest'
+ * for keys like 'key'.
+ */
+static bool hash_message(const struct options *opts, const struct l1_key *key,
+		unsigned char *digest) {
+	int algo = key->digest;
+	unsigned int hash_nbytes = key->digest_nbytes;
+	char *msg_filename = opts->message;
+	FILE *msg_file = stdin;
+	gcry_md_hd_t hd;
+	bool ret = true;
+
+	if (msg_filename && !strcmp(msg_filename, "-")) {
+		msg_filename = NULL;
+	}
+
+	if (msg_filename && !(msg_file = fopen(msg_filename, "r"))) {
+		perror("Failed to open message file");
+		return false;
+	}
+
+	l1_stats_phase(L1_PHASE_MESSAGE_HASH);
+
+	if (opts->checkpoint || opts->chunked) {
+		ret = l1_checkpoint_hash_file(algo, msg_file, opts->checkpoint, digest,
+				hash_nbytes);
+	} else if (!(hd = l1_gcry_hash_hd_create(algo, false))) {
+		ret = false;
+	} else {
+		if (opts->tee || opts->tee_fd) {
+			ret = l1_tee_hash_file(hd, msg_file, opts->tee,
+					opts->tee_fd ? (int) opts->tee_fd : -1);
+		} else if (!l1_gcry_hash_file(hd, msg_file)) {
+			fprintf(stderr, "Failed to read message\n");
+			ret = false;
+		}
+
+		l1_gcry_hash_read(hd, digest, hash_nbytes);
+		l1_gcry_hash_hd_destroy(hd);
+	}
+
+	if (ret && opts->verbose) {
+		fprintf(stderr, "Message digest: ");
+		l1_gcry_print_digest(stderr, digest, hash_nbytes);
+	}
+
+	if (msg_filename && fclose(msg_file)) {
+		perror("Failed to close message file");
+		return false;
+	}
+
+	return ret;
+}
+
+/*
+ * Select the blocks of key 'key' for 'digest' into 'buf'.
+ */
+static bool read_key_blocks(const struct options *opts,
+		struct multi_key *key, unsigned char *digest, unsigned char *buf) {
+	unsigned int hash_nbytes = key->key.block_nbytes;
+	unsigned int hash_nbits = key->key.nblocks / 2;
+	struct l1_map map;
+
+	if (key->key.format != L1_KEY_FORMAT_V1 || key->key.head_nbytes) {
+		return l1_key_read_blocks(&key->key, opts->io_engine, key->fd,
+				key->filename, digest, buf, NULL, NULL);
+	}
+
+	unsigned char *blocks = l1_key_map(&key->key, key->fd, &map);
+
+	if (!blocks) {
+		fprintf(stderr, "Failed to map %s: %s\n", key->filename,
+				strerror(errno));
+		return false;
+	}
+
+	l1_ots_select(blocks, digest, hash_nbytes, hash_nbits, buf);
+	l1_unmap(&map);
+	return true;
+}
+
+static bool sign_task(size_t idx, void *arg) {
+	struct sign_ctx *ctx = arg;
+
+	return read_key_blocks(ctx->opts, &ctx->keys[idx], ctx->digest,
+			ctx->sigs + (size_t) ctx->sig_nbytes * idx);
+}
+
+static bool burn_task(size_t idx, void *arg) {
+	struct multi_key *key = &((struct multi_key *) arg)[idx];
+
+	return l1_key_burn(&key->key, key->fd, key->filename);
+}
+
+/*
+ * Sign the message with each key given with --key and save the signatures
+ * to a multi-signature file.  The message is hashed once, and the blocks of
+ * each key are read in parallel.
+ */
+int l1_cmd_sign_multi(const struct options *opts, int argc, char **argv) {
+	if (argc > 1) {
+		print_cmd_usage("sign --key <secret-key-file> [--key ...] "
+				"[signature-file]");
+		return EXIT_FAILURE;
+	}
+
+	char *sig_filename = argv[0];
+	struct l1_out sig_out;
+	struct multi_key *keys;
+	unsigned char digest[L1_MAX_HASH_NBYTES];
+	unsigned char header[L1_MSIG_HEADER_NBYTES];
+	int retval = EXIT_SUCCESS;
+
+	if (!sig_filename && isatty(STDOUT_FILENO)) {
+		fprintf(stderr, "Refusing implicit write to terminal\n");
+		return EXIT_FAILURE;
+	}
+
+	if (sig_filename && !strcmp(sig_filename, "-")) {
+		sig_filename = NULL;
+	}
+
+	if (((opts->tee && !strcmp(opts->tee, "-"))
+			|| opts->tee_fd == STDOUT_FILENO) && !sig_filename) {
+		fprintf(stderr, "Unable to write both message and signature to "
+				"standard output\n");
+		return EXIT_FAILURE;
+	}
+
+	umask(0133);
+
+	if (!(keys = open_keys(opts, L1_KEY_TYPE_SECRET, "secret key file"))) {
+		return EXIT_FAILURE;
+	}
+
+	struct l1_msig msig = {
+		keys[0].key.digest,
+		keys[0].key.algo,
+		opts->nkeys,
+		keys[0].key.block_nbytes * (keys[0].key.nblocks / 2),
+	};
+	size_t sigs_nbytes = (size_t) msig.sig_nbytes * msig.nsigs;
+	unsigned char *sigs = NULL;
+
+	if (opts->nkeys > L1_MSIG_MAX_NSIGS) {
+		fprintf(stderr, "Too many keys\n");
+		retval = EXIT_FAILURE;
+	} else if (!l1_gcry_secmem_init(msig.sig_nbytes, opts->nkeys)) {
+		retval = EXIT_FAILURE;
+	} else if (!hash_message(opts, &keys[0].key, digest)) {
+		retval = EXIT_FAILURE;
+	} else if (!(sigs = l1_gcry_secmem_alloc(sigs_nbytes))) {
+		fprintf(stderr, "Failed to allocate secure memory\n");
+		retval = EXIT_FAILURE;
+	}
+
+	if (retval == EXIT_SUCCESS) {
+		struct sign_ctx ctx = {
+			opts, keys, digest, sigs, msig.sig_nbytes,
+		};
+
+		l1_stats_phase(L1_PHASE_KEY_READ);
+
+		if (!l1_pool_run(opts->jobs, opts->nkeys, sign_task, &ctx)) {
+			retval = EXIT_FAILURE;
+		}
+	}
+
+	if (retval == EXIT_SUCCESS) {
+		struct iovec iov[2] = {
+			{ header, sizeof header },
+			{ sigs, sigs_nbytes },
+		};
+
+		l1_msig_encode_header(&msig, header);
+		l1_stats_phase(L1_PHASE_WRITE);
+
+		if (!l1_out_open(&sig_out, sig_filename)) {
+			perror("Failed to open signature file");
+			retval = EXIT_FAILURE;
+		} else if (!l1_out_writev(&sig_out, iov, 2)) {
+			perror("Failed to write to signature file");
+			l1_out_abort(&sig_out);
+			retval = EXIT_FAILURE;
+		} else if (!l1_out_commit(&sig_out)) {
+			perror("Failed to save signature file");
+			retval = EXIT_FAILURE;
+		}
+	}
+
+	/*
+	 * Each key is overwritten and synced to disk on its own.  The keys are
+	 * burned in parallel only so that the waits for their syncs overlap.
+	 */
+	if (retval == EXIT_SUCCESS && opts->burn
+			&& !l1_pool_run(opts->jobs, opts->nkeys, burn_task, keys)) {
+		retval = EXIT_FAILURE;
+	}
+
+	l1_gcry_secmem_free(sigs, sigs_nbytes);
+	close_keys(keys, opts->nkeys);
+	return retval;
+}
+
+/*
+ * Find a signature made with key 'idx'.  The first block of a signature
+ * hashes to the first selected public key block, which narrows the candidates
+ * down before signatures are checked in full.
+ */
+static bool verify_task(size_t idx, void *arg) {
+	struct verify_ctx *ctx = arg;
+	unsigned int hash_nbytes = ctx->hash_nbytes;
+	unsigned int hash_nbits = ctx->keys[idx].key.nblocks / 2;
+	size_t sig_nbytes = (size_t) hash_nbytes * hash_nbits;
+	unsigned char *pubbuf = gcry_malloc(sig_nbytes);
+	struct l1_hash *hash = NULL;
+	bool ret = false;
+
+	ctx->matches[idx] = -1;
+
+	if (!pubbuf) {
+		fprintf(stderr, "Failed to allocate memory\n");
+		goto out;
+	}
+
+	if (!(hash = l1_hash_create(ctx->opts->hash_backend,
+					ctx->keys[idx].key.algo, hash_nbytes, false))) {
+		goto out;
+	}
+
+	if (!read_key_blocks(ctx->opts, &ctx->keys[idx], ctx->digest, pubbuf)) {
+		goto out;
+	}
+
+	for (unsigned int i = 0; i < ctx->nsigs; ++i) {
+		if (memcmp(ctx->sig_hashes + (size_t) hash_nbytes * i, pubbuf,
+					hash_nbytes)) {
+			continue;
+		}
+
+		ctx->block_hashes[idx] += hash_nbits;
+
+		if (l1_ots_verify(hash, ctx->sigs + sig_nbytes * i, pubbuf,
+					hash_nbytes, hash_nbits)) {
+			ctx->matches[idx] = i;
+			break;
+		}
+	}
+
+	ret = true;
+
+out:
+	if (hash) {
+		l1_hash_destroy(hash);
+	}
+
+	gcry_free(pubbuf);
+	return ret;
+}
+
+/*
+ * Read a multi-signature file for keys like 'key'.
+ */
+static unsigned char *read_sigs(FILE *sig_file, const struct l1_key *key,
+		struct l1_msig *msig) {
+	unsigned char header[L1_MSIG_HEADER_NBYTES];
+	unsigned int hash_nbytes = key->block_nbytes;
+	unsigned int hash_nbits = key->nblocks / 2;
+	unsigned char *sigs;
+	size_t sigs_nbytes;
+	size_t len;
+
+	if (fread(header, 1, sizeof header, sig_file) != sizeof header) {
+		fprintf(stderr, "Failed to read from signature file\n");
+		return NULL;
+	}
+
+	l1_stats_read(sizeof header);
+
+	if (!l1_msig_decode_header(msig, header, "signature file")) {
+		return NULL;
+	}
+
+	if (msig->digest != key->digest || msig->algo != key->algo
+			|| msig->sig_nbytes != hash_nbytes * hash_nbits) {
+		fprintf(stderr, "The signature file does not match the hash %s "
+				"(%u bits) and message digest %s of the keys\n",
+				gcry_md_algo_name(key->algo), hash_nbytes * 8,
+				gcry_md_algo_name(key->digest));
+		return NULL;
+	}
+
+	sigs_nbytes = (size_t) msig->sig_nbytes * msig->nsigs;
+
+	if (!(sigs = gcry_malloc(sigs_nbytes))) {
+		fprintf(stderr, "Failed to allocate memory\n");
+		return NULL;
+	}
+
+	len = fread(sigs, 1, sigs_nbytes, sig_file);
+	l1_stats_read(len);
+
+	if (len != sigs_nbytes) {
+		fprintf(stderr, "Failed to read from signature file%s\n",
+				ferror(sig_file) ? "" : " (truncated file?)");
+	} else if (fgetc(sig_file) != EOF) {
+		fprintf(stderr, "Warning: Partial read from signature file\n");
+	} else {
+		return sigs;
+	}
+
+	gcry_free(sigs);
+	return NULL;
+}
+
+/*
+ * Verify a multi-signature file against the public keys given with --key.
+ * The verification succeeds if at least --threshold keys (all keys by
+ * default) have made a valid signature.  Each signature counts only once.
+ */
+int l1_cmd_verify_multi(const struct options *opts, int argc, char **argv) {
+	if (argc > 1) {
+		print_cmd_usage("verify --key <public-key-file> [--key ...] "
+				"[--threshold n] [signature-file]");
+		return EXIT_FAILURE;
+	}
+
+	char *sig_filename = argv[0];
+	FILE *sig_file = stdin;
+	struct multi_key *keys;
+	struct l1_msig msig;
+	unsigned char digest[L1_MAX_HASH_NBYTES];
+	unsigned char *sigs = NULL;
+	unsigned char *sig_hashes = NULL;
+	long *matches = NULL;
+	unsigned long *block_hashes = NULL;
+	bool *used = NULL;
+	unsigned int threshold = opts->threshold ? opts->threshold : opts->nkeys;
+	unsigned int nvalid = 0;
+	int retval = EXIT_SUCCESS;
+
+	if (threshold > opts->nkeys) {
+		fprintf(stderr, "Threshold exceeds the number of public keys\n");
+		return EXIT_FAILURE;
+	}
+
+	if (!sig_filename && isatty(STDIN_FILENO)) {
+		fprintf(stderr, "Refusing implicit read from terminal\n");
+		return EXIT_FAILURE;
+	}
+
+	if (sig_filename && !strcmp(sig_filename, "-")) {
+		sig_filename = NULL;
+	}
+
+	if (!sig_filename && (!opts->message || !strcmp(opts->message, "-"))) {
+		fprintf(stderr, "Unable to read multiple files from "
+				"standard input\n");
+		return EXIT_FAILURE;
+	}
+
+	if (!(keys = open_keys(opts, L1_KEY_TYPE_PUBLIC, "public key file"))) {
+		return EXIT_FAILURE;
+	}
+
+	int algo = keys[0].key.algo;
+	unsigned int hash_nbytes = keys[0].key.block_nbytes;
+
+	if (sig_filename && !(sig_file = fopen(sig_filename, "r"))) {
+		perror("Failed to open signature file");
+		close_keys(keys, opts->nkeys);
+		return EXIT_FAILURE;
+	}
+
+	l1_stats_phase(L1_PHASE_KEY_READ);
+
+	if (!(sigs = read_sigs(sig_file, &keys[0].key, &msig))
+			|| !hash_message(opts, &keys[0].key, digest)) {
+		retval = EXIT_FAILURE;
+	} else if (!(sig_hashes = gcry_malloc((size_t) hash_nbytes * msig.nsigs))
+			|| !(matches = calloc(opts->nkeys, sizeof *matches))
+			|| !(block_hashes = calloc(opts->nkeys, sizeof *block_hashes))
+			|| !(used = calloc(msig.nsigs, sizeof *used))) {
+		fprintf(stderr, "Failed to allocate memory\n");
+		retval = EXIT_FAILURE;
+	}
+
+	if (retval == EXIT_SUCCESS) {
+		struct verify_ctx ctx = {
+			opts, keys, digest, sigs, sig_hashes, msig.nsigs, hash_nbytes,
+			matches, block_hashes,
+		};
+
+		l1_stats_phase(L1_PHASE_BLOCK_HASH);
+
+		for (unsigned int i = 0; i < msig.nsigs; ++i) {
+			if (!l1_gcry_hash_buffer(algo,
+						sig_hashes + (size_t) hash_nbytes * i, hash_nbytes,
+						sigs + (size_t) msig.sig_nbytes * i, hash_nbytes)) {
+				retval = EXIT_FAILURE;
+			}
+		}
+
+		l1_stats.block_hashes += msig.nsigs;
+
+		if (retval == EXIT_SUCCESS
+				&& !l1_pool_run(opts->jobs, opts->nkeys, verify_task, &ctx)) {
+			retval = EXIT_FAILURE;
+		}
+	}
+
+	for (size_t i = 0; retval == EXIT_SUCCESS && i < opts->nkeys; ++i) {
+		bool valid = matches[i] >= 0 && !used[matches[i]];
+
+		if (valid) {
+			used[matches[i]] = true;
+			++nvalid;
+		}
+
+		l1_stats.block_hashes += block_hashes[i];
+
+		if (opts->verbose) {
+			fprintf(stderr, "%s: %s\n", keys[i].filename,
+					valid ? "valid signature" : "no valid signature");
+		}
+	}
+
+	if (retval == EXIT_SUCCESS && nvalid < threshold) {
+		fprintf(stderr, "Invalid signature (%u of %u required signatures "
+				"are valid)\n", nvalid, threshold);
+		retval = EXIT_FAILURE;
+	}
+
+	if (opts->verbose && retval != EXIT_FAILURE) {
+		fprintf(stderr, "Signature is valid (%u of %u required signatures "
+				"are valid)\n", nvalid, threshold);
+	}
+
+	free(used);
+	free(block_hashes);
+	free(matches);
+	gcry_free(sig_hashes);
+	gcry_free(sigs);
+	close_keys(keys, opts->nkeys);
+
+	if (sig_filename && fclose(sig_file)) {
+		perror("Failed to close signature file");
+		return EXIT_FAILURE;
+	}
+
+	return retval;
+}
@@ -19,6 +19,11 @@
 #include "l1sign_cmd_pubkey.h"
 
 #include "l1sign_gcrypt.h"
+#include "l1sign_hash.h"
+#include "l1sign_key.h"
+#include "l1sign_ots.h"
+#include "l1sign_out.h"
+#include "l1sign_stats.h"
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -29,10 +34,24 @@
 #define CMD_NAME "pubkey"
 
 int l1_cmd_pubkey(const struct options *opts, int argc, char **argv) {
+	L1_OPT_REJECT(CMD_NAME, opts->bundle, L1_OPT_NAME_BUNDLE);
+	L1_OPT_REJECT(CMD_NAME, opts->burn, L1_OPT_NAME_BURN);
+	L1_OPT_REJECT(CMD_NAME, opts->cache, L1_OPT_NAME_CACHE);
+	L1_OPT_REJECT(CMD_NAME, opts->checkpoint, L1_OPT_NAME_CHECKPOINT);
+	L1_OPT_REJECT(CMD_NAME, opts->chunked, L1_OPT_NAME_CHUNKED);
+	L1_OPT_REJECT(CMD_NAME, opts->nkeys, L1_OPT_NAME_KEY);
+	L1_OPT_REJECT(CMD_NAME, opts->keyring, L1_OPT_NAME_KEYRING);
 	L1_OPT_REJECT(CMD_NAME, opts->message, L1_OPT_NAME_MESSAGE);
-
-	if (argc > 2) {
-		print_cmd_usage(CMD_NAME " [[secret-key-file] public-key-file]");
+	L1_OPT_REJECT(CMD_NAME, opts->pubkey, L1_OPT_NAME_PUBKEY);
+	L1_OPT_REJECT(CMD_NAME, opts->scheme, L1_OPT_NAME_SCHEME);
+	L1_OPT_REJECT(CMD_NAME, opts->tee, L1_OPT_NAME_TEE);
+	L1_OPT_REJECT(CMD_NAME, opts->tee_fd, L1_OPT_NAME_TEE_FD);
+	L1_OPT_REJECT(CMD_NAME, opts->threshold, L1_OPT_NAME_THRESHOLD);
+
+	if (argc > (opts->key_fd ? 1 : 2)) {
+		print_cmd_usage(opts->key_fd
+				? CMD_NAME " --" L1_OPT_NAME_KEY_FD " <fd> [public-key-file]"
+				: CMD_NAME " [[secret-key-file] public-key-file]");
 		return EXIT_FAILURE;
 	}
 
@@ -41,7 +60,7 @@ int l1_cmd_pubkey(const struct options *opts, int argc, char **argv) {
 
 	int retval = EXIT_SUCCESS;
 
-	gcry_md_hd_t hd;
+	struct l1_hash *hash;
 
 	if (argc == 1) {
 		pub_filename = argv[0];
@@ -51,16 +70,13 @@ int l1_cmd_pubkey(const struct options *opts, int argc, char **argv) {
 	}
 
 	FILE *sec_file = stdin;
-	FILE *pub_file = stdout;
+	struct l1_out pub_out;
 
-	unsigned int hash_nbytes = l1_gcry_hash_nbytes(opts->hash);
+	struct l1_key sec_key;
+	struct l1_key pub_key;
+	struct l1_map sec_map = { 0 };
 
-	/*
-	 * nblocks = key_nbytes / hash_nbytes
-	 */
-	unsigned int nblocks = hash_nbytes * (2 * 8);
-
-	if (!sec_filename && isatty(STDIN_FILENO)) {
+	if (!opts->key_fd && !sec_filename && isatty(STDIN_FILENO)) {
 		fprintf(stderr, "Refusing implicit read from terminal\n");
 		return EXIT_FAILURE;
 	}
@@ -87,61 +103,144 @@ int l1_cmd_pubkey(const struct options *opts, int argc, char **argv) {
 		return EXIT_FAILURE;
 	}
 
-	if (pub_filename && !(pub_file = fopen(pub_filename, "w"))) {
-		perror("Failed to open public key file");
+	int sec_fd = opts->key_fd ? (int) opts->key_fd : fileno(sec_file);
+
+	if (!l1_key_open(&sec_key, sec_fd, "secret key file",
+				L1_KEY_TYPE_SECRET, opts->digest, opts->hash,
+				opts->hash_nbytes, opts->key_explicit)) {
 		return EXIT_FAILURE;
 	}
 
-	if (!(hd = l1_gcry_hash_hd_create(opts->hash, true))) {
+	if (opts->verbose) {
+		l1_key_print_info(&sec_key, "Secret key");
+	}
+
+	l1_key_init(&pub_key, opts->key_format == L1_KEY_FORMAT_AUTO
+			? sec_key.format
+			: opts->key_format, L1_KEY_TYPE_PUBLIC, sec_key.digest,
+			sec_key.algo, sec_key.block_nbytes);
+
+	if (!l1_key_set_scheme(&pub_key, sec_key.scheme)) {
 		return EXIT_FAILURE;
 	}
 
-	void *secbuf = gcry_malloc_secure(hash_nbytes);
+	unsigned int hash_nbytes = sec_key.block_nbytes;
+	unsigned int nblocks = sec_key.nblocks;
+	size_t key_nbytes = (size_t) hash_nbytes * nblocks;
 
-	if (!secbuf) {
-		fprintf(stderr, "Failed to allocate secure memory\n");
+	if (!l1_gcry_secmem_init(key_nbytes, 1)) {
 		return EXIT_FAILURE;
 	}
 
-	for (unsigned int i = 0; i < nblocks; ++i) {
-		if (!fread(secbuf, hash_nbytes, 1, sec_file)) {
-			fprintf(stderr, "Failed to read from secret key file%s\n",
-					i ? " (hash size mismatch?)" : "");
+	if (!(hash = l1_hash_create(opts->hash_backend, sec_key.algo,
+			hash_nbytes, true))) {
+		return EXIT_FAILURE;
+	}
+
+	/*
+	 * Version 1 keys and keys passed with --key-fd, which may only support
+	 * mapping, are accessed directly through a mapping, unless they are read
+	 * from a stream.
+	 */
+	bool mapped = (sec_key.format == L1_KEY_FORMAT_V1 && !sec_key.head_nbytes)
+		|| opts->key_fd;
+	unsigned char *secbuf = NULL;
+	unsigned char *sec = NULL;
+	void *pubbuf = gcry_malloc(key_nbytes);
+
+	if (!mapped) {
+		sec = secbuf = l1_gcry_secmem_alloc(key_nbytes);
+	}
+
+	if ((!mapped && !secbuf) || !pubbuf) {
+		fprintf(stderr, "Failed to allocate memory\n");
+		return EXIT_FAILURE;
+	}
+
+	l1_stats_phase(L1_PHASE_KEY_READ);
+
+	if (mapped) {
+		if (sec_key.format == L1_KEY_FORMAT_RAW
+				&& !l1_key_check_size(&sec_key, sec_fd, "secret key file")) {
+			retval = EXIT_FAILURE;
+		} else if (!(sec = l1_key_map(&sec_key, sec_fd, &sec_map))) {
+			perror("Failed to map secret key file");
 			retval = EXIT_FAILURE;
-			break;
 		}
+	} else {
+		size_t head_nbytes = l1_key_copy_head(&sec_key, secbuf);
+		size_t len = fread(secbuf + head_nbytes, 1, key_nbytes - head_nbytes,
+				sec_file);
+
+		l1_stats_read(len);
+		len += head_nbytes;
 
-		gcry_md_reset(hd);
-		gcry_md_write(hd, secbuf, hash_nbytes);
+		if (len != key_nbytes) {
+			fprintf(stderr, "Failed to read from secret key file%s\n",
+					len ? " (hash size mismatch?)" : "");
+			retval = EXIT_FAILURE;
+		} else if (fgetc(sec_file) != EOF) {
+			fprintf(stderr, "Warning: Partial read from secret key file "
+					"(hash size mismatch?)\n");
+			retval = EXIT_FAILURE;
+		}
+	}
 
-		void *hash = gcry_md_read(hd, GCRY_MD_NONE);
+	if (retval == EXIT_SUCCESS) {
+		l1_stats_phase(L1_PHASE_BLOCK_HASH);
 
-		if (!fwrite(hash, hash_nbytes, 1, pub_file)) {
-			fprintf(stderr, "Failed to write to public key file\n");
+		if (!l1_ots_pubkey(hash, sec, pubbuf, hash_nbytes, nblocks)) {
+			fprintf(stderr, "Failed to derive public key\n");
 			retval = EXIT_FAILURE;
-			break;
 		}
+
+		l1_stats.block_hashes += nblocks;
 	}
 
-	if (retval == EXIT_SUCCESS && fgetc(sec_file) != EOF) {
-		fprintf(stderr, "Warning: Partial read from secret key file "
-				"(hash size mismatch?)\n");
-		retval = EXIT_FAILURE;
+	/*
+	 * The fingerprint in the header of a version 1 secret key must match the
+	 * public key that was derived from it.
+	 */
+	if (retval == EXIT_SUCCESS && (sec_key.format == L1_KEY_FORMAT_V1
+				|| pub_key.format == L1_KEY_FORMAT_V1)) {
+		l1_key_set_fingerprint(&pub_key, pubbuf);
+
+		if (sec_key.format == L1_KEY_FORMAT_V1 && memcmp(sec_key.fingerprint,
+					pub_key.fingerprint, L1_FPR_NBYTES)) {
+			fprintf(stderr, "Fingerprint mismatch in secret key file "
+					"(corrupted key?)\n");
+			retval = EXIT_FAILURE;
+		}
 	}
 
-	gcry_free(secbuf);
+	l1_unmap(&sec_map);
+	l1_gcry_secmem_free(secbuf, key_nbytes);
 
-	l1_gcry_hash_hd_destroy(hd);
+	l1_hash_destroy(hash);
 
 	if (sec_filename && fclose(sec_file)) {
 		perror("Failed to close secret key file");
+		gcry_free(pubbuf);
 		return EXIT_FAILURE;
 	}
 
-	if (pub_filename && fclose(pub_file)) {
-		perror("Failed to close public key file");
-		return EXIT_FAILURE;
+	if (retval == EXIT_SUCCESS) {
+		l1_stats_phase(L1_PHASE_WRITE);
+
+		if (!l1_out_open(&pub_out, pub_filename)) {
+			perror("Failed to open public key file");
+			retval = EXIT_FAILURE;
+		} else if (!l1_key_write(&pub_key, &pub_out, pubbuf)) {
+			perror("Failed to write to public key file");
+			l1_out_abort(&pub_out);
+			retval = EXIT_FAILURE;
+		} else if (!l1_out_commit(&pub_out)) {
+			perror("Failed to save public key file");
+			retval = EXIT_FAILURE;
+		}
 	}
 
+	gcry_free(pubbuf);
+
 	return retval;
 }
@@ -18,8 +18,17 @@
 
 #include "l1sign_cmd_sign.h"
 
+#include "l1sign_bundle.h"
+#include "l1sign_checkpoint.h"
+#include "l1sign_cmd_multi.h"
 #include "l1sign_gcrypt.h"
-#include "l1sign_util.h"
+#include "l1sign_hors.h"
+#include "l1sign_io.h"
+#include "l1sign_key.h"
+#include "l1sign_out.h"
+#include "l1sign_ots.h"
+#include "l1sign_stats.h"
+#include "l1sign_tee.h"
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -29,26 +38,104 @@
 
 #define CMD_NAME "sign"
 
+/*
+ * Write the bundle header, the signature, and the spooled message to 'out'.
+ */
+static bool write_bundle(const struct l1_key *key,
+		struct l1_bundle_spool *spool, const void *sigbuf,
+		unsigned int sig_nbytes, struct l1_out *out) {
+	unsigned char header[L1_BUNDLE_HEADER_NBYTES];
+	struct l1_bundle bundle = {
+		key->digest, key->algo, sig_nbytes, spool->nbytes,
+	};
+	struct iovec iov[2] = {
+		{ header, sizeof header },
+		{ (void *) sigbuf, sig_nbytes },
+	};
+
+	l1_bundle_encode_header(&bundle, header);
+
+	return l1_out_writev(out, iov, 2) && l1_bundle_spool_flush(spool, out);
+}
+
 int l1_cmd_sign(const struct options *opts, int argc, char **argv) {
-	if (argc < 1 || argc > 2) {
-		print_cmd_usage(CMD_NAME " <secret-key-file> [signature-file]");
+	L1_OPT_REJECT(CMD_NAME, opts->cache, L1_OPT_NAME_CACHE);
+	L1_OPT_REJECT(CMD_NAME, opts->keyring, L1_OPT_NAME_KEYRING);
+	L1_OPT_REJECT(CMD_NAME, opts->pubkey, L1_OPT_NAME_PUBKEY);
+	L1_OPT_REJECT(CMD_NAME, opts->threshold, L1_OPT_NAME_THRESHOLD);
+	L1_OPT_REJECT(CMD_NAME, opts->key_format, L1_OPT_NAME_FORMAT);
+	L1_OPT_REJECT(CMD_NAME, opts->scheme, L1_OPT_NAME_SCHEME);
+
+	if (opts->tee) {
+		L1_OPT_REJECT(CMD_NAME " --" L1_OPT_NAME_TEE, opts->tee_fd,
+				L1_OPT_NAME_TEE_FD);
+	}
+
+	if (opts->checkpoint) {
+		L1_OPT_REJECT(CMD_NAME " --" L1_OPT_NAME_CHECKPOINT, opts->tee,
+				L1_OPT_NAME_TEE);
+		L1_OPT_REJECT(CMD_NAME " --" L1_OPT_NAME_CHECKPOINT, opts->tee_fd,
+				L1_OPT_NAME_TEE_FD);
+	}
+
+	if (opts->chunked) {
+		L1_OPT_REJECT(CMD_NAME " --" L1_OPT_NAME_CHUNKED, opts->tee,
+				L1_OPT_NAME_TEE);
+		L1_OPT_REJECT(CMD_NAME " --" L1_OPT_NAME_CHUNKED, opts->tee_fd,
+				L1_OPT_NAME_TEE_FD);
+	}
+
+	if (opts->bundle) {
+		L1_OPT_REJECT(CMD_NAME " --" L1_OPT_NAME_BUNDLE, opts->checkpoint,
+				L1_OPT_NAME_CHECKPOINT);
+		L1_OPT_REJECT(CMD_NAME " --" L1_OPT_NAME_BUNDLE, opts->chunked,
+				L1_OPT_NAME_CHUNKED);
+		L1_OPT_REJECT(CMD_NAME " --" L1_OPT_NAME_BUNDLE, opts->nkeys,
+				L1_OPT_NAME_KEY);
+		L1_OPT_REJECT(CMD_NAME " --" L1_OPT_NAME_BUNDLE, opts->tee,
+				L1_OPT_NAME_TEE);
+		L1_OPT_REJECT(CMD_NAME " --" L1_OPT_NAME_BUNDLE, opts->tee_fd,
+				L1_OPT_NAME_TEE_FD);
+	}
+
+	if (opts->nkeys) {
+		L1_OPT_REJECT(CMD_NAME " --" L1_OPT_NAME_KEY, opts->key_fd,
+				L1_OPT_NAME_KEY_FD);
+
+		return l1_cmd_sign_multi(opts, argc, argv);
+	}
+
+	/*
+	 * With --key-fd, the secret key is read from a descriptor provided by the
+	 * caller instead of the secret key file argument.
+	 */
+	if (opts->key_fd ? argc > 1 : argc < 1 || argc > 2) {
+		print_cmd_usage(opts->key_fd
+				? CMD_NAME " --" L1_OPT_NAME_KEY_FD " <fd> [signature-file]"
+				: CMD_NAME " <secret-key-file> [signature-file]");
 		return EXIT_FAILURE;
 	}
 
 	char *msg_filename = opts->message;
-	char *sec_filename = argv[0];
-	char *sig_filename = argv[1];
+	char *sec_filename = opts->key_fd ? NULL : argv[0];
+	char *sig_filename = opts->key_fd ? argv[0] : argv[1];
+	const char *sec_source = opts->key_fd
+		? "a file descriptor"
+		: "standard input";
 
 	int retval = EXIT_SUCCESS;
 
 	gcry_md_hd_t hd;
+	unsigned char msg_hash[L1_MAX_HASH_NBYTES];
 
 	FILE *msg_file = stdin;
 	FILE *sec_file = stdin;
-	FILE *sig_file = stdout;
+	struct l1_out sig_out;
+	struct l1_key sec_key;
+	struct l1_map sec_map = { 0 };
+	struct l1_bundle_spool spool;
 
-	unsigned int hash_nbytes = l1_gcry_hash_nbytes(opts->hash);
-	unsigned int hash_nbits = hash_nbytes * 8;
+	l1_bundle_spool_init(&spool, NULL);
 
 	if (!sig_filename && isatty(STDOUT_FILENO)) {
 		fprintf(stderr, "Refusing implicit write to terminal\n");
@@ -67,104 +154,232 @@ int l1_cmd_sign(const struct options *opts, int argc, char **argv) {
 		sig_filename = NULL;
 	}
 
-	if (!msg_filename && !sec_filename) {
+	if (((opts->tee && !strcmp(opts->tee, "-"))
+			|| opts->tee_fd == STDOUT_FILENO) && !sig_filename) {
+		fprintf(stderr, "Unable to write both message and signature to "
+				"standard output\n");
+		return EXIT_FAILURE;
+	}
+
+	if (!msg_filename && !sec_filename && !opts->key_fd) {
 		fprintf(stderr, "Unable to read both message and secret key from "
 				"standard input\n");
 		return EXIT_FAILURE;
 	}
 
+	if (opts->burn && !sec_filename) {
+		fprintf(stderr, "Unable to burn a secret key read from %s\n",
+				sec_source);
+		return EXIT_FAILURE;
+	}
+
 	setvbuf(sec_file, NULL, _IONBF, 0);
-	setvbuf(sig_file, NULL, _IONBF, 0);
 
 	umask(0133);
 
+	if (sec_filename && !(sec_file = fopen(sec_filename, "r"))) {
+		perror("Failed to open secret key file");
+		return EXIT_FAILURE;
+	}
+
+	int sec_fd = opts->key_fd ? (int) opts->key_fd : fileno(sec_file);
+
+	if (!l1_key_open(&sec_key, sec_fd, "secret key file",
+				L1_KEY_TYPE_SECRET, opts->digest, opts->hash,
+				opts->hash_nbytes, opts->key_explicit)) {
+		return EXIT_FAILURE;
+	}
+
+	if (opts->verbose) {
+		l1_key_print_info(&sec_key, "Secret key");
+	}
+
+	/*
+	 * HORS keys record each signature in their header, which requires a
+	 * secret key file that can be updated.
+	 */
+	if (sec_key.scheme == L1_KEY_SCHEME_HORS) {
+		if (!sec_filename) {
+			fprintf(stderr, "Unable to record the signature of a HORS key "
+					"read from %s\n", sec_source);
+			return EXIT_FAILURE;
+		}
+
+		if (sec_key.nsigs >= l1_hors_max_signatures(sec_key.nselect)) {
+			fprintf(stderr, "The secret key has been used for the maximum "
+					"number of %u signatures\n",
+					l1_hors_max_signatures(sec_key.nselect));
+			return EXIT_FAILURE;
+		}
+	}
+
+	unsigned int hash_nbytes = sec_key.block_nbytes;
+	unsigned int hash_nbits = sec_key.digest_nbytes * 8;
+	unsigned int sig_nbytes = hash_nbytes * sec_key.nselect;
+
+	/*
+	 * Only the signature is kept in secure memory: the selected blocks are
+	 * copied into it from the mapping or read into it directly.
+	 */
+	if (!l1_gcry_secmem_init(sig_nbytes, 1)) {
+		return EXIT_FAILURE;
+	}
+
 	if (msg_filename && !(msg_file = fopen(msg_filename, "r"))) {
 		perror("Failed to open message file");
 		return EXIT_FAILURE;
 	}
 
-	if (!(hd = l1_gcry_hash_hd_create(opts->hash, false))) {
+	if (!(hd = l1_gcry_hash_hd_create(sec_key.digest, false))) {
 		return EXIT_FAILURE;
 	}
 
-	if (!l1_gcry_hash_file(hd, msg_file)) {
-		fprintf(stderr, "Failed to read message\n");
-	}
+	l1_stats_phase(L1_PHASE_MESSAGE_HASH);
+
+	/*
+	 * With --chunked, the chunked message digest is computed, and with
+	 * --checkpoint, only the data appended since the last checkpoint is
+	 * hashed for it.  With --tee, the message is passed through while it is
+	 * hashed, and the signature is written once the message has ended.  With
+	 * --bundle, the message is kept until it follows the signature.
+	 */
+	if (opts->checkpoint || opts->chunked) {
+		if (!l1_checkpoint_hash_file(sec_key.digest, msg_file,
+					opts->checkpoint, msg_hash, hash_nbits / 8)) {
+			l1_gcry_hash_hd_destroy(hd);
+			return EXIT_FAILURE;
+		}
+	} else {
+		if (opts->tee || opts->tee_fd) {
+			if (!l1_tee_hash_file(hd, msg_file, opts->tee,
+						opts->tee_fd ? (int) opts->tee_fd : -1)) {
+				l1_gcry_hash_hd_destroy(hd);
+				return EXIT_FAILURE;
+			}
+		} else if (opts->bundle) {
+			if (!l1_bundle_spool_hash(&spool, msg_file, hd, UINT64_MAX)) {
+				perror("Failed to read message");
+				l1_bundle_spool_free(&spool);
+				l1_gcry_hash_hd_destroy(hd);
+				return EXIT_FAILURE;
+			}
+		} else if (!l1_gcry_hash_file(hd, msg_file)) {
+			fprintf(stderr, "Failed to read message\n");
+			l1_gcry_hash_hd_destroy(hd);
+			return EXIT_FAILURE;
+		}
 
-	unsigned char *msg_hash = gcry_md_read(hd, GCRY_MD_NONE);
+		l1_gcry_hash_read(hd, msg_hash, hash_nbits / 8);
+	}
 
 	if (opts->verbose) {
 		fprintf(stderr, "Message digest: ");
-		l1_gcry_print_digest(stderr, msg_hash, hash_nbytes);
+		l1_gcry_print_digest(stderr, msg_hash, hash_nbits / 8);
 	}
 
-	if (msg_filename && fclose(msg_file)) {
+	if (msg_filename && !opts->bundle && fclose(msg_file)) {
 		perror("Failed to close message file");
 		return EXIT_FAILURE;
 	}
 
-	if (sec_filename && !(sec_file = fopen(sec_filename, "r"))) {
-		perror("Failed to open secret key file");
-		return EXIT_FAILURE;
-	}
-
-	if (sig_filename && !(sig_file = fopen(sig_filename, "w"))) {
+	if (!l1_out_open(&sig_out, sig_filename)) {
 		perror("Failed to open signature file");
 		return EXIT_FAILURE;
 	}
 
-	void *secbuf = gcry_malloc_secure(hash_nbytes);
+	void *sigbuf = l1_gcry_secmem_alloc(sig_nbytes);
 
-	if (!secbuf) {
+	if (!sigbuf) {
 		fprintf(stderr, "Failed to allocate secure memory\n");
+		l1_out_abort(&sig_out);
 		return EXIT_FAILURE;
 	}
 
-	for (unsigned int i = 0; i < hash_nbits; ++i) {
-		unsigned char dbit = l1_bit_get(msg_hash, hash_nbytes, i);
+	l1_stats_phase(L1_PHASE_KEY_READ);
 
-		if (fseek(sec_file, hash_nbytes * (i * 2 + dbit), SEEK_SET)) {
-			perror("Failed to seek within secret key file");
+	/*
+	 * The blocks of version 1 keys and of keys passed with --key-fd, which
+	 * may only support mapping, are accessed directly through a mapping,
+	 * unless they are read from a stream.
+	 */
+	if (sec_key.format == L1_KEY_FORMAT_RAW && opts->key_fd
+			&& !l1_key_check_size(&sec_key, sec_fd, "secret key file")) {
+		retval = EXIT_FAILURE;
+	} else if ((sec_key.format == L1_KEY_FORMAT_V1 && !sec_key.head_nbytes)
+			|| opts->key_fd) {
+		unsigned char *sec = l1_key_map(&sec_key, sec_fd, &sec_map);
+
+		if (!sec) {
+			perror("Failed to map secret key file");
 			retval = EXIT_FAILURE;
-			break;
+		} else {
+			l1_key_select(&sec_key, sec, msg_hash, sigbuf);
+			l1_unmap(&sec_map);
 		}
+	} else if (!l1_key_read_blocks(&sec_key, opts->io_engine, sec_fd,
+				"secret key file", msg_hash, sigbuf, NULL, NULL)) {
+		retval = EXIT_FAILURE;
+	}
 
-		if (!fread(secbuf, hash_nbytes, 1, sec_file)) {
-			fprintf(stderr, "Failed to read from secret key file%s\n",
-					i ? " (hash size mismatch?)" : "");
+	if (retval == EXIT_SUCCESS && sec_key.scheme == L1_KEY_SCHEME_HORS) {
+		if (!l1_key_count_signature(&sec_key, sec_filename)) {
 			retval = EXIT_FAILURE;
-			break;
+		} else if (sec_key.nsigs == l1_hors_max_signatures(sec_key.nselect)) {
+			fprintf(stderr, "Warning: This was the last signature permitted "
+					"for the secret key\n");
+		} else if (opts->verbose) {
+			fprintf(stderr, "Remaining signatures: %u, security level "
+					"%.1f bits\n",
+					l1_hors_max_signatures(sec_key.nselect) - sec_key.nsigs,
+					l1_hors_security(sec_key.nselect, sec_key.nsigs));
 		}
+	}
 
-		if (!fwrite(secbuf, hash_nbytes, 1, sig_file)) {
-			fprintf(stderr, "Failed to write to signature file\n");
+	if (retval == EXIT_SUCCESS) {
+		l1_stats_phase(L1_PHASE_WRITE);
+
+		if (opts->bundle) {
+			if (!write_bundle(&sec_key, &spool, sigbuf, sig_nbytes,
+						&sig_out)) {
+				perror("Failed to write to bundle");
+				retval = EXIT_FAILURE;
+			}
+		} else if (!l1_out_write(&sig_out, sigbuf, sig_nbytes)) {
+			perror("Failed to write to signature file");
 			retval = EXIT_FAILURE;
-			break;
 		}
 	}
 
-	if (fseek(sec_file, hash_nbytes * hash_nbits * 2, SEEK_SET)) {
-		perror("Failed to seek within secret key file");
+	l1_gcry_secmem_free(sigbuf, sig_nbytes);
+	l1_bundle_spool_free(&spool);
+
+	l1_gcry_hash_hd_destroy(hd);
+
+	if (retval != EXIT_SUCCESS) {
+		l1_out_abort(&sig_out);
+	} else if (!l1_out_commit(&sig_out)) {
+		perror("Failed to save signature file");
 		retval = EXIT_FAILURE;
 	}
 
-	if (retval == EXIT_SUCCESS && fgetc(sec_file) != EOF) {
-		fprintf(stderr, "Warning: Partial read from secret key file "
-				"(hash size mismatch?)\n");
+	/*
+	 * The key is only burned once the signature has been saved.  HORS keys
+	 * are kept until they have made their last signature.
+	 */
+	if (retval == EXIT_SUCCESS && opts->burn
+			&& (sec_key.scheme != L1_KEY_SCHEME_HORS || sec_key.nsigs
+				== l1_hors_max_signatures(sec_key.nselect))
+			&& !l1_key_burn(&sec_key, sec_fd, sec_filename)) {
 		retval = EXIT_FAILURE;
 	}
 
-	gcry_free(secbuf);
-
-	l1_gcry_hash_hd_destroy(hd);
-
-	if (sec_filename && fclose(sec_file)) {
-		perror("Failed to close secret key file");
+	if (msg_filename && opts->bundle && fclose(msg_file)) {
+		perror("Failed to close message file");
 		return EXIT_FAILURE;
 	}
 
-	if (sig_filename && fclose(sig_file)) {
-		perror("Failed to close signature file");
+	if (sec_filename && fclose(sec_file)) {
+		perror("Failed to close secret key file");
 		return EXIT_FAILURE;
 	}
 
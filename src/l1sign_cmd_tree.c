@@ -0,0 +1,324 @@
+/*
+ * l1sign - Implementation of the Lamport-Diffie one-time signature scheme
+ * Copyright (c) 2019  Janik Rabe <info@janikrabe.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "l1sign_cmd_tree.h"
+
+#include "l1sign_cmd_sign.h"
+#include "l1sign_cmd_verify.h"
+#include "l1sign_gcrypt.h"
+#include "l1sign_key.h"
+#include "l1sign_manifest.h"
+#include "l1sign_out.h"
+#include "l1sign_stats.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CMD_NAME_SIGN "sign-tree"
+#define CMD_NAME_VERIFY "verify-tree"
+
+static void close_root(int root_fd) {
+	if (root_fd >= 0) {
+		close(root_fd);
+	}
+}
+
+/*
+ * Determine the message digest of the secret key without consuming it, which
+ * requires a file that can be read at an offset.  Secure memory is set up for
+ * the key here, as it must be set up before the files are hashed.
+ */
+static bool secret_key_digest(const struct options *opts,
+		const char *sec_filename, int *digest) {
+	struct l1_key sec_key;
+	int fd = STDIN_FILENO;
+	bool ret;
+
+	if (strcmp(sec_filename, "-")
+			&& (fd = open(sec_filename, O_RDONLY | O_CLOEXEC)) < 0) {
+		perror("Failed to open secret key file");
+		return false;
+	}
+
+	if (lseek(fd, 0, SEEK_CUR) < 0 && errno == ESPIPE) {
+		fprintf(stderr, "Command '%s' cannot read the secret key from a "
+				"pipe\n", CMD_NAME_SIGN);
+
+		if (fd != STDIN_FILENO) {
+			close(fd);
+		}
+
+		return false;
+	}
+
+	ret = l1_key_open(&sec_key, fd, "secret key file", L1_KEY_TYPE_SECRET,
+			opts->digest, opts->hash, opts->hash_nbytes, opts->key_explicit);
+
+	if (fd != STDIN_FILENO) {
+		close(fd);
+	}
+
+	*digest = sec_key.digest;
+	return ret && l1_gcry_secmem_init(
+			(size_t) sec_key.block_nbytes * sec_key.nselect, 1);
+}
+
+static bool write_manifest(const struct l1_manifest *manifest,
+		const char *filename) {
+	struct l1_out out;
+	size_t len;
+	char *text = l1_manifest_format(manifest, &len);
+	bool ret = false;
+
+	if (!text) {
+		return false;
+	}
+
+	if (!l1_out_open(&out, filename)) {
+		perror("Failed to open manifest file");
+	} else if (!l1_out_write(&out, text, len)) {
+		perror("Failed to write manifest file");
+		l1_out_abort(&out);
+	} else if (!l1_out_commit(&out)) {
+		perror("Failed to write manifest file");
+	} else {
+		ret = true;
+	}
+
+	free(text);
+	return ret;
+}
+
+/*
+ * Read the entire manifest file into memory.
+ */
+static char *read_manifest(const char *filename, size_t *len) {
+	struct stat st;
+	char *buf = NULL;
+	int fd;
+
+	if ((fd = open(filename, O_RDONLY | O_CLOEXEC)) < 0) {
+		perror("Failed to open manifest file");
+		return NULL;
+	}
+
+	if (fstat(fd, &st)) {
+		perror("Failed to stat manifest file");
+	} else if (!(buf = malloc(st.st_size ? st.st_size : 1))) {
+		fprintf(stderr, "Failed to allocate memory\n");
+	} else if (read(fd, buf, st.st_size) != st.st_size) {
+		fprintf(stderr, "Failed to read manifest file\n");
+		free(buf);
+		buf = NULL;
+	} else {
+		l1_stats_read(st.st_size);
+		*len = st.st_size;
+	}
+
+	close(fd);
+	return buf;
+}
+
+int l1_cmd_sign_tree(const struct options *opts, int argc, char **argv) {
+	L1_OPT_ACCEPT(CMD_NAME_SIGN, opts->message, L1_OPT_NAME_MESSAGE);
+	L1_OPT_REJECT(CMD_NAME_SIGN, opts->bundle, L1_OPT_NAME_BUNDLE);
+	L1_OPT_REJECT(CMD_NAME_SIGN, opts->checkpoint, L1_OPT_NAME_CHECKPOINT);
+	L1_OPT_REJECT(CMD_NAME_SIGN, opts->chunked, L1_OPT_NAME_CHUNKED);
+	L1_OPT_REJECT(CMD_NAME_SIGN, opts->nkeys, L1_OPT_NAME_KEY);
+	L1_OPT_REJECT(CMD_NAME_SIGN, opts->key_fd, L1_OPT_NAME_KEY_FD);
+	L1_OPT_REJECT(CMD_NAME_SIGN, opts->tee, L1_OPT_NAME_TEE);
+	L1_OPT_REJECT(CMD_NAME_SIGN, opts->tee_fd, L1_OPT_NAME_TEE_FD);
+
+	if (argc < 2 || argc > 3) {
+		print_cmd_usage(CMD_NAME_SIGN
+				" <directory> <secret-key-file> [signature-file]");
+		return EXIT_FAILURE;
+	}
+
+	char *dirname = argv[0];
+	char *sec_filename = argv[1];
+	char *sig_filename = argv[2];
+
+	struct l1_manifest manifest;
+	enum l1_stats_phase phase;
+	int root_fd;
+	int digest;
+
+	if (!strcmp(opts->message, "-")) {
+		fprintf(stderr, "Command '%s' requires a manifest file\n",
+				CMD_NAME_SIGN);
+		return EXIT_FAILURE;
+	}
+
+	if (!strcmp(dirname, "-") && !strcmp(sec_filename, "-")) {
+		fprintf(stderr, "Unable to read both file list and secret key from "
+				"standard input\n");
+		return EXIT_FAILURE;
+	}
+
+	if (!secret_key_digest(opts, sec_filename, &digest)) {
+		return EXIT_FAILURE;
+	}
+
+	l1_manifest_init(&manifest, digest);
+	l1_manifest_exclude(&manifest, opts->message);
+	l1_manifest_exclude(&manifest, sig_filename);
+
+	if ((root_fd = l1_manifest_collect(&manifest, dirname)) == -1
+			|| !l1_manifest_sort(&manifest)) {
+		close_root(root_fd);
+		l1_manifest_free(&manifest);
+		return EXIT_FAILURE;
+	}
+
+	if (opts->verbose) {
+		fprintf(stderr, "Files: %zu\n", manifest.nentries);
+	}
+
+	phase = l1_stats_phase(L1_PHASE_MESSAGE_HASH);
+
+	if (!l1_manifest_hash(&manifest, root_fd, opts->jobs, false)) {
+		close_root(root_fd);
+		l1_manifest_free(&manifest);
+		return EXIT_FAILURE;
+	}
+
+	l1_stats_phase(L1_PHASE_WRITE);
+	close_root(root_fd);
+	umask(0133);
+
+	if (!write_manifest(&manifest, opts->message)) {
+		l1_manifest_free(&manifest);
+		return EXIT_FAILURE;
+	}
+
+	l1_stats_phase(phase);
+	l1_manifest_free(&manifest);
+
+	/*
+	 * The manifest is signed like any other message.
+	 */
+	return l1_cmd_sign(opts, argc - 1, argv + 1);
+}
+
+int l1_cmd_verify_tree(const struct options *opts, int argc, char **argv) {
+	L1_OPT_ACCEPT(CMD_NAME_VERIFY, opts->message, L1_OPT_NAME_MESSAGE);
+	L1_OPT_REJECT(CMD_NAME_VERIFY, opts->bundle, L1_OPT_NAME_BUNDLE);
+	L1_OPT_REJECT(CMD_NAME_VERIFY, opts->burn, L1_OPT_NAME_BURN);
+	L1_OPT_REJECT(CMD_NAME_VERIFY, opts->key_fd, L1_OPT_NAME_KEY_FD);
+	L1_OPT_REJECT(CMD_NAME_VERIFY, opts->checkpoint, L1_OPT_NAME_CHECKPOINT);
+	L1_OPT_REJECT(CMD_NAME_VERIFY, opts->chunked, L1_OPT_NAME_CHUNKED);
+	L1_OPT_REJECT(CMD_NAME_VERIFY, opts->nkeys, L1_OPT_NAME_KEY);
+
+	if (opts->keyring ? argc < 1 || argc > 2 : argc < 2 || argc > 3) {
+		print_cmd_usage(opts->keyring
+				? CMD_NAME_VERIFY " <directory> [signature-file]"
+				: CMD_NAME_VERIFY
+					" <directory> <public-key-file> [signature-file]");
+		return EXIT_FAILURE;
+	}
+
+	char *dirname = argv[0];
+	char *sig_filename = argv[opts->keyring ? 1 : 2];
+
+	struct l1_manifest expected;
+	struct l1_manifest actual;
+	enum l1_stats_phase phase;
+	size_t manifest_len;
+	char *manifest_buf;
+	FILE *manifest_file;
+	int retval;
+	int root_fd;
+
+	if (!strcmp(opts->message, "-")) {
+		fprintf(stderr, "Command '%s' requires a manifest file\n",
+				CMD_NAME_VERIFY);
+		return EXIT_FAILURE;
+	}
+
+	if (!(manifest_buf = read_manifest(opts->message, &manifest_len))) {
+		return EXIT_FAILURE;
+	}
+
+	if (!(manifest_file = fmemopen(manifest_buf, manifest_len, "r"))) {
+		perror("Failed to open manifest file");
+		free(manifest_buf);
+		return EXIT_FAILURE;
+	}
+
+	/*
+	 * The files are only checked against a manifest with a valid signature,
+	 * so the signature is verified over the same copy that is parsed.
+	 */
+	retval = l1_cmd_verify_message(opts, manifest_file, argc - 1, argv + 1);
+	fclose(manifest_file);
+
+	if (retval != EXIT_SUCCESS) {
+		free(manifest_buf);
+		return retval;
+	}
+
+	l1_manifest_init(&expected, 0);
+	l1_manifest_init(&actual, 0);
+	l1_manifest_exclude(&actual, opts->message);
+	l1_manifest_exclude(&actual, sig_filename);
+
+	retval = EXIT_FAILURE;
+	root_fd = -1;
+
+	if (!l1_manifest_parse(&expected, manifest_buf, manifest_len)) {
+		goto out;
+	}
+
+	if (opts->verbose) {
+		fprintf(stderr, "Files: %zu\n", expected.nentries);
+	}
+
+	/*
+	 * With "-", the files of the manifest are checked relative to the
+	 * current directory and other files are ignored, while a directory must
+	 * contain exactly the files of the manifest.
+	 */
+	if (!strcmp(dirname, "-")) {
+		root_fd = AT_FDCWD;
+	} else if ((root_fd = l1_manifest_collect(&actual, dirname)) == -1
+			|| !l1_manifest_sort(&actual)
+			|| !l1_manifest_compare_paths(&expected, &actual)) {
+		goto out;
+	}
+
+	phase = l1_stats_phase(L1_PHASE_MESSAGE_HASH);
+
+	if (l1_manifest_hash(&expected, root_fd, opts->jobs, true)) {
+		retval = EXIT_SUCCESS;
+	}
+
+	l1_stats_phase(phase);
+
+out:
+	close_root(root_fd);
+	l1_manifest_free(&expected);
+	l1_manifest_free(&actual);
+	free(manifest_buf);
+	return retval;
+}
@@ -18,41 +18,355 @@
 
 #include "l1sign_cmd_verify.h"
 
+#include "l1sign_bundle.h"
+#include "l1sign_cache.h"
+#include "l1sign_checkpoint.h"
+#include "l1sign_cmd_multi.h"
 #include "l1sign_gcrypt.h"
+#include "l1sign_hash.h"
+#include "l1sign_io.h"
+#include "l1sign_key.h"
+#include "l1sign_keyring.h"
+#include "l1sign_ots.h"
+#include "l1sign_probe.h"
+#include "l1sign_stats.h"
 #include "l1sign_util.h"
 
+#include <fcntl.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #define CMD_NAME "verify"
 
+struct verify_ctx {
+	struct l1_hash *block_hash;
+	unsigned char *sigbuf;
+	unsigned char *pubbuf;
+	unsigned int hash_nbytes;
+	bool invalid;
+};
+
+/*
+ * Compare the hash of signature block 'idx' to the public key block selected
+ * for it once the latter has been read.
+ */
+static bool verify_block(size_t idx, void *arg) {
+	struct verify_ctx *ctx = arg;
+	size_t offset = (size_t) ctx->hash_nbytes * idx;
+	enum l1_stats_phase phase = l1_stats_phase(L1_PHASE_BLOCK_HASH);
+
+	unsigned char hash[L1_MAX_HASH_NBYTES];
+
+	if (!l1_ots_hash_block(ctx->block_hash, ctx->sigbuf + offset,
+				ctx->hash_nbytes, hash)
+			|| memcmp(hash, ctx->pubbuf + offset, ctx->hash_nbytes)) {
+		ctx->invalid = true;
+	}
+
+	L1_PROBE2(verify_block, idx, !ctx->invalid);
+	++l1_stats.block_hashes;
+	l1_stats_phase(phase);
+	return true;
+}
+
+/*
+ * Compute the cache key of a verification, which identifies the message
+ * digest and hash algorithm of 'pub_key' and their output lengths, the public
+ * key, and the signature.
+ */
+static bool verify_cache_key(const struct l1_key *pub_key,
+		unsigned char *pubkey, unsigned int key_nbytes, unsigned char *sigbuf,
+		unsigned int sig_nbytes, unsigned char *key) {
+	gcry_md_hd_t hd;
+	uint32_t params[] = {
+		pub_key->algo,
+		pub_key->block_nbytes,
+		pub_key->digest,
+		pub_key->digest_nbytes,
+	};
+
+	if (!(hd = l1_gcry_hash_hd_create(L1_FPR_ALGO, false))) {
+		return false;
+	}
+
+	gcry_md_write(hd, params, sizeof params);
+	gcry_md_write(hd, pubkey, key_nbytes);
+	gcry_md_write(hd, sigbuf, sig_nbytes);
+	memcpy(key, gcry_md_read(hd, GCRY_MD_NONE), L1_FPR_NBYTES);
+
+	l1_gcry_hash_hd_destroy(hd);
+	return true;
+}
+
+/*
+ * Read an entire public key into memory.
+ */
+static unsigned char *read_pubkey(FILE *pub_file, const struct l1_key *key,
+		unsigned int key_nbytes) {
+	unsigned char *pubkey = gcry_malloc(key_nbytes);
+	size_t head_nbytes;
+	size_t len;
+
+	if (!pubkey) {
+		fprintf(stderr, "Failed to allocate memory\n");
+		return NULL;
+	}
+
+	head_nbytes = l1_key_copy_head(key, pubkey);
+	len = fread(pubkey + head_nbytes, 1, key_nbytes - head_nbytes, pub_file);
+	l1_stats_read(len);
+	len += head_nbytes;
+
+	if (len != key_nbytes) {
+		fprintf(stderr, "Failed to read from public key file%s\n",
+				ferror(pub_file) ? "" : " (hash size mismatch?)");
+	} else if (fgetc(pub_file) != EOF) {
+		fprintf(stderr, "Warning: Partial read from public key file "
+				"(hash size mismatch?)\n");
+	} else {
+		return pubkey;
+	}
+
+	gcry_free(pubkey);
+	return NULL;
+}
+
+static bool read_signature(FILE *sig_file, unsigned char *sig,
+		unsigned int sig_nbytes) {
+	size_t len = fread(sig, 1, sig_nbytes, sig_file);
+
+	l1_stats_read(len);
+	return len == sig_nbytes;
+}
+
+struct keyring_match_ctx {
+	unsigned char *hash;
+	unsigned int hash_nbytes;
+	unsigned int key_nbytes;
+	struct l1_map *map;
+	unsigned char *pubkey;
+	bool verbose;
+};
+
+/*
+ * Accept a keyring candidate if the hash of the first signature block matches
+ * either of its first two blocks.  Only the matching key is mapped.
+ */
+static bool verify_keyring_match(const char *filename, off_t offset,
+		void *arg) {
+	struct keyring_match_ctx *ctx = arg;
+	struct stat st;
+	unsigned char *pubkey = NULL;
+	int fd;
+
+	if ((fd = open(filename, O_RDONLY | O_CLOEXEC)) < 0) {
+		return false;
+	}
+
+	if (!fstat(fd, &st) && st.st_size >= offset + ctx->key_nbytes) {
+		pubkey = l1_map_range(fd, offset, ctx->key_nbytes, ctx->map);
+	}
+
+	close(fd);
+
+	if (!pubkey) {
+		return false;
+	}
+
+	if (memcmp(pubkey, ctx->hash, ctx->hash_nbytes)
+			&& memcmp(pubkey + ctx->hash_nbytes, ctx->hash, ctx->hash_nbytes)) {
+		l1_unmap(ctx->map);
+		return false;
+	}
+
+	if (ctx->verbose) {
+		fprintf(stderr, "Public key: %s (offset %lld)\n",
+				filename, (long long) offset);
+	}
+
+	ctx->pubkey = pubkey;
+	return true;
+}
+
+/*
+ * Read the header of the bundle 'in', whose signature must have been created
+ * with a key like 'key' and have 'sig_nbytes' bytes.
+ */
+static bool read_bundle_header(FILE *in, const struct l1_key *key,
+		unsigned int sig_nbytes, struct l1_bundle *bundle) {
+	unsigned char header[L1_BUNDLE_HEADER_NBYTES];
+
+	if (fread(header, 1, sizeof header, in) != sizeof header) {
+		fprintf(stderr, "Failed to read from bundle%s\n",
+				ferror(in) ? "" : " (truncated bundle?)");
+		return false;
+	}
+
+	l1_stats_read(sizeof header);
+
+	if (!l1_bundle_decode_header(bundle, header, "bundle")) {
+		return false;
+	}
+
+	if (bundle->digest != key->digest || bundle->algo != key->algo
+			|| bundle->sig_nbytes != sig_nbytes) {
+		fprintf(stderr, "The bundle was not signed with the parameters of "
+				"the public key\n");
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Hash the message that follows the signature in bundle 'in' and spool it for
+ * output to 'out'.  The bundle must end with the message.
+ */
+static bool read_bundle_message(FILE *in, gcry_md_hd_t hd,
+		const struct l1_bundle *bundle, struct l1_bundle_spool *spool,
+		struct l1_out *out) {
+	l1_bundle_spool_init(spool, out);
+
+	if (!l1_bundle_spool_hash(spool, in, hd, bundle->msg_nbytes)) {
+		perror("Failed to read message from bundle");
+		return false;
+	}
+
+	if (spool->nbytes != bundle->msg_nbytes) {
+		fprintf(stderr, "Failed to read message from bundle "
+				"(truncated bundle?)\n");
+		return false;
+	}
+
+	if (fgetc(in) != EOF) {
+		fprintf(stderr, "Trailing data after message in bundle\n");
+		return false;
+	}
+
+	return true;
+}
+
 int l1_cmd_verify(const struct options *opts, int argc, char **argv) {
-	if (argc < 1 || argc > 2) {
-		print_cmd_usage(CMD_NAME " <public-key-file> [signature-file]");
+	return l1_cmd_verify_message(opts, NULL, argc, argv);
+}
+
+/*
+ * Verify the message read from 'msg_in' in place of the message file if it
+ * is not NULL.  The stream is left open.
+ */
+int l1_cmd_verify_message(const struct options *opts, FILE *msg_in, int argc,
+		char **argv) {
+	L1_OPT_REJECT(CMD_NAME, opts->pubkey, L1_OPT_NAME_PUBKEY);
+	L1_OPT_REJECT(CMD_NAME, opts->key_format, L1_OPT_NAME_FORMAT);
+	L1_OPT_REJECT(CMD_NAME, opts->burn, L1_OPT_NAME_BURN);
+	L1_OPT_REJECT(CMD_NAME, opts->checkpoint, L1_OPT_NAME_CHECKPOINT);
+	L1_OPT_REJECT(CMD_NAME, opts->key_fd, L1_OPT_NAME_KEY_FD);
+	L1_OPT_REJECT(CMD_NAME, opts->scheme, L1_OPT_NAME_SCHEME);
+
+	/*
+	 * With --bundle, the message is read from the bundle and passed through
+	 * to the file given by --tee once the signature has been verified.
+	 */
+	if (opts->bundle) {
+		L1_OPT_REJECT(CMD_NAME " --" L1_OPT_NAME_BUNDLE, opts->cache,
+				L1_OPT_NAME_CACHE);
+		L1_OPT_REJECT(CMD_NAME " --" L1_OPT_NAME_BUNDLE, opts->chunked,
+				L1_OPT_NAME_CHUNKED);
+		L1_OPT_REJECT(CMD_NAME " --" L1_OPT_NAME_BUNDLE, opts->nkeys,
+				L1_OPT_NAME_KEY);
+		L1_OPT_REJECT(CMD_NAME " --" L1_OPT_NAME_BUNDLE, opts->message,
+				L1_OPT_NAME_MESSAGE);
+	} else {
+		L1_OPT_REJECT(CMD_NAME, opts->tee, L1_OPT_NAME_TEE);
+		L1_OPT_REJECT(CMD_NAME, opts->tee_fd, L1_OPT_NAME_TEE_FD);
+	}
+
+	if (opts->tee) {
+		L1_OPT_REJECT(CMD_NAME " --" L1_OPT_NAME_TEE, opts->tee_fd,
+				L1_OPT_NAME_TEE_FD);
+	}
+
+	if (opts->chunked) {
+		L1_OPT_REJECT(CMD_NAME " --" L1_OPT_NAME_CHUNKED, opts->cache,
+				L1_OPT_NAME_CACHE);
+	}
+
+	if (opts->nkeys) {
+		L1_OPT_REJECT(CMD_NAME " --" L1_OPT_NAME_KEY, opts->cache,
+				L1_OPT_NAME_CACHE);
+		L1_OPT_REJECT(CMD_NAME " --" L1_OPT_NAME_KEY, opts->keyring,
+				L1_OPT_NAME_KEYRING);
+		return l1_cmd_verify_multi(opts, argc, argv);
+	}
+
+	if (opts->threshold) {
+		fprintf(stderr, "Option '--%s' requires option '--%s'\n",
+				L1_OPT_NAME_THRESHOLD, L1_OPT_NAME_KEY);
+		return EXIT_FAILURE;
+	}
+
+	if (opts->keyring ? argc > 1 : argc < 1 || argc > 2) {
+		print_cmd_usage(opts->keyring
+				? opts->bundle
+					? CMD_NAME " [bundle-file]"
+					: CMD_NAME " [signature-file]"
+				: opts->bundle
+					? CMD_NAME " <public-key-file> [bundle-file]"
+					: CMD_NAME " <public-key-file> [signature-file]");
 		return EXIT_FAILURE;
 	}
 
 	char *msg_filename = opts->message;
-	char *pub_filename = argv[0];
-	char *sig_filename = argv[1];
+	char *pub_filename = opts->keyring ? NULL : argv[0];
+	char *sig_filename = opts->keyring ? argv[0] : argv[1];
+	char *out_filename = opts->tee;
 
 	int retval = EXIT_SUCCESS;
 
-	gcry_md_hd_t hd;
+	struct l1_hash *block_hash;
+	gcry_md_hd_t msg_hd;
 
 	FILE *msg_file = stdin;
 	FILE *pub_file = stdin;
 	FILE *sig_file = stdin;
 
-	unsigned int hash_nbytes = l1_gcry_hash_nbytes(opts->hash);
-	unsigned int hash_nbits = hash_nbytes * 8;
+	struct l1_cache *cache = NULL;
+	struct l1_keyring *ring = NULL;
+	struct l1_map pub_map = { 0 };
+	struct stat msg_st;
+	struct stat *msg_st_ref = NULL;
+	unsigned char cache_key[L1_FPR_NBYTES];
+	unsigned char msg_fpr[L1_FPR_NBYTES];
+	unsigned char *pubkey = NULL;
+	unsigned char *msg_hash = NULL;
+	bool cached = false;
+	bool valid = false;
+
+	struct l1_key pub_key;
+	struct l1_bundle bundle;
+	struct l1_bundle_spool spool;
+	struct l1_out msg_out;
+	bool msg_out_open = false;
+
+	l1_bundle_spool_init(&spool, NULL);
 
 	if (!sig_filename && isatty(STDIN_FILENO)) {
 		fprintf(stderr, "Refusing implicit read from terminal\n");
 		return EXIT_FAILURE;
 	}
 
+	if (out_filename && !strcmp(out_filename, "-")) {
+		out_filename = NULL;
+	}
+
+	if (opts->bundle && !out_filename && !opts->tee_fd
+			&& isatty(STDOUT_FILENO)) {
+		fprintf(stderr, "Refusing implicit write to terminal\n");
+		return EXIT_FAILURE;
+	}
+
 	if (msg_filename && !strcmp(msg_filename, "-")) {
 		msg_filename = NULL;
 	}
@@ -65,7 +379,9 @@ int l1_cmd_verify(const struct options *opts, int argc, char **argv) {
 		sig_filename = NULL;
 	}
 
-	if (!msg_filename + !pub_filename + !sig_filename > 1) {
+	if ((!opts->bundle && !msg_filename && !msg_in)
+			+ (!opts->keyring && !pub_filename)
+			+ !sig_filename > 1) {
 		fprintf(stderr, "Unable to read multiple files from "
 				"standard input\n");
 		return EXIT_FAILURE;
@@ -74,113 +390,275 @@ int l1_cmd_verify(const struct options *opts, int argc, char **argv) {
 	setvbuf(pub_file, NULL, _IONBF, 0);
 	setvbuf(sig_file, NULL, _IONBF, 0);
 
-	if (msg_filename && !(msg_file = fopen(msg_filename, "r"))) {
+	if (msg_in) {
+		msg_file = msg_in;
+	} else if (msg_filename && !(msg_file = fopen(msg_filename, "r"))) {
 		perror("Failed to open message file");
 		return EXIT_FAILURE;
 	}
 
-	if (!(hd = l1_gcry_hash_hd_create(opts->hash, false))) {
+	if (!opts->keyring && pub_filename
+			&& !(pub_file = fopen(pub_filename, "r"))) {
+		perror("Failed to open public key file");
 		return EXIT_FAILURE;
 	}
 
-	if (!l1_gcry_hash_file(hd, msg_file)) {
-		fprintf(stderr, "Failed to read message\n");
-	}
-
-	unsigned char *msg_hash = gcry_malloc(hash_nbytes);
-	memcpy(msg_hash, gcry_md_read(hd, GCRY_MD_NONE), hash_nbytes);
-
-	if (opts->verbose) {
-		fprintf(stderr, "Message digest: ");
-		l1_gcry_print_digest(stderr, msg_hash, hash_nbytes);
+	if (sig_filename && !(sig_file = fopen(sig_filename, "r"))) {
+		perror("Failed to open signature file");
+		return EXIT_FAILURE;
 	}
 
-	if (msg_filename && fclose(msg_file)) {
-		perror("Failed to close message file");
+	if (opts->keyring) {
+		l1_key_init(&pub_key, L1_KEY_FORMAT_RAW, L1_KEY_TYPE_PUBLIC,
+				opts->digest, opts->hash, opts->hash_nbytes);
+	} else if (!l1_key_open(&pub_key, fileno(pub_file), "public key file",
+				L1_KEY_TYPE_PUBLIC, opts->digest, opts->hash,
+				opts->hash_nbytes, opts->key_explicit)) {
 		return EXIT_FAILURE;
+	} else if (opts->verbose) {
+		l1_key_print_info(&pub_key, "Public key");
 	}
 
-	if (pub_filename && !(pub_file = fopen(pub_filename, "r"))) {
-		perror("Failed to open public key file");
+	int algo = pub_key.algo;
+	unsigned int hash_nbytes = pub_key.block_nbytes;
+	unsigned int hash_nbits = pub_key.digest_nbytes * 8;
+	unsigned int nselect = pub_key.nselect;
+	unsigned int sig_nbytes = hash_nbytes * nselect;
+	unsigned int key_nbytes = hash_nbytes * pub_key.nblocks;
+
+	if (!(block_hash = l1_hash_create(opts->hash_backend, algo, hash_nbytes,
+			false))) {
 		return EXIT_FAILURE;
 	}
 
-	if (sig_filename && !(sig_file = fopen(sig_filename, "r"))) {
-		perror("Failed to open signature file");
+	if (!(msg_hd = l1_gcry_hash_hd_create(pub_key.digest, false))) {
+		l1_hash_destroy(block_hash);
 		return EXIT_FAILURE;
 	}
 
-	void *blkbuf = gcry_malloc(hash_nbytes);
+	unsigned char *sigbuf = gcry_malloc(sig_nbytes);
+	unsigned char *pubbuf = gcry_malloc(sig_nbytes);
 
-	if (!blkbuf) {
+	if (!sigbuf || !pubbuf) {
 		fprintf(stderr, "Failed to allocate memory\n");
+		gcry_free(sigbuf);
+		gcry_free(pubbuf);
+		l1_gcry_hash_hd_destroy(msg_hd);
+		l1_hash_destroy(block_hash);
 		return EXIT_FAILURE;
 	}
 
-	bool invalid = false;
+	struct verify_ctx ctx = { block_hash, sigbuf, pubbuf, hash_nbytes, false };
 
-	for (unsigned int i = 0; i < hash_nbits; ++i) {
-		unsigned char dbit = l1_bit_get(msg_hash, hash_nbytes, i);
+	l1_stats_phase(L1_PHASE_KEY_READ);
 
-		if (!fread(blkbuf, hash_nbytes, 1, sig_file)) {
-			fprintf(stderr, "Failed to read from signature file%s\n",
-					i ? " (hash size mismatch?)" : "");
+	if (opts->bundle && !read_bundle_header(sig_file, &pub_key, sig_nbytes,
+				&bundle)) {
+		retval = EXIT_FAILURE;
+	} else if (!read_signature(sig_file, sigbuf, sig_nbytes)) {
+		fprintf(stderr, "Failed to read from signature file%s\n",
+				ferror(sig_file) ? "" : " (hash size mismatch?)");
+		retval = EXIT_FAILURE;
+	} else if (!opts->bundle && fgetc(sig_file) != EOF) {
+		fprintf(stderr, "Warning: Partial read from signature file "
+				"(hash size mismatch?)\n");
+		retval = EXIT_FAILURE;
+	}
+
+	if (retval == EXIT_SUCCESS && opts->keyring) {
+		unsigned char hash[L1_MAX_HASH_NBYTES];
+		struct keyring_match_ctx match = {
+			hash, hash_nbytes, key_nbytes, &pub_map, NULL, opts->verbose,
+		};
+
+		if (!l1_gcry_hash_buffer(algo, hash, hash_nbytes, sigbuf,
+					hash_nbytes)) {
+			retval = EXIT_FAILURE;
+		} else if (!(ring = l1_keyring_open(opts->keyring, pub_key.digest,
+						algo, hash_nbytes, false))) {
+			retval = EXIT_FAILURE;
+		} else if (!l1_keyring_find(ring, hash, verify_keyring_match, &match)) {
+			fprintf(stderr, "No matching public key found in keyring\n");
 			retval = EXIT_FAILURE;
-			break;
 		}
 
-		gcry_md_reset(hd);
-		gcry_md_write(hd, blkbuf, hash_nbytes);
-
-		void *hash = gcry_md_read(hd, GCRY_MD_NONE);
+		pubkey = match.pubkey;
+	}
 
-		if (fseek(pub_file, hash_nbytes * (i * 2 + dbit), SEEK_SET)) {
-			perror("Failed to seek within public key file");
+	/*
+	 * The blocks of version 1 keys are accessed directly through a mapping,
+	 * or read in full from a stream, as their blocks may be selected by
+	 * another scheme.
+	 */
+	if (retval == EXIT_SUCCESS && pub_key.format == L1_KEY_FORMAT_V1) {
+		if (pub_key.head_nbytes) {
+			if (!(pubkey = read_pubkey(pub_file, &pub_key, key_nbytes))) {
+				retval = EXIT_FAILURE;
+			}
+		} else if (!(pubkey = l1_key_map(&pub_key, fileno(pub_file),
+						&pub_map))) {
+			perror("Failed to map public key file");
 			retval = EXIT_FAILURE;
-			break;
 		}
+	}
 
-		if (!fread(blkbuf, hash_nbytes, 1, pub_file)) {
-			fprintf(stderr, "Failed to read from public key file%s\n",
-					i ? " (hash size mismatch?)" : "");
+	/*
+	 * The cache key covers the entire public key, so it is read in full.
+	 * A cached verdict is used without hashing the message if the message
+	 * file has not changed since the verdict was recorded.
+	 */
+	if (retval == EXIT_SUCCESS && opts->cache
+			&& (cache = l1_cache_open(opts->cache))) {
+		if (!pubkey && !(pubkey = read_pubkey(pub_file, &pub_key,
+						key_nbytes))) {
+			retval = EXIT_FAILURE;
+		} else if (!verify_cache_key(&pub_key, pubkey, key_nbytes, sigbuf,
+					sig_nbytes, cache_key)) {
 			retval = EXIT_FAILURE;
-			break;
 		}
 
-		if (memcmp(hash, blkbuf, hash_nbytes)) {
-			invalid = true;
+		if (!fstat(fileno(msg_file), &msg_st) && S_ISREG(msg_st.st_mode)) {
+			msg_st_ref = &msg_st;
+		}
+
+		if (retval == EXIT_SUCCESS && msg_st_ref) {
+			cached = l1_cache_lookup(cache, cache_key, msg_st_ref, NULL,
+					&valid);
 		}
 	}
 
-	if (fseek(pub_file, hash_nbytes * hash_nbits * 2, SEEK_SET)) {
-		perror("Failed to seek within public key file");
-		retval = EXIT_FAILURE;
+	if (retval == EXIT_SUCCESS && !cached) {
+		l1_stats_phase(L1_PHASE_MESSAGE_HASH);
+
+		if (!(msg_hash = gcry_malloc(hash_nbits / 8))) {
+			fprintf(stderr, "Failed to allocate memory\n");
+			retval = EXIT_FAILURE;
+		} else if (opts->chunked) {
+			if (!l1_checkpoint_hash_file(pub_key.digest, msg_file, NULL,
+						msg_hash, hash_nbits / 8)) {
+				retval = EXIT_FAILURE;
+			}
+		} else if (opts->bundle) {
+			if (opts->tee_fd) {
+				msg_out_open = true;
+				l1_out_open_fd(&msg_out, opts->tee_fd);
+			} else {
+				msg_out_open = l1_out_open(&msg_out, out_filename);
+			}
+
+			if (!msg_out_open) {
+				perror("Failed to open message output file");
+				retval = EXIT_FAILURE;
+			} else if (!read_bundle_message(sig_file, msg_hd, &bundle,
+						&spool, &msg_out)) {
+				retval = EXIT_FAILURE;
+			}
+
+			l1_gcry_hash_read(msg_hd, msg_hash, hash_nbits / 8);
+		} else {
+			if (!l1_gcry_hash_file(msg_hd, msg_file)) {
+				fprintf(stderr, "Failed to read message\n");
+				retval = EXIT_FAILURE;
+			}
+
+			l1_gcry_hash_read(msg_hd, msg_hash, hash_nbits / 8);
+		}
+
+		if (retval == EXIT_SUCCESS && opts->verbose) {
+			fprintf(stderr, "Message digest: ");
+			l1_gcry_print_digest(stderr, msg_hash, hash_nbits / 8);
+		}
+
+		if (retval == EXIT_SUCCESS && cache) {
+			gcry_md_hash_buffer(L1_FPR_ALGO, msg_fpr, msg_hash, hash_nbits / 8);
+			cached = l1_cache_lookup(cache, cache_key, NULL, msg_fpr, &valid);
+		}
 	}
 
-	if (retval == EXIT_SUCCESS && fgetc(pub_file) != EOF) {
-		fprintf(stderr, "Warning: Partial read from public key file "
-				"(hash size mismatch?)\n");
-		retval = EXIT_FAILURE;
+	if (retval == EXIT_SUCCESS && !cached) {
+		l1_stats_phase(L1_PHASE_KEY_READ);
+
+		if (pubkey) {
+			l1_key_select(&pub_key, pubkey, msg_hash, pubbuf);
+			l1_stats_phase(L1_PHASE_BLOCK_HASH);
+
+			if (!l1_ots_verify(block_hash, sigbuf, pubbuf, hash_nbytes,
+					nselect)) {
+				ctx.invalid = true;
+			}
+
+			l1_stats.block_hashes += nselect;
+		} else if (!l1_key_read_blocks(&pub_key, opts->io_engine,
+					fileno(pub_file), "public key file", msg_hash, pubbuf,
+					verify_block, &ctx)) {
+			retval = EXIT_FAILURE;
+		}
+
+		valid = !ctx.invalid;
+	} else if (cached && opts->verbose) {
+		fprintf(stderr, "Using cached verification result\n");
 	}
 
-	if (retval == EXIT_SUCCESS && fgetc(sig_file) != EOF) {
-		fprintf(stderr, "Warning: Partial read from signature file "
-				"(hash size mismatch?)\n");
-		retval = EXIT_FAILURE;
+	/*
+	 * Record the verdict along with the current identity of the message, so
+	 * that the next lookup does not need to hash the message again.
+	 */
+	if (retval == EXIT_SUCCESS && cache && msg_hash) {
+		l1_cache_store(cache, cache_key, msg_st_ref, msg_fpr, valid);
 	}
 
-	if (invalid) {
+	if (retval == EXIT_SUCCESS && !valid) {
 		fprintf(stderr, "Invalid signature\n");
 		retval = EXIT_FAILURE;
 	}
 
+	/*
+	 * The message of a bundle is only released if its signature is valid.
+	 */
+	if (msg_out_open) {
+		if (retval != EXIT_SUCCESS) {
+			l1_out_abort(&msg_out);
+		} else if (!l1_bundle_spool_flush(&spool, &msg_out)) {
+			perror("Failed to write message");
+			l1_out_abort(&msg_out);
+			retval = EXIT_FAILURE;
+		} else if (!l1_out_commit(&msg_out)) {
+			perror("Failed to save message output file");
+			retval = EXIT_FAILURE;
+		}
+	}
+
+	l1_bundle_spool_free(&spool);
+
 	if (opts->verbose && retval != EXIT_FAILURE) {
 		fprintf(stderr, "Signature is valid\n");
 	}
 
-	gcry_free(blkbuf);
+	if (cache) {
+		l1_cache_close(cache);
+	}
 
-	l1_gcry_hash_hd_destroy(hd);
+	if (ring) {
+		l1_keyring_close(ring);
+	}
+
+	if (pub_map.addr) {
+		l1_unmap(&pub_map);
+	} else {
+		gcry_free(pubkey);
+	}
+
+	gcry_free(pubbuf);
+	gcry_free(sigbuf);
+	gcry_free(msg_hash);
+
+	l1_gcry_hash_hd_destroy(msg_hd);
+	l1_hash_destroy(block_hash);
+
+	if (msg_filename && !msg_in && fclose(msg_file)) {
+		perror("Failed to close message file");
+		return EXIT_FAILURE;
+	}
 
 	if (pub_filename && fclose(pub_file)) {
 		perror("Failed to close public key file");
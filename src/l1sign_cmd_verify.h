@@ -21,6 +21,10 @@
 
 #include "l1sign.h"
 
+#include <stdio.h>
+
 int l1_cmd_verify(const struct options *opts, int argc, char **argv);
+int l1_cmd_verify_message(const struct options *opts, FILE *msg_in, int argc,
+		char **argv);
 
 #endif
@@ -18,36 +18,99 @@
 
 #include "l1sign_gcrypt.h"
 
-#define FILE_BUFFER_LEN 256
+#include "l1sign_probe.h"
+#include "l1sign_stats.h"
 
+#define FILE_BUFFER_LEN 65536
+
+#include <limits.h>
 #include <stdlib.h>
+#include <string.h>
 
 void l1_gcry_handle_err(const char *desc, gcry_error_t err) {
 	fprintf(stderr, "%s: %s\n", desc, gcry_strerror(err));
 }
 
-bool l1_gcry_init(int algo) {
-	gcry_error_t err = 0;
-	int secmem_nbytes;
+static bool initialized;
+static size_t initialized_secmem_nbytes;
 
+/*
+ * Initialize libgcrypt for message digest 'digest' and hash algorithm 'algo'
+ * with 'nbytes'-byte blocks.  Initialization is completed by
+ * l1_gcry_secmem_init() or, for commands that use no secure memory, by
+ * l1_gcry_finish().
+ */
+bool l1_gcry_init(int digest, int algo, unsigned int nbytes) {
 	if (!gcry_check_version(NEED_LIBGCRYPT_VERSION)) {
 		fprintf(stderr, PACKAGE_NAME " requires libgcrypt "
 				NEED_LIBGCRYPT_VERSION " or later.\n");
 		return false;
 	}
 
-	if (l1_gcry_check_hash(algo) != 0) {
+	if (l1_gcry_check_hash(algo, nbytes) != 0
+			|| l1_gcry_check_hash(digest,
+				l1_gcry_digest_nbytes(digest, algo, nbytes)) != 0) {
 		return false;
 	}
 
-	secmem_nbytes = l1_gcry_key_nbytes(algo) + L1_SECMEM_EXTRA_NBYTES;
+	return true;
+}
+
+/*
+ * Complete the initialization of libgcrypt.  Secure memory can no longer be
+ * set up afterwards.
+ */
+bool l1_gcry_finish(void) {
+	gcry_error_t err = 0;
+
+	if (initialized) {
+		return true;
+	}
+
+	if ((err = gcry_control(GCRYCTL_INITIALIZATION_FINISHED))) {
+		l1_gcry_handle_err("Failed to complete initialization", err);
+		return false;
+	}
+
+	initialized = true;
+	return true;
+}
+
+/*
+ * Set up enough secure memory for 'nkeys' keys (at least one) of 'key_nbytes'
+ * bytes.  The size of a key is only known once its header has been read, so
+ * this is done by the commands that handle secret keys, before they allocate
+ * any secure memory, and completes the initialization of libgcrypt.
+ */
+bool l1_gcry_secmem_init(size_t key_nbytes, size_t nkeys) {
+	size_t secmem_nbytes = key_nbytes * (nkeys ? nkeys : 1)
+		+ L1_SECMEM_EXTRA_NBYTES;
+	gcry_error_t err = 0;
+
+	/*
+	 * Commands that run other commands may set up secure memory first.
+	 */
+	if (initialized) {
+		if (secmem_nbytes > initialized_secmem_nbytes) {
+			fprintf(stderr, "Secure memory has already been set up\n");
+			return false;
+		}
+
+		return true;
+	}
+
+	if (secmem_nbytes > UINT_MAX) {
+		fprintf(stderr, "Keys are too large for secure memory\n");
+		return false;
+	}
 
 	if ((err = gcry_control(GCRYCTL_SUSPEND_SECMEM_WARN))) {
 		l1_gcry_handle_err("Failed to suspend secure memory warnings", err);
 		return false;
 	}
 
-	if ((err = gcry_control(GCRYCTL_INIT_SECMEM, secmem_nbytes))) {
+	if ((err = gcry_control(GCRYCTL_INIT_SECMEM,
+					(unsigned int) secmem_nbytes))) {
 		l1_gcry_handle_err("Failed to initialize secure memory", err);
 		return false;
 	}
@@ -57,12 +120,8 @@ bool l1_gcry_init(int algo) {
 		return false;
 	}
 
-	if ((err = gcry_control(GCRYCTL_INITIALIZATION_FINISHED))) {
-		l1_gcry_handle_err("Failed to complete initialization", err);
-		return false;
-	}
-
-	return true;
+	initialized_secmem_nbytes = secmem_nbytes;
+	return l1_gcry_finish();
 }
 
 void l1_gcry_term(void) {
@@ -73,8 +132,25 @@ void l1_gcry_term(void) {
 	}
 }
 
-int l1_gcry_check_hash(int algo) {
-	unsigned int nbytes = l1_gcry_hash_nbytes(algo);
+/*
+ * Check whether hash algorithm 'algo' can produce 'nbytes'-byte digests that
+ * fit the limits of this system.
+ */
+int l1_gcry_check_hash(int algo, unsigned int nbytes) {
+	if (!l1_gcry_hash_is_xof(algo) && nbytes != l1_gcry_hash_nbytes(algo)) {
+		fprintf(stderr,
+				"Hash function %s produces %u bits and does not support other "
+				"output lengths\n",
+				gcry_md_algo_name(algo),
+				l1_gcry_hash_nbytes(algo) * 8);
+		return 1;
+	}
+
+	if (!nbytes) {
+		fprintf(stderr, "Hash function %s cannot be used\n",
+				gcry_md_algo_name(algo));
+		return 1;
+	}
 
 	if (nbytes > L1_MAX_HASH_NBYTES) {
 		fprintf(stderr,
@@ -89,13 +165,51 @@ int l1_gcry_check_hash(int algo) {
 	return 0;
 }
 
+/*
+ * Check whether 'algo' is an extendable-output function, which has no fixed
+ * digest length.
+ */
+bool l1_gcry_hash_is_xof(int algo) {
+	return algo && !gcry_md_get_algo_dlen(algo);
+}
+
+/*
+ * Return the default digest length of hash algorithm 'algo'.  Extendable-output
+ * functions default to twice their security strength.
+ */
 unsigned int l1_gcry_hash_nbytes(int algo) {
-	return gcry_md_get_algo_dlen(algo);
+	switch (algo) {
+	case GCRY_MD_SHAKE128:
+		return 32;
+	case GCRY_MD_SHAKE256:
+		return 64;
+	default:
+		return gcry_md_get_algo_dlen(algo);
+	}
 }
 
-unsigned int l1_gcry_key_nbytes(int algo) {
-	unsigned int bytes = l1_gcry_hash_nbytes(algo);
-	return 2 * bytes * (bytes * 8);
+/*
+ * Return the length of the message digests that 'digest' produces for keys
+ * that use hash algorithm 'algo' with 'block_nbytes'-byte blocks.  An
+ * extendable-output function that is also the hash algorithm produces digests
+ * of the block size, so --hash-bytes sets both lengths.
+ */
+unsigned int l1_gcry_digest_nbytes(int digest, int algo,
+		unsigned int block_nbytes) {
+	if (digest == algo && l1_gcry_hash_is_xof(digest)) {
+		return block_nbytes;
+	}
+
+	return l1_gcry_hash_nbytes(digest);
+}
+
+/*
+ * Return the size of a key that has two 'block_nbytes'-byte blocks for each
+ * bit of a 'digest_nbytes'-byte message digest.
+ */
+unsigned int l1_gcry_key_nbytes(unsigned int digest_nbytes,
+		unsigned int block_nbytes) {
+	return 2 * block_nbytes * (digest_nbytes * 8);
 }
 
 gcry_md_hd_t l1_gcry_hash_hd_create(int algo, bool secure) {
@@ -120,20 +234,93 @@ void l1_gcry_hash_hd_destroy(gcry_md_hd_t hd) {
 	gcry_md_close(hd);
 }
 
+/*
+ * Copy the first 'nbytes' bytes of the digest of 'hd' to 'out'.
+ */
+void l1_gcry_hash_read(gcry_md_hd_t hd, void *out, unsigned int nbytes) {
+	int algo = gcry_md_get_algo(hd);
+
+	if (l1_gcry_hash_is_xof(algo)) {
+		gcry_md_extract(hd, algo, out, nbytes);
+	} else {
+		memcpy(out, gcry_md_read(hd, algo), nbytes);
+	}
+}
+
+/*
+ * Compute the 'nbytes'-byte digest of 'len' bytes of 'buf'.  Unlike
+ * gcry_md_hash_buffer(), this supports extendable-output functions.
+ */
+bool l1_gcry_hash_buffer(int algo, void *out, unsigned int nbytes,
+		const void *buf, size_t len) {
+	gcry_md_hd_t hd;
+
+	if (!l1_gcry_hash_is_xof(algo)) {
+		gcry_md_hash_buffer(algo, out, buf, len);
+		return true;
+	}
+
+	if (!(hd = l1_gcry_hash_hd_create(algo, false))) {
+		return false;
+	}
+
+	gcry_md_write(hd, buf, len);
+	l1_gcry_hash_read(hd, out, nbytes);
+	l1_gcry_hash_hd_destroy(hd);
+	return true;
+}
+
+/*
+ * Allocate a buffer in secure memory.  Buffers must be released with
+ * l1_gcry_secmem_free() so that secure memory usage can be tracked.
+ */
+void *l1_gcry_secmem_alloc(size_t nbytes) {
+	void *buf = gcry_malloc_secure(nbytes);
+
+	if (buf) {
+		l1_stats_secmem(nbytes, 0);
+	}
+
+	L1_PROBE2(secmem_alloc, nbytes, buf);
+	return buf;
+}
+
+void l1_gcry_secmem_free(void *buf, size_t nbytes) {
+	if (buf) {
+		L1_PROBE2(secmem_free, nbytes, buf);
+		gcry_free(buf);
+		l1_stats_secmem(0, nbytes);
+	}
+}
+
 /*
  * Hash an entire file.
  * Buffers are allocated in secure memory if and only if the digest object is
  * allocated in secure memory.
  */
 bool l1_gcry_hash_file(gcry_md_hd_t hd, FILE *in) {
-	void *(*mem_alloc)(size_t n) = gcry_md_is_secure(hd)
-		? gcry_malloc_secure
-		: gcry_malloc;
-	char *buf = mem_alloc(FILE_BUFFER_LEN);
+	return l1_gcry_hash_file_bufsize(hd, in, FILE_BUFFER_LEN);
+}
+
+/*
+ * Hash an entire file, reading 'buf_nbytes' bytes at a time.
+ */
+bool l1_gcry_hash_file_bufsize(gcry_md_hd_t hd, FILE *in, size_t buf_nbytes) {
+	bool secure = gcry_md_is_secure(hd);
+	char *buf = secure
+		? l1_gcry_secmem_alloc(buf_nbytes)
+		: gcry_malloc(buf_nbytes);
 	bool ret = false;
 
+	if (!buf) {
+		return false;
+	}
+
 	for (;;) {
-		size_t len = fread(buf, 1, sizeof buf, in);
+		size_t len = fread(buf, 1, buf_nbytes, in);
+
+		l1_stats_read(len);
+		L1_PROBE1(message_block, len);
 
 		if (ferror(in)) {
 			break;
@@ -147,7 +334,12 @@ bool l1_gcry_hash_file(gcry_md_hd_t hd, FILE *in) {
 		}
 	}
 
-	gcry_free(buf);
+	if (secure) {
+		l1_gcry_secmem_free(buf, buf_nbytes);
+	} else {
+		gcry_free(buf);
+	}
+
 	return ret;
 }
 
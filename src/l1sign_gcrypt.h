@@ -26,6 +26,9 @@
 
 #define L1_SECMEM_EXTRA_NBYTES 8192
 
+#define L1_FPR_ALGO GCRY_MD_SHA256
+#define L1_FPR_NBYTES 32
+
 #if SIZEOF_INT >= 4
 #	define L1_MAX_HASH_NBYTES 8192
 #else
@@ -35,14 +38,26 @@
 #include <stdbool.h>
 
 void l1_gcry_handle_err(const char *desc, gcry_error_t err);
-bool l1_gcry_init(int secmem_nbytes);
+bool l1_gcry_init(int digest, int algo, unsigned int nbytes);
+bool l1_gcry_finish(void);
+bool l1_gcry_secmem_init(size_t key_nbytes, size_t nkeys);
 void l1_gcry_term(void);
-int l1_gcry_check_hash(int algo);
+int l1_gcry_check_hash(int algo, unsigned int nbytes);
+bool l1_gcry_hash_is_xof(int algo);
 unsigned int l1_gcry_hash_nbytes(int algo);
-unsigned int l1_gcry_key_nbytes(int algo);
+unsigned int l1_gcry_digest_nbytes(int digest, int algo,
+		unsigned int block_nbytes);
+unsigned int l1_gcry_key_nbytes(unsigned int digest_nbytes,
+		unsigned int block_nbytes);
 gcry_md_hd_t l1_gcry_hash_hd_create(int algo, bool secure);
 void l1_gcry_hash_hd_destroy(gcry_md_hd_t hd);
+void l1_gcry_hash_read(gcry_md_hd_t hd, void *out, unsigned int nbytes);
+bool l1_gcry_hash_buffer(int algo, void *out, unsigned int nbytes,
+		const void *buf, size_t len);
+void *l1_gcry_secmem_alloc(size_t nbytes);
+void l1_gcry_secmem_free(void *buf, size_t nbytes);
 bool l1_gcry_hash_file(gcry_md_hd_t hd, FILE *in);
+bool l1_gcry_hash_file_bufsize(gcry_md_hd_t hd, FILE *in, size_t buf_nbytes);
 void l1_gcry_print_digest(FILE *out, unsigned char *digest, size_t len);
 
 #endif
@@ -0,0 +1,248 @@
+/*
+ * l1sign - Implementation of the Lamport-Diffie one-time signature scheme
+ * Copyright (c) 2019  Janik Rabe <info@janikrabe.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "l1sign_hash.h"
+
+#include "l1sign_gcrypt.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_OPENSSL
+#	include <openssl/err.h>
+#	include <openssl/evp.h>
+#endif
+
+static bool gcrypt_open(struct l1_hash *hash, bool secure) {
+	return (hash->state = l1_gcry_hash_hd_create(hash->algo, secure)) != NULL;
+}
+
+static bool gcrypt_digest(struct l1_hash *hash, const void *in, size_t len,
+		void *out) {
+	gcry_md_hd_t hd = hash->state;
+
+	gcry_md_reset(hd);
+	gcry_md_write(hd, in, len);
+	l1_gcry_hash_read(hd, out, hash->nbytes);
+	return true;
+}
+
+static void gcrypt_close(struct l1_hash *hash) {
+	l1_gcry_hash_hd_destroy(hash->state);
+}
+
+#ifdef HAVE_OPENSSL
+struct openssl_state {
+	EVP_MD *md;
+	EVP_MD_CTX *ctx;
+	bool xof;
+};
+
+/*
+ * The libcrypto names of the libgcrypt hash functions that it implements.
+ */
+static const struct {
+	int algo;
+	const char *name;
+} openssl_names[] = {
+	{ GCRY_MD_BLAKE2B_512, "BLAKE2B-512" },
+	{ GCRY_MD_BLAKE2S_256, "BLAKE2S-256" },
+	{ GCRY_MD_MD5, "MD5" },
+	{ GCRY_MD_RMD160, "RIPEMD-160" },
+	{ GCRY_MD_SHA1, "SHA1" },
+	{ GCRY_MD_SHA224, "SHA2-224" },
+	{ GCRY_MD_SHA256, "SHA2-256" },
+	{ GCRY_MD_SHA384, "SHA2-384" },
+	{ GCRY_MD_SHA512, "SHA2-512" },
+	{ GCRY_MD_SHA512_224, "SHA2-512/224" },
+	{ GCRY_MD_SHA512_256, "SHA2-512/256" },
+	{ GCRY_MD_SHA3_224, "SHA3-224" },
+	{ GCRY_MD_SHA3_256, "SHA3-256" },
+	{ GCRY_MD_SHA3_384, "SHA3-384" },
+	{ GCRY_MD_SHA3_512, "SHA3-512" },
+	{ GCRY_MD_SHAKE128, "SHAKE-128" },
+	{ GCRY_MD_SHAKE256, "SHAKE-256" },
+	{ GCRY_MD_SM3, "SM3" },
+};
+
+static const char *openssl_name(int algo) {
+	for (size_t i = 0; i < sizeof openssl_names / sizeof *openssl_names;
+			++i) {
+		if (openssl_names[i].algo == algo) {
+			return openssl_names[i].name;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * libcrypto allocates hash states itself and cannot keep them in secure
+ * memory, so this backend is never asked for a secure instance.
+ */
+static bool openssl_open(struct l1_hash *hash, bool secure) {
+	struct openssl_state *state = calloc(1, sizeof *state);
+	const char *name = openssl_name(hash->algo);
+
+	(void) secure;
+
+	if (!state) {
+		fprintf(stderr, "Failed to allocate memory\n");
+		return false;
+	}
+
+	if (!name || !(state->md = EVP_MD_fetch(NULL, name, NULL))) {
+		fprintf(stderr, "Hash function %s is not supported by the openssl "
+				"backend\n", gcry_md_algo_name(hash->algo));
+		free(state);
+		return false;
+	}
+
+	state->xof = EVP_MD_get_flags(state->md) & EVP_MD_FLAG_XOF;
+
+	if (!state->xof && (unsigned int) EVP_MD_get_size(state->md)
+			!= hash->nbytes) {
+		fprintf(stderr, "Hash function %s produces a different output "
+				"length in the openssl backend\n",
+				gcry_md_algo_name(hash->algo));
+		EVP_MD_free(state->md);
+		free(state);
+		return false;
+	}
+
+	if (!(state->ctx = EVP_MD_CTX_new())) {
+		fprintf(stderr, "Failed to allocate memory\n");
+		EVP_MD_free(state->md);
+		free(state);
+		return false;
+	}
+
+	/*
+	 * Each digest reinitializes the context with the fetched implementation
+	 * instead of looking it up again.
+	 */
+	if (!EVP_DigestInit_ex2(state->ctx, state->md, NULL)) {
+		fprintf(stderr, "Failed to initialize hash function %s\n",
+				gcry_md_algo_name(hash->algo));
+		EVP_MD_CTX_free(state->ctx);
+		EVP_MD_free(state->md);
+		free(state);
+		return false;
+	}
+
+	hash->state = state;
+	return true;
+}
+
+static bool openssl_digest(struct l1_hash *hash, const void *in, size_t len,
+		void *out) {
+	struct openssl_state *state = hash->state;
+
+	if (!EVP_DigestInit_ex2(state->ctx, NULL, NULL)
+			|| !EVP_DigestUpdate(state->ctx, in, len)) {
+		return false;
+	}
+
+	return state->xof
+		? EVP_DigestFinalXOF(state->ctx, out, hash->nbytes)
+		: EVP_DigestFinal_ex(state->ctx, out, NULL);
+}
+
+static void openssl_close(struct l1_hash *hash) {
+	struct openssl_state *state = hash->state;
+
+	EVP_MD_CTX_free(state->ctx);
+	EVP_MD_free(state->md);
+	free(state);
+}
+#endif
+
+static const struct l1_hash_backend backends[] = {
+	{
+		"gcrypt",
+		"Use libgcrypt",
+		true,
+		gcrypt_open,
+		gcrypt_digest,
+		gcrypt_close,
+	},
+#ifdef HAVE_OPENSSL
+	{
+		"openssl",
+		"Use the EVP interface of OpenSSL libcrypto",
+		false,
+		openssl_open,
+		openssl_digest,
+		openssl_close,
+	},
+#endif
+	{
+		NULL,
+		NULL,
+		false,
+		NULL,
+		NULL,
+		NULL,
+	},
+};
+
+const struct l1_hash_backend *l1_hash_find_backend(const char *name) {
+	for (size_t i = 0; backends[i].name; ++i) {
+		if (!strcmp(name, backends[i].name)) {
+			return &backends[i];
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Create an instance of hash function 'algo' with 'nbytes' bytes of output.
+ * If 'secure' is set, the state is kept in secure memory, and backends that
+ * cannot do so are replaced with libgcrypt, which produces the same hashes.
+ */
+struct l1_hash *l1_hash_create(const struct l1_hash_backend *backend,
+		int algo, unsigned int nbytes, bool secure) {
+	struct l1_hash *hash = calloc(1, sizeof *hash);
+
+	if (!hash) {
+		fprintf(stderr, "Failed to allocate memory\n");
+		return NULL;
+	}
+
+	if (secure && !backend->secure) {
+		backend = &backends[0];
+	}
+
+	hash->backend = backend;
+	hash->algo = algo;
+	hash->nbytes = nbytes;
+
+	if (!backend->open(hash, secure)) {
+		free(hash);
+		return NULL;
+	}
+
+	return hash;
+}
+
+void l1_hash_destroy(struct l1_hash *hash) {
+	hash->backend->close(hash);
+	free(hash);
+}
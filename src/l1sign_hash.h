@@ -0,0 +1,67 @@
+/*
+ * l1sign - Implementation of the Lamport-Diffie one-time signature scheme
+ * Copyright (c) 2019  Janik Rabe <info@janikrabe.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef L1SIGN_HASH_H
+#define L1SIGN_HASH_H
+
+#include <config.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * An instance of a hash function of a backend, which computes the block
+ * hashes of keys and signatures.  Message digests, secure memory, and random
+ * numbers are always provided by libgcrypt.  Instances must not be shared
+ * between threads.
+ *
+ * Backends that cannot keep their state in secure memory ('secure' is unset)
+ * are only used for public data.
+ */
+struct l1_hash {
+	const struct l1_hash_backend *backend;
+	int algo;
+	unsigned int nbytes;
+	void *state;
+};
+
+struct l1_hash_backend {
+	char *name;
+	char *description;
+	bool secure;
+	bool (*open)(struct l1_hash *hash, bool secure);
+	bool (*digest)(struct l1_hash *hash, const void *in, size_t len,
+			void *out);
+	void (*close)(struct l1_hash *hash);
+};
+
+const struct l1_hash_backend *l1_hash_find_backend(const char *name);
+struct l1_hash *l1_hash_create(const struct l1_hash_backend *backend,
+		int algo, unsigned int nbytes, bool secure);
+void l1_hash_destroy(struct l1_hash *hash);
+
+/*
+ * Hash 'len' bytes at 'in' into the 'nbytes' bytes at 'out'.  Returns false
+ * if the backend fails.
+ */
+static inline bool l1_hash_digest(struct l1_hash *hash, const void *in,
+		size_t len, void *out) {
+	return hash->backend->digest(hash, in, len, out);
+}
+
+#endif
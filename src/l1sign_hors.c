@@ -0,0 +1,79 @@
+/*
+ * l1sign - Implementation of the Lamport-Diffie one-time signature scheme
+ * Copyright (c) 2019  Janik Rabe <info@janikrabe.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "l1sign_hors.h"
+
+#include <math.h>
+#include <string.h>
+
+#if L1_HORS_TAU != 16
+#	error "l1_hors_select() expects 16-bit indices"
+#endif
+
+/*
+ * Number of blocks revealed by each signature for a 'digest_nbits'-bit
+ * message digest, or 0 if the digest cannot be split into indices.
+ */
+unsigned int l1_hors_nselect(unsigned int digest_nbits) {
+	return digest_nbits % L1_HORS_TAU ? 0 : digest_nbits / L1_HORS_TAU;
+}
+
+/*
+ * Security level in bits after 'nsigs' signatures: a forgery requires a
+ * message whose 'nselect' indices all select one of the at most
+ * nsigs * nselect blocks that have been revealed.
+ */
+double l1_hors_security(unsigned int nselect, uint32_t nsigs) {
+	if (!nsigs) {
+		return (double) nselect * L1_HORS_TAU;
+	}
+
+	return nselect * (L1_HORS_TAU - log2((double) nsigs * nselect));
+}
+
+/*
+ * Maximum number of signatures that keep the security level at or above
+ * L1_HORS_MIN_SECURITY bits, which is 0 if not even one signature does.
+ */
+uint32_t l1_hors_max_signatures(unsigned int nselect) {
+	double max;
+
+	if (!nselect) {
+		return 0;
+	}
+
+	max = floor(exp2(L1_HORS_TAU - (double) L1_HORS_MIN_SECURITY / nselect)
+			/ nselect);
+
+	return max < 1 ? 0 : (uint32_t) max;
+}
+
+/*
+ * Copy the 'nselect' key blocks selected by 'digest' from the in-memory key
+ * 'key' to consecutive slots of 'out'.  Index i is the big-endian 16-bit
+ * integer at byte 2 * i of the digest.
+ */
+void l1_hors_select(const unsigned char *key, const unsigned char *digest,
+		unsigned int hash_nbytes, unsigned int nselect, unsigned char *out) {
+	for (unsigned int i = 0; i < nselect; ++i) {
+		size_t idx = (size_t) digest[2 * i] << 8 | digest[2 * i + 1];
+
+		memcpy(out + (size_t) hash_nbytes * i,
+				key + (size_t) hash_nbytes * idx, hash_nbytes);
+	}
+}
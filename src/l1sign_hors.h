@@ -0,0 +1,45 @@
+/*
+ * l1sign - Implementation of the Lamport-Diffie one-time signature scheme
+ * Copyright (c) 2019  Janik Rabe <info@janikrabe.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef L1SIGN_HORS_H
+#define L1SIGN_HORS_H
+
+#include <config.h>
+
+#include <stdint.h>
+
+/*
+ * HORS keys have 2^L1_HORS_TAU blocks.  Each signature reveals the blocks
+ * selected by consecutive L1_HORS_TAU-bit indices of the message digest.
+ */
+#define L1_HORS_TAU 16
+#define L1_HORS_NBLOCKS (1U << L1_HORS_TAU)
+
+/*
+ * Keys may sign as many messages as keep the security level at or above this
+ * number of bits.
+ */
+#define L1_HORS_MIN_SECURITY 128
+
+unsigned int l1_hors_nselect(unsigned int digest_nbits);
+uint32_t l1_hors_max_signatures(unsigned int nselect);
+double l1_hors_security(unsigned int nselect, uint32_t nsigs);
+void l1_hors_select(const unsigned char *key, const unsigned char *digest,
+		unsigned int hash_nbytes, unsigned int nselect, unsigned char *out);
+
+#endif
@@ -0,0 +1,634 @@
+/*
+ * l1sign - Implementation of the Lamport-Diffie one-time signature scheme
+ * Copyright (c) 2019  Janik Rabe <info@janikrabe.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "l1sign_io.h"
+
+#include "l1sign_gcrypt.h"
+#include "l1sign_probe.h"
+#include "l1sign_stats.h"
+#include "l1sign_util.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifdef HAVE_LINUX_IO_URING_H
+#	include <linux/io_uring.h>
+#	include <sys/mman.h>
+#	include <sys/syscall.h>
+#	define URING_ENTRIES 128
+#endif
+
+/*
+ * Read up to 'nbytes' bytes at 'offset', retrying after interruptions and
+ * partial reads.  Returns the number of bytes read or the negated error number.
+ */
+static ssize_t pread_full(int fd, void *buf, size_t nbytes, off_t offset) {
+	size_t done = 0;
+
+	while (done < nbytes) {
+		ssize_t len = pread(fd, (char *) buf + done, nbytes - done,
+				offset + done);
+
+		l1_stats_read(len > 0 ? len : 0);
+
+		if (len < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if (len < 0) {
+			return -errno;
+		}
+
+		if (len == 0) {
+			break;
+		}
+
+		done += len;
+	}
+
+	return done;
+}
+
+static bool pread_read_batch(struct l1_io_req *reqs, size_t nreqs,
+		const struct l1_io_head *head, l1_io_complete_fn complete,
+		void *arg) {
+	(void) head;
+
+	for (size_t i = 0; i < nreqs; ++i) {
+		reqs[i].result = pread_full(reqs[i].fd, reqs[i].buf,
+				reqs[i].nbytes, reqs[i].offset);
+
+		if (!complete(&reqs[i], i, arg)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * The stream engine fills up to STREAM_MAX_IOV buffers (the limit of Linux)
+ * with each call, and reads the data between requests into a discard buffer
+ * of STREAM_DISCARD_NBYTES bytes.
+ */
+#define STREAM_MAX_IOV 1024
+#define STREAM_DISCARD_NBYTES 4096
+
+/*
+ * Fill 'iov' from 'fd', retrying after interruptions and partial reads.
+ * Returns the number of bytes read, which is only short at the end of the
+ * file or if a read failed, in which case '*err' is set to the error number.
+ */
+static size_t readv_full(int fd, struct iovec *iov, int iovcnt, int *err) {
+	size_t done = 0;
+
+	while (iovcnt) {
+		if (!iov->iov_len) {
+			++iov;
+			--iovcnt;
+			continue;
+		}
+
+		ssize_t len = readv(fd, iov, iovcnt);
+
+		l1_stats_read(len > 0 ? len : 0);
+
+		if (len < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if (len < 0) {
+			*err = errno;
+			break;
+		}
+
+		if (len == 0) {
+			break;
+		}
+
+		done += len;
+
+		while (iovcnt && (size_t) len >= iov->iov_len) {
+			len -= iov->iov_len;
+			++iov;
+			--iovcnt;
+		}
+
+		if (iovcnt) {
+			iov->iov_base = (char *) iov->iov_base + len;
+			iov->iov_len -= len;
+		}
+	}
+
+	return done;
+}
+
+/*
+ * Read all requests in a single forward pass from the current position of
+ * the file, which is taken as offset zero, or as the end of 'head' if the
+ * start of the file has already been read.  This works with pipes and other
+ * files that cannot seek, but requires the requests to be sorted by offset
+ * without overlapping and to share a file.  The data between requests may
+ * hold secret key blocks, so it is discarded through secure memory.
+ */
+static bool stream_read_batch(struct l1_io_req *reqs, size_t nreqs,
+		const struct l1_io_head *head, l1_io_complete_fn complete,
+		void *arg) {
+	struct iovec iov[STREAM_MAX_IOV];
+	unsigned char *discard = l1_gcry_secmem_alloc(STREAM_DISCARD_NBYTES);
+	off_t pos = head ? (off_t) head->nbytes : 0;
+	size_t done = 0;
+	bool eof = false;
+	bool ret = true;
+	int err = 0;
+
+	if (!discard) {
+		fprintf(stderr, "Failed to allocate secure memory\n");
+		return false;
+	}
+
+	/*
+	 * Requests that start within the head are copied from it, and only the
+	 * rest of a request that extends beyond the head is read.
+	 */
+	for (; ret && done < nreqs && reqs[done].offset < pos; ++done) {
+		struct l1_io_req *req = &reqs[done];
+		size_t len = (size_t) (pos - req->offset) < req->nbytes
+			? (size_t) (pos - req->offset)
+			: req->nbytes;
+		struct iovec rest = { (char *) req->buf + len, req->nbytes - len };
+
+		memcpy(req->buf, head->buf + req->offset, len);
+
+		if (rest.iov_len && !eof && !err) {
+			pos += readv_full(req->fd, &rest, 1, &err);
+			eof = pos < req->offset + (off_t) req->nbytes;
+		}
+
+		if (pos >= req->offset + (off_t) req->nbytes) {
+			req->result = req->nbytes;
+		} else if (err) {
+			req->result = -err;
+		} else {
+			req->result = pos - req->offset;
+		}
+
+		ret = complete(req, done, arg);
+	}
+
+	while (ret && done < nreqs) {
+		off_t end = pos;
+		size_t last = done;
+		int niov = 0;
+
+		while (last < nreqs && niov < STREAM_MAX_IOV
+				&& reqs[last].fd == reqs[0].fd && reqs[last].offset >= end) {
+			if (end < reqs[last].offset) {
+				size_t len = reqs[last].offset - end < STREAM_DISCARD_NBYTES
+					? reqs[last].offset - end
+					: STREAM_DISCARD_NBYTES;
+
+				iov[niov].iov_base = discard;
+				iov[niov++].iov_len = len;
+				end += len;
+				continue;
+			}
+
+			iov[niov].iov_base = reqs[last].buf;
+			iov[niov++].iov_len = reqs[last].nbytes;
+			end += reqs[last++].nbytes;
+		}
+
+		if (!niov) {
+			reqs[done].result = -ESPIPE;
+			complete(&reqs[done], done, arg);
+			ret = false;
+			break;
+		}
+
+		if (!eof && !err) {
+			pos += readv_full(reqs[0].fd, iov, niov, &err);
+			eof = pos < end;
+		}
+
+		for (; ret && done < last; ++done) {
+			struct l1_io_req *req = &reqs[done];
+
+			if (pos >= req->offset + (off_t) req->nbytes) {
+				req->result = req->nbytes;
+			} else if (err) {
+				req->result = -err;
+			} else {
+				req->result = pos > req->offset ? pos - req->offset : 0;
+			}
+
+			ret = complete(req, done, arg);
+		}
+	}
+
+	l1_gcry_secmem_free(discard, STREAM_DISCARD_NBYTES);
+	return ret;
+}
+
+#ifdef HAVE_LINUX_IO_URING_H
+struct uring {
+	int fd;
+	unsigned int entries;
+
+	void *sq_ring;
+	size_t sq_ring_nbytes;
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	struct io_uring_sqe *sqes;
+	size_t sqes_nbytes;
+
+	void *cq_ring;
+	size_t cq_ring_nbytes;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_cqe *cqes;
+};
+
+static void uring_destroy(struct uring *ring) {
+	if (ring->sqes) {
+		munmap(ring->sqes, ring->sqes_nbytes);
+	}
+
+	if (ring->cq_ring && ring->cq_ring != ring->sq_ring) {
+		munmap(ring->cq_ring, ring->cq_ring_nbytes);
+	}
+
+	if (ring->sq_ring) {
+		munmap(ring->sq_ring, ring->sq_ring_nbytes);
+	}
+
+	close(ring->fd);
+}
+
+static bool uring_create(struct uring *ring) {
+	struct io_uring_params params = { 0 };
+	int mmap_flags = MAP_SHARED | MAP_POPULATE;
+
+	memset(ring, 0, sizeof *ring);
+
+	if ((ring->fd = syscall(SYS_io_uring_setup, URING_ENTRIES, &params)) < 0) {
+		return false;
+	}
+
+	ring->entries = params.sq_entries;
+	ring->sq_ring_nbytes = params.sq_off.array
+		+ params.sq_entries * sizeof (unsigned int);
+	ring->cq_ring_nbytes = params.cq_off.cqes
+		+ params.cq_entries * sizeof (struct io_uring_cqe);
+	ring->sqes_nbytes = params.sq_entries * sizeof (struct io_uring_sqe);
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_ring_nbytes > ring->sq_ring_nbytes) {
+			ring->sq_ring_nbytes = ring->cq_ring_nbytes;
+		}
+
+		ring->cq_ring_nbytes = ring->sq_ring_nbytes;
+	}
+
+	ring->sq_ring = mmap(NULL, ring->sq_ring_nbytes, PROT_READ | PROT_WRITE,
+			mmap_flags, ring->fd, IORING_OFF_SQ_RING);
+
+	if (ring->sq_ring == MAP_FAILED) {
+		ring->sq_ring = NULL;
+		uring_destroy(ring);
+		return false;
+	}
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		ring->cq_ring = ring->sq_ring;
+	} else {
+		ring->cq_ring = mmap(NULL, ring->cq_ring_nbytes,
+				PROT_READ | PROT_WRITE, mmap_flags, ring->fd,
+				IORING_OFF_CQ_RING);
+
+		if (ring->cq_ring == MAP_FAILED) {
+			ring->cq_ring = NULL;
+			uring_destroy(ring);
+			return false;
+		}
+	}
+
+	ring->sqes = mmap(NULL, ring->sqes_nbytes, PROT_READ | PROT_WRITE,
+			mmap_flags, ring->fd, IORING_OFF_SQES);
+
+	if (ring->sqes == MAP_FAILED) {
+		ring->sqes = NULL;
+		uring_destroy(ring);
+		return false;
+	}
+
+	ring->sq_head = (unsigned int *)
+		((char *) ring->sq_ring + params.sq_off.head);
+	ring->sq_tail = (unsigned int *)
+		((char *) ring->sq_ring + params.sq_off.tail);
+	ring->sq_mask = (unsigned int *)
+		((char *) ring->sq_ring + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned int *)
+		((char *) ring->sq_ring + params.sq_off.array);
+
+	ring->cq_head = (unsigned int *)
+		((char *) ring->cq_ring + params.cq_off.head);
+	ring->cq_tail = (unsigned int *)
+		((char *) ring->cq_ring + params.cq_off.tail);
+	ring->cq_mask = (unsigned int *)
+		((char *) ring->cq_ring + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)
+		((char *) ring->cq_ring + params.cq_off.cqes);
+
+	return true;
+}
+
+/*
+ * Submit as many requests as the ring can hold and feed completions to the
+ * callback as they arrive, refilling the submission queue in between.
+ * Requests that are already in flight are always waited for, even after the
+ * callback cancels the batch or a submission fails, as their buffers are still
+ * in use by the kernel.
+ */
+static bool uring_run(struct uring *ring, struct l1_io_req *reqs, size_t nreqs,
+		l1_io_complete_fn complete, void *arg) {
+	size_t queued = 0;
+	size_t completed = 0;
+	bool ok = true;
+
+	while (completed < queued || (ok && queued < nreqs)) {
+		unsigned int sq_tail = *ring->sq_tail;
+
+		while (ok && queued < nreqs && queued - completed < ring->entries) {
+			unsigned int idx = sq_tail & *ring->sq_mask;
+			struct io_uring_sqe *sqe = &ring->sqes[idx];
+
+			memset(sqe, 0, sizeof *sqe);
+			sqe->opcode = IORING_OP_READ;
+			sqe->fd = reqs[queued].fd;
+			sqe->off = reqs[queued].offset;
+			sqe->addr = (uintptr_t) reqs[queued].buf;
+			sqe->len = reqs[queued].nbytes;
+			sqe->user_data = queued;
+
+			ring->sq_array[idx] = idx;
+
+			++sq_tail;
+			++queued;
+		}
+
+		__atomic_store_n(ring->sq_tail, sq_tail, __ATOMIC_RELEASE);
+
+		unsigned int pending = sq_tail
+			- __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+		if (syscall(SYS_io_uring_enter, ring->fd, pending, 1,
+					IORING_ENTER_GETEVENTS, NULL, 0) < 0
+				&& errno != EINTR && errno != EAGAIN) {
+			/*
+			 * Withdraw the entries the kernel has not consumed and keep
+			 * reaping the rest, which complete without further calls.
+			 */
+			unsigned int sq_head =
+				__atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+			queued -= sq_tail - sq_head;
+			__atomic_store_n(ring->sq_tail, sq_head, __ATOMIC_RELEASE);
+			ok = false;
+		}
+
+		unsigned int cq_head = *ring->cq_head;
+		unsigned int cq_tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+		for (; cq_head != cq_tail; ++cq_head) {
+			struct io_uring_cqe *cqe = &ring->cqes[cq_head & *ring->cq_mask];
+			size_t i = cqe->user_data;
+
+			reqs[i].result = cqe->res;
+			l1_stats_read(cqe->res > 0 ? cqe->res : 0);
+
+			if (cqe->res > 0 && (size_t) cqe->res < reqs[i].nbytes) {
+				ssize_t rest = pread_full(reqs[i].fd,
+						(char *) reqs[i].buf + cqe->res,
+						reqs[i].nbytes - cqe->res,
+						reqs[i].offset + cqe->res);
+
+				reqs[i].result = rest < 0 ? rest : cqe->res + rest;
+			}
+
+			++completed;
+
+			if (ok && !complete(&reqs[i], i, arg)) {
+				ok = false;
+			}
+		}
+
+		__atomic_store_n(ring->cq_head, cq_head, __ATOMIC_RELEASE);
+	}
+
+	return ok;
+}
+
+static bool uring_read_batch(struct l1_io_req *reqs, size_t nreqs,
+		const struct l1_io_head *head, l1_io_complete_fn complete,
+		void *arg) {
+	struct uring ring;
+	bool ret;
+
+	(void) head;
+
+	if (!uring_create(&ring)) {
+		perror("Failed to set up io_uring");
+		return false;
+	}
+
+	ret = uring_run(&ring, reqs, nreqs, complete, arg);
+	uring_destroy(&ring);
+	return ret;
+}
+#endif
+
+/*
+ * Use the stream engine for files that cannot seek.  Otherwise, use io_uring
+ * if the kernel supports it and fall back to pread.
+ */
+static bool auto_read_batch(struct l1_io_req *reqs, size_t nreqs,
+		const struct l1_io_head *head, l1_io_complete_fn complete,
+		void *arg) {
+	if (nreqs && lseek(reqs[0].fd, 0, SEEK_CUR) < 0 && errno == ESPIPE) {
+		return stream_read_batch(reqs, nreqs, head, complete, arg);
+	}
+
+#ifdef HAVE_LINUX_IO_URING_H
+	struct uring ring;
+	bool ret;
+
+	if (uring_create(&ring)) {
+		ret = uring_run(&ring, reqs, nreqs, complete, arg);
+		uring_destroy(&ring);
+		return ret;
+	}
+#endif
+
+	return pread_read_batch(reqs, nreqs, head, complete, arg);
+}
+
+static const struct l1_io_engine engines[] = {
+	{
+		"auto",
+		"Use stream for pipes, io_uring if available, pread otherwise",
+		auto_read_batch,
+	},
+#ifdef HAVE_LINUX_IO_URING_H
+	{
+		"io_uring",
+		"Submit reads in batches through io_uring",
+		uring_read_batch,
+	},
+#endif
+	{
+		"pread",
+		"Issue one pread call per read",
+		pread_read_batch,
+	},
+	{
+		"stream",
+		"Read in a single forward pass, even from pipes",
+		stream_read_batch,
+	},
+	{
+		NULL,
+		NULL,
+		NULL,
+	},
+};
+
+const struct l1_io_engine *l1_io_find_engine(const char *name) {
+	for (size_t i = 0; engines[i].name; ++i) {
+		if (!strcmp(name, engines[i].name)) {
+			return &engines[i];
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Read a batch of blocks, invoking 'complete' once for each request.
+ * Returns false if a request could not be submitted or the callback
+ * cancelled the batch.
+ */
+bool l1_io_read_batch(const struct l1_io_engine *engine,
+		struct l1_io_req *reqs, size_t nreqs, const struct l1_io_head *head,
+		l1_io_complete_fn complete, void *arg) {
+	return engine->read_batch(reqs, nreqs, head, complete, arg);
+}
+
+struct key_blocks_ctx {
+	const char *desc;
+	off_t offset;
+	size_t nblocks;
+	l1_io_block_fn block;
+	void *arg;
+	bool trailing;
+};
+
+static bool key_block_complete(struct l1_io_req *req, size_t idx, void *arg) {
+	struct key_blocks_ctx *ctx = arg;
+
+	L1_PROBE3(key_block, idx, req->offset, req->result);
+
+	if (idx == ctx->nblocks) {
+		ctx->trailing = req->result > 0;
+		return true;
+	}
+
+	if (req->result < 0) {
+		fprintf(stderr, "Failed to read from %s: %s\n",
+				ctx->desc, strerror(-req->result));
+		return false;
+	}
+
+	if ((size_t) req->result < req->nbytes) {
+		fprintf(stderr, "Failed to read from %s%s\n", ctx->desc,
+				req->offset != ctx->offset ? " (hash size mismatch?)" : "");
+		return false;
+	}
+
+	return !ctx->block || ctx->block(idx, ctx->arg);
+}
+
+/*
+ * Read the key block selected by each bit of 'digest' from the key file 'fd'
+ * into consecutive slots of 'buf'.  The i-th bit selects block 2 * i + bit.
+ * The blocks start at 'offset', and 'head' (if not NULL) holds the start of
+ * the file if it has already been read from a stream.  All reads are
+ * submitted as a single batch; 'block' (if not NULL) is invoked for every
+ * block as soon as it is available.
+ */
+bool l1_io_read_key_blocks(const struct l1_io_engine *engine,
+		int fd, const char *desc, off_t offset, const struct l1_io_head *head,
+		unsigned char *digest, unsigned int block_nbytes, unsigned int nbits,
+		unsigned char *buf, l1_io_block_fn block, void *arg) {
+	struct key_blocks_ctx ctx = { desc, offset, nbits, block, arg, false };
+	struct l1_io_req *reqs = calloc(nbits + 1, sizeof *reqs);
+	unsigned char trailing;
+	bool ret;
+
+	if (!reqs) {
+		fprintf(stderr, "Failed to allocate memory\n");
+		return false;
+	}
+
+	for (unsigned int i = 0; i < nbits; ++i) {
+		unsigned char dbit = l1_bit_get(digest, nbits / 8, i);
+
+		reqs[i].fd = fd;
+		reqs[i].offset = offset + (off_t) block_nbytes * (i * 2 + dbit);
+		reqs[i].buf = buf + (size_t) block_nbytes * i;
+		reqs[i].nbytes = block_nbytes;
+	}
+
+	/*
+	 * Any data beyond the end of the key indicates a hash size mismatch.
+	 */
+	reqs[nbits].fd = fd;
+	reqs[nbits].offset = offset + (off_t) block_nbytes * nbits * 2;
+	reqs[nbits].buf = &trailing;
+	reqs[nbits].nbytes = 1;
+
+	ret = l1_io_read_batch(engine, reqs, nbits + 1, head, key_block_complete,
+			&ctx);
+
+	if (ret && ctx.trailing) {
+		fprintf(stderr, "Warning: Partial read from %s "
+				"(hash size mismatch?)\n", desc);
+		ret = false;
+	}
+
+	free(reqs);
+	return ret;
+}
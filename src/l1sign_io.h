@@ -0,0 +1,75 @@
+/*
+ * l1sign - Implementation of the Lamport-Diffie one-time signature scheme
+ * Copyright (c) 2019  Janik Rabe <info@janikrabe.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef L1SIGN_IO_H
+#define L1SIGN_IO_H
+
+#include <config.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * A single positional read.  'result' receives the number of bytes read, or
+ * the negated error number if the read failed.  A result shorter than 'nbytes'
+ * indicates that the end of the file was reached.
+ */
+struct l1_io_req {
+	int fd;
+	off_t offset;
+	void *buf;
+	size_t nbytes;
+	ssize_t result;
+};
+
+/*
+ * The first 'nbytes' bytes of a stream, which have already been read from it
+ * and are held at 'buf'.
+ */
+struct l1_io_head {
+	const unsigned char *buf;
+	size_t nbytes;
+};
+
+/*
+ * Completion callback.  Requests may complete in any order.  Returning false
+ * cancels all requests that have not been submitted yet.
+ */
+typedef bool (*l1_io_complete_fn)(struct l1_io_req *req, size_t idx, void *arg);
+
+struct l1_io_engine {
+	char *name;
+	char *description;
+	bool (*read_batch)(struct l1_io_req *reqs, size_t nreqs,
+			const struct l1_io_head *head, l1_io_complete_fn complete,
+			void *arg);
+};
+
+const struct l1_io_engine *l1_io_find_engine(const char *name);
+typedef bool (*l1_io_block_fn)(size_t idx, void *arg);
+
+bool l1_io_read_batch(const struct l1_io_engine *engine,
+		struct l1_io_req *reqs, size_t nreqs, const struct l1_io_head *head,
+		l1_io_complete_fn complete, void *arg);
+bool l1_io_read_key_blocks(const struct l1_io_engine *engine,
+		int fd, const char *desc, off_t offset, const struct l1_io_head *head,
+		unsigned char *digest, unsigned int block_nbytes, unsigned int nbits,
+		unsigned char *buf, l1_io_block_fn block, void *arg);
+
+#endif
@@ -0,0 +1,706 @@
+/*
+ * l1sign - Implementation of the Lamport-Diffie one-time signature scheme
+ * Copyright (c) 2019  Janik Rabe <info@janikrabe.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "l1sign_key.h"
+
+#include "l1sign_hors.h"
+#include "l1sign_ots.h"
+#include "l1sign_stats.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define OFF_VERSION 8
+#define OFF_HEADER_NBYTES 12
+#define OFF_TYPE 16
+#define OFF_FLAGS 20
+#define OFF_BLOCK_NBYTES 24
+#define OFF_NBLOCKS 28
+#define OFF_ALGO 32
+#define OFF_DIGEST (OFF_ALGO + L1_KEY_ALGO_NAME_LEN)
+#define OFF_FINGERPRINT (OFF_DIGEST + L1_KEY_ALGO_NAME_LEN)
+#define OFF_CHECKSUM (OFF_FINGERPRINT + L1_FPR_NBYTES)
+#define OFF_NSIGS (OFF_CHECKSUM + L1_FPR_NBYTES)
+#define OFF_HORS_CHECKSUM (OFF_NSIGS + 4)
+
+#define BURN_BUFFER_LEN 65536
+
+/*
+ * Report an invalid key unless 'desc' is NULL.
+ */
+static void key_error(const char *desc, const char *fmt, ...) {
+	va_list ap;
+
+	if (!desc) {
+		return;
+	}
+
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+}
+
+static const char *type_name(enum l1_key_type type) {
+	return type == L1_KEY_TYPE_SECRET ? "secret" : "public";
+}
+
+/*
+ * Initialize the description of a key for message digest 'digest' that uses
+ * hash algorithm 'algo' with 'block_nbytes'-byte blocks.
+ */
+void l1_key_init(struct l1_key *key, enum l1_key_format format,
+		enum l1_key_type type, int digest, int algo,
+		unsigned int block_nbytes) {
+	memset(key, 0, sizeof *key);
+
+	key->format = format;
+	key->type = type;
+	key->scheme = L1_KEY_SCHEME_LD;
+	key->digest = digest;
+	key->algo = algo;
+	key->block_nbytes = block_nbytes;
+	key->digest_nbytes = l1_gcry_digest_nbytes(digest, algo, block_nbytes);
+	key->nblocks = key->digest_nbytes * (2 * 8);
+	key->nselect = key->nblocks / 2;
+	key->offset = format == L1_KEY_FORMAT_V1 ? L1_KEY_HEADER_NBYTES : 0;
+}
+
+/*
+ * Make the key described by l1_key_init() use signature scheme 'scheme'.
+ * HORS keys must be version 1 keys, which count their signatures.
+ */
+bool l1_key_set_scheme(struct l1_key *key, enum l1_key_scheme scheme) {
+	unsigned int nselect;
+
+	if (scheme != L1_KEY_SCHEME_HORS) {
+		return true;
+	}
+
+	if (key->format != L1_KEY_FORMAT_V1) {
+		fprintf(stderr, "HORS keys require the version 1 key format\n");
+		return false;
+	}
+
+	nselect = l1_hors_nselect(key->digest_nbytes * 8);
+
+	if (!l1_hors_max_signatures(nselect)) {
+		fprintf(stderr, "Message digest %s is too short for HORS keys\n",
+				gcry_md_algo_name(key->digest));
+		return false;
+	}
+
+	key->scheme = L1_KEY_SCHEME_HORS;
+	key->flags |= L1_KEY_FLAG_HORS;
+	key->nblocks = L1_HORS_NBLOCKS;
+	key->nselect = nselect;
+	return true;
+}
+
+/*
+ * Map the NUL-padded algorithm name at 'name' to an algorithm.
+ */
+static int decode_algo(const unsigned char *name, const char *desc) {
+	char algo_name[L1_KEY_ALGO_NAME_LEN + 1] = { 0 };
+	int algo;
+
+	memcpy(algo_name, name, L1_KEY_ALGO_NAME_LEN);
+
+	if (!(algo = gcry_md_map_name(algo_name))) {
+		key_error(desc, "Unknown hash algorithm in %s: %s\n", desc, algo_name);
+	}
+
+	return algo;
+}
+
+static bool decode_header(struct l1_key *key, const unsigned char *buf,
+		const char *desc) {
+	unsigned char checksum[L1_FPR_NBYTES];
+
+	gcry_md_hash_buffer(L1_FPR_ALGO, checksum, buf, OFF_CHECKSUM);
+
+	if (l1_get_le32(buf + OFF_VERSION) != L1_KEY_VERSION) {
+		key_error(desc, "Unsupported format version %u of %s\n",
+				l1_get_le32(buf + OFF_VERSION), desc);
+		return false;
+	}
+
+	if (memcmp(checksum, buf + OFF_CHECKSUM, L1_FPR_NBYTES)
+			|| l1_get_le32(buf + OFF_HEADER_NBYTES) != L1_KEY_HEADER_NBYTES) {
+		key_error(desc, "Corrupted header in %s\n", desc);
+		return false;
+	}
+
+	if (l1_get_le32(buf + OFF_TYPE) != key->type) {
+		key_error(desc, "The %s does not contain a %s key\n",
+				desc, type_name(key->type));
+		return false;
+	}
+
+	if (l1_get_le32(buf + OFF_FLAGS) & ~L1_KEY_FLAGS_KNOWN) {
+		key_error(desc, "Unsupported features in %s\n", desc);
+		return false;
+	}
+
+	if (l1_get_le32(buf + OFF_FLAGS) & L1_KEY_FLAG_BURNED) {
+		key_error(desc, "The %s contains a burned key\n", desc);
+		return false;
+	}
+
+	if (!(key->algo = decode_algo(buf + OFF_ALGO, desc))
+			|| !(key->digest = decode_algo(buf + OFF_DIGEST, desc))) {
+		return false;
+	}
+
+	key->format = L1_KEY_FORMAT_V1;
+	key->flags = l1_get_le32(buf + OFF_FLAGS);
+	key->block_nbytes = l1_get_le32(buf + OFF_BLOCK_NBYTES);
+	key->nblocks = l1_get_le32(buf + OFF_NBLOCKS);
+	key->digest_nbytes = l1_gcry_digest_nbytes(key->digest, key->algo,
+			key->block_nbytes);
+	key->offset = L1_KEY_HEADER_NBYTES;
+	memcpy(key->fingerprint, buf + OFF_FINGERPRINT, L1_FPR_NBYTES);
+
+	/*
+	 * The block size selects the output length of extendable-output functions.
+	 */
+	if (l1_gcry_check_hash(key->algo, key->block_nbytes) != 0
+			|| l1_gcry_check_hash(key->digest, key->digest_nbytes) != 0) {
+		return false;
+	}
+
+	if (!(key->flags & L1_KEY_FLAG_HORS)) {
+		key->scheme = L1_KEY_SCHEME_LD;
+		key->nselect = key->nblocks / 2;
+		key->nsigs = 0;
+
+		if (key->nblocks != key->digest_nbytes * (2 * 8)) {
+			key_error(desc, "Unsupported key parameters in %s\n", desc);
+			return false;
+		}
+
+		return true;
+	}
+
+	key->scheme = L1_KEY_SCHEME_HORS;
+	key->nselect = l1_hors_nselect(key->digest_nbytes * 8);
+	key->nsigs = l1_get_le32(buf + OFF_NSIGS);
+
+	if (key->nblocks != L1_HORS_NBLOCKS
+			|| !l1_hors_max_signatures(key->nselect)) {
+		key_error(desc, "Unsupported key parameters in %s\n", desc);
+		return false;
+	}
+
+	gcry_md_hash_buffer(L1_FPR_ALGO, checksum, buf, OFF_HORS_CHECKSUM);
+
+	if (memcmp(checksum, buf + OFF_HORS_CHECKSUM, L1_FPR_NBYTES)) {
+		key_error(desc, "Corrupted header in %s\n", desc);
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Read the start of key file 'fd' into 'buf', which holds
+ * L1_KEY_HEADER_NBYTES bytes.  Descriptors created by memfd_secret() cannot
+ * be read, but unlike pipes they are regular files that can be mapped.  Pipes
+ * and other streams are read from their current position, and '*consumed' is
+ * set, as the data cannot be read again.
+ */
+static ssize_t read_header(int fd, unsigned char *buf, bool *consumed) {
+	ssize_t len = pread(fd, buf, L1_KEY_HEADER_NBYTES, 0);
+	unsigned char *data;
+	struct l1_map map;
+	struct stat st;
+
+	*consumed = false;
+
+	if (len >= 0 || errno != ESPIPE || fstat(fd, &st)) {
+		return len;
+	}
+
+	if (!S_ISREG(st.st_mode)) {
+		*consumed = true;
+		len = 0;
+
+		while (len < L1_KEY_HEADER_NBYTES) {
+			ssize_t n = read(fd, buf + len, L1_KEY_HEADER_NBYTES - len);
+
+			if (n < 0 && errno == EINTR) {
+				continue;
+			}
+
+			if (n < 0) {
+				return -1;
+			}
+
+			if (!n) {
+				break;
+			}
+
+			len += n;
+		}
+
+		return len;
+	}
+
+	if (st.st_size <= 0) {
+		return len;
+	}
+
+	len = st.st_size < L1_KEY_HEADER_NBYTES
+		? st.st_size
+		: L1_KEY_HEADER_NBYTES;
+
+	if (!(data = l1_map_range(fd, 0, len, &map))) {
+		return -1;
+	}
+
+	memcpy(buf, data, len);
+	l1_unmap(&map);
+	return len;
+}
+
+/*
+ * Determine the format of the key file 'fd'.  Version 1 keys are validated
+ * by their header and size alone, and their parameters are used unless they
+ * are marked in 'explicit': L1_KEY_EXPLICIT_HASH requires the hash algorithm
+ * and block size to match 'algo' and 'block_nbytes', and
+ * L1_KEY_EXPLICIT_DIGEST requires the message digest to match 'digest'.
+ * Other files are treated as raw keys with the given parameters.  The start of
+ * a stream is kept in key->head, since it has been consumed.  Errors are not
+ * reported if 'desc' is NULL.
+ */
+bool l1_key_open(struct l1_key *key, int fd, const char *desc,
+		enum l1_key_type type, int digest, int algo, unsigned int block_nbytes,
+		unsigned int explicit) {
+	unsigned char buf[L1_KEY_HEADER_NBYTES];
+	struct stat st;
+	bool consumed;
+	ssize_t len;
+
+	l1_key_init(key, L1_KEY_FORMAT_RAW, type, digest, algo, block_nbytes);
+
+	len = read_header(fd, buf, &consumed);
+	l1_stats_read(len > 0 ? len : 0);
+
+	if (consumed && len > 0) {
+		memcpy(key->head, buf, len);
+		key->head_nbytes = len;
+	}
+
+	if (len < (ssize_t) strlen(L1_KEY_MAGIC)
+			|| memcmp(buf, L1_KEY_MAGIC, strlen(L1_KEY_MAGIC))) {
+		if (key->head_nbytes > (size_t) key->block_nbytes * key->nblocks) {
+			key_error(desc, "Warning: Partial read from %s "
+					"(hash size mismatch?)\n", desc);
+			return false;
+		}
+
+		return true;
+	}
+
+	if (len != sizeof buf) {
+		key_error(desc, "Truncated header in %s\n", desc);
+		return false;
+	}
+
+	if (!decode_header(key, buf, desc)) {
+		return false;
+	}
+
+	if ((explicit & L1_KEY_EXPLICIT_HASH) && (key->algo != algo
+				|| key->block_nbytes != block_nbytes)) {
+		key_error(desc, "The %s uses hash %s (%u bits), not %s (%u bits)\n",
+				desc, gcry_md_algo_name(key->algo), key->block_nbytes * 8,
+				gcry_md_algo_name(algo), block_nbytes * 8);
+		return false;
+	}
+
+	if ((explicit & L1_KEY_EXPLICIT_DIGEST) && key->digest != digest) {
+		key_error(desc, "The %s uses message digest %s, not %s\n", desc,
+				gcry_md_algo_name(key->digest), gcry_md_algo_name(digest));
+		return false;
+	}
+
+	if (key->algo != algo || key->block_nbytes != block_nbytes) {
+		l1_stats.hash = gcry_md_algo_name(key->algo);
+	}
+
+	if (!fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size != key->offset
+			+ (off_t) key->block_nbytes * key->nblocks) {
+		key_error(desc, "Invalid size of %s (truncated key?)\n", desc);
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Check that the raw key file 'fd' holds exactly the blocks of 'key' before
+ * it is mapped.  The size of version 1 keys is checked by l1_key_open().
+ */
+bool l1_key_check_size(const struct l1_key *key, int fd, const char *desc) {
+	struct stat st;
+
+	if (fstat(fd, &st)) {
+		fprintf(stderr, "Failed to access %s: %s\n", desc, strerror(errno));
+		return false;
+	}
+
+	if (st.st_size != key->offset + (off_t) key->block_nbytes * key->nblocks) {
+		fprintf(stderr, "Invalid size of %s (hash size mismatch?)\n", desc);
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Copy the key blocks in the head of a stream that l1_key_open() has read to
+ * the start of 'blocks'.  Returns the number of bytes copied.
+ */
+size_t l1_key_copy_head(const struct l1_key *key, unsigned char *blocks) {
+	size_t len = 0;
+
+	if (key->head_nbytes > key->offset) {
+		len = key->head_nbytes - key->offset;
+		memcpy(blocks, key->head + key->offset, len);
+	}
+
+	return len;
+}
+
+/*
+ * Read the blocks of 'key' selected by 'digest' from the key file 'fd' into
+ * 'buf' with l1_io_read_key_blocks().
+ */
+bool l1_key_read_blocks(const struct l1_key *key,
+		const struct l1_io_engine *engine, int fd, const char *desc,
+		unsigned char *digest, unsigned char *buf, l1_io_block_fn block,
+		void *arg) {
+	struct l1_io_head head = { key->head, key->head_nbytes };
+
+	return l1_io_read_key_blocks(engine, fd, desc, key->offset, &head,
+			digest, key->block_nbytes, key->nselect, buf, block, arg);
+}
+
+/*
+ * Encode the version 1 header of 'key' into 'buf', which must hold
+ * L1_KEY_HEADER_NBYTES bytes.
+ */
+void l1_key_encode_header(const struct l1_key *key, unsigned char *buf) {
+	memset(buf, 0, L1_KEY_HEADER_NBYTES);
+	memcpy(buf, L1_KEY_MAGIC, strlen(L1_KEY_MAGIC));
+
+	l1_put_le32(buf + OFF_VERSION, L1_KEY_VERSION);
+	l1_put_le32(buf + OFF_HEADER_NBYTES, L1_KEY_HEADER_NBYTES);
+	l1_put_le32(buf + OFF_TYPE, key->type);
+	l1_put_le32(buf + OFF_FLAGS, key->flags);
+	l1_put_le32(buf + OFF_BLOCK_NBYTES, key->block_nbytes);
+	l1_put_le32(buf + OFF_NBLOCKS, key->nblocks);
+	strncpy((char *) buf + OFF_ALGO, gcry_md_algo_name(key->algo),
+			L1_KEY_ALGO_NAME_LEN - 1);
+	strncpy((char *) buf + OFF_DIGEST, gcry_md_algo_name(key->digest),
+			L1_KEY_ALGO_NAME_LEN - 1);
+	memcpy(buf + OFF_FINGERPRINT, key->fingerprint, L1_FPR_NBYTES);
+
+	gcry_md_hash_buffer(L1_FPR_ALGO, buf + OFF_CHECKSUM, buf, OFF_CHECKSUM);
+
+	if (key->scheme == L1_KEY_SCHEME_HORS) {
+		l1_put_le32(buf + OFF_NSIGS, key->nsigs);
+		gcry_md_hash_buffer(L1_FPR_ALGO, buf + OFF_HORS_CHECKSUM, buf,
+				OFF_HORS_CHECKSUM);
+	}
+}
+
+/*
+ * Set the fingerprint of 'key' to that of the public key blocks 'pub'.  Both
+ * halves of a key pair carry the same fingerprint.
+ */
+void l1_key_set_fingerprint(struct l1_key *key, const unsigned char *pub) {
+	gcry_md_hash_buffer(L1_FPR_ALGO, key->fingerprint, pub,
+			(size_t) key->block_nbytes * key->nblocks);
+}
+
+/*
+ * Write the header (for version 1 keys) and the blocks of 'key' with a single
+ * write.
+ */
+bool l1_key_write(const struct l1_key *key, struct l1_out *out,
+		const void *blocks) {
+	unsigned char header[L1_KEY_HEADER_NBYTES];
+	struct iovec iov[2];
+	int iovcnt = 0;
+
+	if (key->format == L1_KEY_FORMAT_V1) {
+		l1_key_encode_header(key, header);
+		iov[iovcnt].iov_base = header;
+		iov[iovcnt++].iov_len = sizeof header;
+	}
+
+	iov[iovcnt].iov_base = (void *) blocks;
+	iov[iovcnt++].iov_len = (size_t) key->block_nbytes * key->nblocks;
+
+	return l1_out_writev(out, iov, iovcnt);
+}
+
+/*
+ * Write 'key' like l1_key_write() to descriptor 'fd', which is resized to
+ * hold the key and written through a shared mapping.  This also supports
+ * descriptors created by memfd_secret(), which cannot be written to.
+ */
+bool l1_key_write_fd(const struct l1_key *key, int fd, const void *blocks) {
+	size_t nbytes = key->offset + (size_t) key->block_nbytes * key->nblocks;
+	unsigned char *data;
+
+	if (ftruncate(fd, nbytes)) {
+		return false;
+	}
+
+	data = mmap(NULL, nbytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+	if (data == MAP_FAILED) {
+		return false;
+	}
+
+	if (key->format == L1_KEY_FORMAT_V1) {
+		l1_key_encode_header(key, data);
+	}
+
+	memcpy(data + key->offset, blocks, nbytes - key->offset);
+	l1_stats_write(nbytes);
+
+	return !munmap(data, nbytes);
+}
+
+/*
+ * Record a signature in the header of the HORS secret key file 'filename',
+ * which must still hold 'key'.  The header is updated on disk before the
+ * signature is released, and the key is refused once it has made
+ * l1_hors_max_signatures() signatures.  Concurrent signers are serialized by
+ * a lock on the key file.
+ */
+bool l1_key_count_signature(struct l1_key *key, const char *filename) {
+	unsigned char buf[L1_KEY_HEADER_NBYTES];
+	struct l1_key cur = *key;
+	uint32_t max_nsigs = l1_hors_max_signatures(key->nselect);
+	bool ret = false;
+	int fd;
+
+	if ((fd = open(filename, O_RDWR | O_CLOEXEC)) < 0
+			|| flock(fd, LOCK_EX)) {
+		fprintf(stderr, "Failed to open %s: %s\n", filename, strerror(errno));
+		goto out;
+	}
+
+	if (pread(fd, buf, sizeof buf, 0) != sizeof buf) {
+		fprintf(stderr, "Failed to read header of %s\n", filename);
+		goto out;
+	}
+
+	l1_stats_read(sizeof buf);
+
+	if (!decode_header(&cur, buf, "secret key file")) {
+		goto out;
+	}
+
+	if (memcmp(cur.fingerprint, key->fingerprint, L1_FPR_NBYTES)) {
+		fprintf(stderr, "Secret key file %s was replaced\n", filename);
+		goto out;
+	}
+
+	if (cur.nsigs >= max_nsigs) {
+		fprintf(stderr, "The secret key has been used for the maximum number "
+				"of %u signatures\n", max_nsigs);
+		goto out;
+	}
+
+	++cur.nsigs;
+	l1_key_encode_header(&cur, buf);
+
+	if (pwrite(fd, buf, sizeof buf, 0) != sizeof buf || fdatasync(fd)) {
+		fprintf(stderr, "Failed to update %s: %s\n", filename,
+				strerror(errno));
+		goto out;
+	}
+
+	key->nsigs = cur.nsigs;
+	ret = true;
+
+out:
+	if (fd >= 0) {
+		close(fd);
+	}
+
+	return ret;
+}
+
+/*
+ * Overwrite 'nbytes' bytes of 'fd' at 'offset' with zeros.
+ */
+static bool overwrite_range(int fd, off_t offset, off_t nbytes) {
+	static const unsigned char zeros[BURN_BUFFER_LEN];
+
+	while (nbytes) {
+		size_t len = nbytes < BURN_BUFFER_LEN ? nbytes : BURN_BUFFER_LEN;
+
+		if (pwrite(fd, zeros, len, offset) != (ssize_t) len) {
+			return false;
+		}
+
+		l1_stats_write(len);
+		offset += len;
+		nbytes -= len;
+	}
+
+	return true;
+}
+
+/*
+ * Destroy the secret key 'key' in file 'filename', which must still be the
+ * file 'fd' that the key was read from.  The blocks are overwritten and
+ * written to disk before the file is truncated to release their storage.
+ * The header of a version 1 key is kept and marked with L1_KEY_FLAG_BURNED,
+ * so the key is refused instead of being mistaken for an empty raw key.
+ */
+bool l1_key_burn(struct l1_key *key, int fd, const char *filename) {
+	unsigned char buf[L1_KEY_HEADER_NBYTES];
+	off_t nbytes = (off_t) key->block_nbytes * key->nblocks;
+	struct l1_key cur = *key;
+	struct stat st, read_st;
+	bool ret = false;
+	int burn_fd;
+
+	if ((burn_fd = open(filename, O_RDWR | O_CLOEXEC)) < 0
+			|| flock(burn_fd, LOCK_EX) || fstat(burn_fd, &st)
+			|| fstat(fd, &read_st)) {
+		fprintf(stderr, "Failed to open %s: %s\n", filename, strerror(errno));
+		goto out;
+	}
+
+	if (st.st_dev != read_st.st_dev || st.st_ino != read_st.st_ino) {
+		fprintf(stderr, "Secret key file %s was replaced\n", filename);
+		goto out;
+	}
+
+	if (key->format == L1_KEY_FORMAT_V1) {
+		if (pread(burn_fd, buf, sizeof buf, 0) != sizeof buf) {
+			fprintf(stderr, "Failed to read header of %s\n", filename);
+			goto out;
+		}
+
+		l1_stats_read(sizeof buf);
+
+		if (!decode_header(&cur, buf, "secret key file")) {
+			goto out;
+		}
+
+		cur.flags |= L1_KEY_FLAG_BURNED;
+		l1_key_encode_header(&cur, buf);
+	}
+
+	if (!overwrite_range(burn_fd, key->offset, nbytes)
+			|| (key->format == L1_KEY_FORMAT_V1
+				&& pwrite(burn_fd, buf, sizeof buf, 0) != sizeof buf)
+			|| fdatasync(burn_fd)
+			|| ftruncate(burn_fd, key->offset)
+			|| fdatasync(burn_fd)) {
+		fprintf(stderr, "Failed to burn %s: %s\n", filename,
+				strerror(errno));
+		goto out;
+	}
+
+	key->flags = cur.flags;
+	ret = true;
+
+out:
+	if (burn_fd >= 0) {
+		close(burn_fd);
+	}
+
+	return ret;
+}
+
+/*
+ * Copy the blocks that sign 'digest' from the in-memory blocks of 'key' to
+ * consecutive slots of 'out', which holds key->nselect blocks.
+ */
+void l1_key_select(const struct l1_key *key, const unsigned char *blocks,
+		const unsigned char *digest, unsigned char *out) {
+	if (key->scheme == L1_KEY_SCHEME_HORS) {
+		l1_hors_select(blocks, digest, key->block_nbytes, key->nselect, out);
+	} else {
+		l1_ots_select(blocks, digest, key->block_nbytes, key->nselect,
+				out);
+	}
+}
+
+/*
+ * Print the format, hash algorithm, message digest, and fingerprint of a key
+ * for --verbose.
+ */
+void l1_key_print_info(const struct l1_key *key, const char *desc) {
+	fprintf(stderr, "%s: %s, %s (%u bits)", desc,
+			key->format == L1_KEY_FORMAT_V1 ? "version 1" : "raw",
+			gcry_md_algo_name(key->algo), key->block_nbytes * 8);
+
+	if (key->digest != key->algo) {
+		fprintf(stderr, ", message digest %s (%u bits)",
+				gcry_md_algo_name(key->digest), key->digest_nbytes * 8);
+	}
+
+	fprintf(stderr, "\n");
+
+	if (key->format != L1_KEY_FORMAT_V1) {
+		return;
+	}
+
+	if (key->scheme == L1_KEY_SCHEME_HORS) {
+		fprintf(stderr, "%s scheme: HORS, %u of %u blocks per signature\n",
+				desc, key->nselect, key->nblocks);
+	}
+
+	if (key->scheme == L1_KEY_SCHEME_HORS && key->type == L1_KEY_TYPE_SECRET) {
+		fprintf(stderr, "%s signatures: %u of %u used, security level "
+				"%.1f bits\n", desc, key->nsigs,
+				l1_hors_max_signatures(key->nselect),
+				l1_hors_security(key->nselect, key->nsigs));
+	}
+
+	fprintf(stderr, "%s fingerprint: ", desc);
+	l1_gcry_print_digest(stderr, (unsigned char *) key->fingerprint,
+			L1_FPR_NBYTES);
+}
+
+/*
+ * Map the blocks of key file 'fd' read-only.
+ */
+unsigned char *l1_key_map(const struct l1_key *key, int fd,
+		struct l1_map *map) {
+	return l1_map_range(fd, key->offset,
+			(size_t) key->block_nbytes * key->nblocks, map);
+}
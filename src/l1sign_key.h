@@ -0,0 +1,154 @@
+/*
+ * l1sign - Implementation of the Lamport-Diffie one-time signature scheme
+ * Copyright (c) 2019  Janik Rabe <info@janikrabe.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef L1SIGN_KEY_H
+#define L1SIGN_KEY_H
+
+#include <config.h>
+
+#include "l1sign_gcrypt.h"
+#include "l1sign_io.h"
+#include "l1sign_out.h"
+#include "l1sign_util.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define L1_KEY_MAGIC "L1SIGNKY"
+#define L1_KEY_VERSION 1
+#define L1_KEY_HEADER_NBYTES 4096
+#define L1_KEY_ALGO_NAME_LEN 32
+
+/*
+ * Flags that are understood by this version.  Keys with other flags set are
+ * rejected.
+ */
+#define L1_KEY_FLAG_HORS (1 << 0)
+#define L1_KEY_FLAG_BURNED (1 << 1)
+#define L1_KEY_FLAGS_KNOWN (L1_KEY_FLAG_HORS | L1_KEY_FLAG_BURNED)
+
+/*
+ * Parameters given on the command line, which version 1 keys must match
+ * instead of providing their own.
+ */
+#define L1_KEY_EXPLICIT_HASH (1 << 0)
+#define L1_KEY_EXPLICIT_DIGEST (1 << 1)
+
+enum l1_key_format {
+	L1_KEY_FORMAT_AUTO,
+	L1_KEY_FORMAT_RAW,
+	L1_KEY_FORMAT_V1,
+};
+
+/*
+ * Lamport-Diffie keys sign a single message.  HORS keys sign up to
+ * l1_hors_max_signatures() messages with smaller signatures, at the cost of
+ * larger keys.
+ */
+enum l1_key_scheme {
+	L1_KEY_SCHEME_AUTO,
+	L1_KEY_SCHEME_LD,
+	L1_KEY_SCHEME_HORS,
+};
+
+enum l1_key_type {
+	L1_KEY_TYPE_SECRET = 1,
+	L1_KEY_TYPE_PUBLIC = 2,
+};
+
+/*
+ * A raw key file consists of the key blocks only.  A version 1 key file
+ * starts with a header of L1_KEY_HEADER_NBYTES bytes, which keeps the blocks
+ * page-aligned.  All integers in the header are stored in little-endian byte
+ * order:
+ *
+ *     0  magic             8 bytes
+ *     8  version           uint32
+ *    12  header size       uint32, offset of the first block
+ *    16  key type          uint32
+ *    20  flags             uint32
+ *    24  block size        uint32, also the output length of the hash
+ *    28  number of blocks  uint32, two for each bit of the message digest
+ *    32  hash algorithm    L1_KEY_ALGO_NAME_LEN bytes, NUL-padded name
+ *    64  message digest    L1_KEY_ALGO_NAME_LEN bytes, NUL-padded name
+ *    96  fingerprint       SHA-256 of the public key blocks
+ *   128  checksum          SHA-256 of the preceding bytes
+ *
+ * Keys with flag L1_KEY_FLAG_HORS use the HORS scheme, have L1_HORS_NBLOCKS
+ * blocks, and extend the header with the number of signatures made with the
+ * secret key, which is updated after the key is created:
+ *
+ *   160  signatures        uint32, zero for public keys
+ *   164  checksum          SHA-256 of the preceding bytes
+ *
+ * Secret keys with flag L1_KEY_FLAG_BURNED have been destroyed by
+ * l1_key_burn() and no longer hold their blocks.
+ *
+ * The remainder of the header is zero.
+ */
+struct l1_key {
+	enum l1_key_format format;
+	enum l1_key_type type;
+	enum l1_key_scheme scheme;
+	int digest;
+	int algo;
+	unsigned int digest_nbytes;
+	uint32_t flags;
+	unsigned int block_nbytes;
+	unsigned int nblocks;
+	unsigned int nselect;
+	uint32_t nsigs;
+	off_t offset;
+	unsigned char fingerprint[L1_FPR_NBYTES];
+
+	/*
+	 * The start of a key file that cannot be read at an offset, which
+	 * l1_key_open() has read from the stream to look for a header.
+	 */
+	unsigned char head[L1_KEY_HEADER_NBYTES];
+	unsigned int head_nbytes;
+};
+
+void l1_key_init(struct l1_key *key, enum l1_key_format format,
+		enum l1_key_type type, int digest, int algo,
+		unsigned int block_nbytes);
+bool l1_key_set_scheme(struct l1_key *key, enum l1_key_scheme scheme);
+bool l1_key_open(struct l1_key *key, int fd, const char *desc,
+		enum l1_key_type type, int digest, int algo, unsigned int block_nbytes,
+		unsigned int explicit);
+bool l1_key_check_size(const struct l1_key *key, int fd, const char *desc);
+size_t l1_key_copy_head(const struct l1_key *key, unsigned char *blocks);
+bool l1_key_read_blocks(const struct l1_key *key,
+		const struct l1_io_engine *engine, int fd, const char *desc,
+		unsigned char *digest, unsigned char *buf, l1_io_block_fn block,
+		void *arg);
+void l1_key_encode_header(const struct l1_key *key, unsigned char *buf);
+void l1_key_set_fingerprint(struct l1_key *key, const unsigned char *pub);
+bool l1_key_write(const struct l1_key *key, struct l1_out *out,
+		const void *blocks);
+bool l1_key_write_fd(const struct l1_key *key, int fd, const void *blocks);
+bool l1_key_count_signature(struct l1_key *key, const char *filename);
+bool l1_key_burn(struct l1_key *key, int fd, const char *filename);
+void l1_key_select(const struct l1_key *key, const unsigned char *blocks,
+		const unsigned char *digest, unsigned char *out);
+void l1_key_print_info(const struct l1_key *key, const char *desc);
+unsigned char *l1_key_map(const struct l1_key *key, int fd,
+		struct l1_map *map);
+
+#endif
@@ -0,0 +1,716 @@
+/*
+ * l1sign - Implementation of the Lamport-Diffie one-time signature scheme
+ * Copyright (c) 2019  Janik Rabe <info@janikrabe.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "l1sign_keyring.h"
+
+#include "l1sign_gcrypt.h"
+#include "l1sign_key.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define INDEX_MIN_NSLOTS 64
+
+struct build_file {
+	char *name;
+	struct stat st;
+	uint32_t nkeys;
+	uint32_t data_offset;
+};
+
+struct build {
+	struct build_file *files;
+	size_t nfiles;
+	size_t files_cap;
+
+	struct l1_keyring_slot *entries;
+	size_t nentries;
+	size_t entries_cap;
+
+	size_t names_nbytes;
+};
+
+static char *path_join(const char *dirname, const char *name) {
+	size_t len = strlen(dirname) + strlen(name) + 2;
+	char *path = malloc(len);
+
+	if (path) {
+		snprintf(path, len, "%s/%s", dirname, name);
+	}
+
+	return path;
+}
+
+static uint64_t block_tag(const unsigned char *block, unsigned int nbytes) {
+	uint64_t tag = 0;
+
+	memcpy(&tag, block, nbytes < sizeof tag ? nbytes : sizeof tag);
+	return tag;
+}
+
+static size_t index_nbytes(const struct l1_keyring_header *header) {
+	return sizeof *header
+		+ (size_t) header->nslots * sizeof (struct l1_keyring_slot)
+		+ (size_t) header->nfiles * sizeof (struct l1_keyring_file)
+		+ header->names_nbytes;
+}
+
+static void keyring_set_index(struct l1_keyring *ring, void *index) {
+	ring->header = index;
+	ring->slots = (struct l1_keyring_slot *) (ring->header + 1);
+	ring->files = (struct l1_keyring_file *)
+		(ring->slots + ring->header->nslots);
+	ring->names = (char *) (ring->files + ring->header->nfiles);
+}
+
+static void keyring_release_index(struct l1_keyring *ring) {
+	if (ring->map) {
+		munmap(ring->map, ring->map_nbytes);
+		ring->map = NULL;
+	} else {
+		free(ring->header);
+	}
+
+	ring->header = NULL;
+}
+
+/*
+ * Check that all references in the index are in bounds: file names must be
+ * terminated within the name table and must not lead out of the directory,
+ * entries must refer to existing keys, and at least one slot must be empty.
+ */
+static bool keyring_check_index(const struct l1_keyring *ring) {
+	const struct l1_keyring_header *header = ring->header;
+	bool empty = false;
+
+	if (header->nfiles
+			&& (!header->names_nbytes
+				|| ring->names[header->names_nbytes - 1])) {
+		return false;
+	}
+
+	for (uint32_t i = 0; i < header->nfiles; ++i) {
+		const struct l1_keyring_file *file = &ring->files[i];
+
+		if (file->name_offset >= header->names_nbytes
+				|| strchr(ring->names + file->name_offset, '/')) {
+			return false;
+		}
+	}
+
+	for (uint32_t i = 0; i < header->nslots; ++i) {
+		const struct l1_keyring_slot *slot = &ring->slots[i];
+
+		if (slot->file_idx == L1_KEYRING_EMPTY_SLOT) {
+			empty = true;
+		} else if (slot->file_idx >= header->nfiles
+				|| slot->key_idx >= ring->files[slot->file_idx].nkeys) {
+			return false;
+		}
+	}
+
+	return empty;
+}
+
+/*
+ * Map the existing index of the keyring, if there is a valid one for the
+ * hash algorithm in use.
+ */
+static bool keyring_load(struct l1_keyring *ring) {
+	char *path = path_join(ring->dirname, L1_KEYRING_INDEX_NAME);
+	struct l1_keyring_header *header;
+	struct stat st;
+	int fd;
+
+	if (!path) {
+		return false;
+	}
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	free(path);
+
+	if (fd < 0) {
+		return false;
+	}
+
+	if (fstat(fd, &st) || (size_t) st.st_size < sizeof *header) {
+		close(fd);
+		return false;
+	}
+
+	header = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (header == MAP_FAILED) {
+		return false;
+	}
+
+	if (memcmp(header->magic, L1_KEYRING_MAGIC, sizeof header->magic)
+			|| header->version != L1_KEYRING_VERSION
+			|| header->digest != ring->digest
+			|| header->algo != ring->algo
+			|| header->hash_nbytes != ring->hash_nbytes
+			|| !header->nslots
+			|| header->nslots & (header->nslots - 1)
+			|| index_nbytes(header) != (size_t) st.st_size) {
+		munmap(header, st.st_size);
+		return false;
+	}
+
+	ring->map = header;
+	ring->map_nbytes = st.st_size;
+	keyring_set_index(ring, header);
+
+	if (!keyring_check_index(ring)) {
+		fprintf(stderr, "Warning: Ignoring corrupt keyring index\n");
+		keyring_release_index(ring);
+		return false;
+	}
+
+	return true;
+}
+
+static bool build_add_file(struct build *build, const char *name,
+		const struct stat *st, uint32_t nkeys, uint32_t data_offset) {
+	if (build->nfiles == build->files_cap) {
+		size_t cap = build->files_cap ? build->files_cap * 2 : 64;
+		void *files = realloc(build->files, cap * sizeof *build->files);
+
+		if (!files) {
+			return false;
+		}
+
+		build->files = files;
+		build->files_cap = cap;
+	}
+
+	if (!(build->files[build->nfiles].name = strdup(name))) {
+		return false;
+	}
+
+	build->files[build->nfiles].st = *st;
+	build->files[build->nfiles].data_offset = data_offset;
+	build->files[build->nfiles++].nkeys = nkeys;
+	build->names_nbytes += strlen(name) + 1;
+	return true;
+}
+
+static bool build_add_entry(struct build *build, uint64_t tag,
+		uint32_t file_idx, uint32_t key_idx) {
+	if (build->nentries == build->entries_cap) {
+		size_t cap = build->entries_cap ? build->entries_cap * 2 : 256;
+		void *entries = realloc(build->entries, cap * sizeof *build->entries);
+
+		if (!entries) {
+			return false;
+		}
+
+		build->entries = entries;
+		build->entries_cap = cap;
+	}
+
+	build->entries[build->nentries].tag = tag;
+	build->entries[build->nentries].file_idx = file_idx;
+	build->entries[build->nentries++].key_idx = key_idx;
+	return true;
+}
+
+static void build_free(struct build *build) {
+	for (size_t i = 0; i < build->nfiles; ++i) {
+		free(build->files[i].name);
+	}
+
+	free(build->files);
+	free(build->entries);
+}
+
+/*
+ * Index keys 'first' to 'nkeys' of a key file by reading their first two
+ * blocks.
+ */
+static bool build_index_keys(struct build *build, struct l1_keyring *ring,
+		int fd, uint32_t file_idx, uint32_t first, uint32_t nkeys,
+		off_t data_offset) {
+	unsigned char blocks[2 * L1_MAX_HASH_NBYTES];
+	size_t nbytes = 2 * ring->hash_nbytes;
+
+	for (uint32_t k = first; k < nkeys; ++k) {
+		off_t offset = data_offset + (off_t) k * ring->key_nbytes;
+
+		if (pread(fd, blocks, nbytes, offset) != (ssize_t) nbytes) {
+			return false;
+		}
+
+		if (!build_add_entry(build,
+					block_tag(blocks, ring->hash_nbytes), file_idx, k)
+				|| !build_add_entry(build,
+					block_tag(blocks + ring->hash_nbytes, ring->hash_nbytes),
+					file_idx, k)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * The keyring whose files are being sorted by compare_files().
+ */
+static const struct l1_keyring *sort_ring;
+
+static int compare_files(const void *a, const void *b) {
+	const struct l1_keyring *ring = sort_ring;
+	const struct l1_keyring_file *fa = &ring->files[*(const uint32_t *) a];
+	const struct l1_keyring_file *fb = &ring->files[*(const uint32_t *) b];
+
+	return strcmp(ring->names + fa->name_offset, ring->names + fb->name_offset);
+}
+
+/*
+ * Find a file of the current index by name.  'order' lists the file indices
+ * sorted by name.  Returns L1_KEYRING_EMPTY_SLOT if there is no such file.
+ */
+static uint32_t keyring_find_file(struct l1_keyring *ring,
+		const uint32_t *order, const char *name) {
+	size_t lo = 0;
+	size_t hi = ring->header ? ring->header->nfiles : 0;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		int cmp = strcmp(name,
+				ring->names + ring->files[order[mid]].name_offset);
+
+		if (!cmp) {
+			return order[mid];
+		}
+
+		if (cmp < 0) {
+			hi = mid;
+		} else {
+			lo = mid + 1;
+		}
+	}
+
+	return L1_KEYRING_EMPTY_SLOT;
+}
+
+/*
+ * Check whether an indexed file is still the same as when it was indexed.
+ * Files that have been replaced, rewritten, or appended to are indexed again.
+ */
+static bool file_unchanged(const struct l1_keyring_file *file,
+		const struct stat *st) {
+	return file->ino == (uint64_t) st->st_ino
+		&& file->size == (int64_t) st->st_size
+		&& file->mtime_sec == (int64_t) st->st_mtim.tv_sec
+		&& file->mtime_nsec == (int64_t) st->st_mtim.tv_nsec;
+}
+
+/*
+ * Serialize the index.  Returns a buffer of 'nbytes' bytes.
+ */
+static struct l1_keyring_header *build_serialize(struct build *build,
+		struct l1_keyring *ring, const struct stat *dir_st, size_t *nbytes) {
+	struct l1_keyring_header header = { 0 };
+	struct l1_keyring_header *index;
+	struct l1_keyring_slot *slots;
+	struct l1_keyring_file *files;
+	char *names;
+	uint32_t nslots = INDEX_MIN_NSLOTS;
+
+	while (nslots < 2 * build->nentries) {
+		nslots *= 2;
+	}
+
+	memcpy(header.magic, L1_KEYRING_MAGIC, sizeof header.magic);
+	header.version = L1_KEYRING_VERSION;
+	header.digest = ring->digest;
+	header.algo = ring->algo;
+	header.hash_nbytes = ring->hash_nbytes;
+	header.nslots = nslots;
+	header.nfiles = build->nfiles;
+	header.names_nbytes = build->names_nbytes;
+	header.dir_mtime_sec = dir_st->st_mtim.tv_sec;
+	header.dir_mtime_nsec = dir_st->st_mtim.tv_nsec;
+
+	*nbytes = index_nbytes(&header);
+
+	if (!(index = calloc(1, *nbytes))) {
+		return NULL;
+	}
+
+	*index = header;
+	slots = (struct l1_keyring_slot *) (index + 1);
+	files = (struct l1_keyring_file *) (slots + nslots);
+	names = (char *) (files + build->nfiles);
+
+	for (uint32_t i = 0; i < nslots; ++i) {
+		slots[i].file_idx = L1_KEYRING_EMPTY_SLOT;
+	}
+
+	for (size_t i = 0; i < build->nentries; ++i) {
+		uint32_t slot = build->entries[i].tag & (nslots - 1);
+
+		while (slots[slot].file_idx != L1_KEYRING_EMPTY_SLOT) {
+			slot = (slot + 1) & (nslots - 1);
+		}
+
+		slots[slot] = build->entries[i];
+	}
+
+	for (size_t i = 0, offset = 0; i < build->nfiles; ++i) {
+		size_t len = strlen(build->files[i].name) + 1;
+
+		files[i].ino = build->files[i].st.st_ino;
+		files[i].size = build->files[i].st.st_size;
+		files[i].mtime_sec = build->files[i].st.st_mtim.tv_sec;
+		files[i].mtime_nsec = build->files[i].st.st_mtim.tv_nsec;
+		files[i].name_offset = offset;
+		files[i].nkeys = build->files[i].nkeys;
+		files[i].data_offset = build->files[i].data_offset;
+		memcpy(names + offset, build->files[i].name, len);
+		offset += len;
+	}
+
+	return index;
+}
+
+/*
+ * Replace the index file of the keyring atomically.  Renaming the index into
+ * place changes the modification time of the directory, so the time recorded
+ * in the index is updated afterwards.  Changes that race with an update are
+ * only picked up by the next explicit update.
+ */
+static bool keyring_write(struct l1_keyring *ring,
+		struct l1_keyring_header *index, size_t nbytes) {
+	char *path = path_join(ring->dirname, L1_KEYRING_INDEX_NAME);
+	char *tmp_path = path_join(ring->dirname,
+			L1_KEYRING_INDEX_NAME ".XXXXXX");
+	struct stat dir_st;
+	bool ret = false;
+	int fd;
+
+	if (!path || !tmp_path) {
+		free(path);
+		free(tmp_path);
+		return false;
+	}
+
+	if ((fd = mkstemp(tmp_path)) >= 0) {
+		const char *buf = (const char *) index;
+		size_t done = 0;
+
+		while (done < nbytes) {
+			ssize_t len = write(fd, buf + done, nbytes - done);
+
+			if (len < 0 && errno == EINTR) {
+				continue;
+			}
+
+			if (len <= 0) {
+				break;
+			}
+
+			done += len;
+		}
+
+		ret = done == nbytes && !fchmod(fd, 0644) && !rename(tmp_path, path);
+
+		if (!ret) {
+			unlink(tmp_path);
+		} else if (!stat(ring->dirname, &dir_st)) {
+			index->dir_mtime_sec = dir_st.st_mtim.tv_sec;
+			index->dir_mtime_nsec = dir_st.st_mtim.tv_nsec;
+
+			if (pwrite(fd, index, sizeof *index, 0) != sizeof *index) {
+				ret = false;
+			}
+		}
+
+		if (close(fd)) {
+			ret = false;
+		}
+	}
+
+	free(path);
+	free(tmp_path);
+	return ret;
+}
+
+/*
+ * Bring the index up to date with the contents of the keyring directory.
+ * Only files that have changed since they were indexed are read; entries of
+ * removed files are dropped.  If the index cannot be saved, the updated index is only kept in
+ * memory.
+ */
+bool l1_keyring_update(struct l1_keyring *ring) {
+	struct build build = { 0 };
+	struct stat dir_st;
+	struct dirent *entry;
+	uint32_t nfiles = ring->header ? ring->header->nfiles : 0;
+	uint32_t *order = calloc(nfiles + 1, sizeof *order);
+	uint32_t *file_map = calloc(nfiles + 1, sizeof *file_map);
+	uint32_t *file_keep = calloc(nfiles + 1, sizeof *file_keep);
+	bool ret = false;
+	DIR *dir;
+
+	if (!order || !file_map || !file_keep) {
+		fprintf(stderr, "Failed to allocate memory\n");
+		goto out;
+	}
+
+	if (!(dir = opendir(ring->dirname))) {
+		perror("Failed to open keyring directory");
+		goto out;
+	}
+
+	if (fstat(dirfd(dir), &dir_st)) {
+		perror("Failed to stat keyring directory");
+		closedir(dir);
+		goto out;
+	}
+
+	for (uint32_t i = 0; i < nfiles; ++i) {
+		order[i] = i;
+		file_map[i] = L1_KEYRING_EMPTY_SLOT;
+	}
+
+	if (nfiles) {
+		sort_ring = ring;
+		qsort(order, nfiles, sizeof *order, compare_files);
+	}
+
+	ret = true;
+
+	while (ret && (entry = readdir(dir))) {
+		struct l1_key key;
+		struct stat st;
+		uint32_t old_idx;
+		uint32_t keep = 0;
+		uint32_t nkeys;
+		int fd;
+
+		if (entry->d_name[0] == '.') {
+			continue;
+		}
+
+		if ((fd = openat(dirfd(dir), entry->d_name,
+						O_RDONLY | O_CLOEXEC)) < 0) {
+			continue;
+		}
+
+		if (fstat(fd, &st) || !S_ISREG(st.st_mode) || !st.st_size
+				|| !l1_key_open(&key, fd, NULL, L1_KEY_TYPE_PUBLIC,
+					ring->digest, ring->algo, ring->hash_nbytes,
+					L1_KEY_EXPLICIT_HASH | L1_KEY_EXPLICIT_DIGEST)
+				|| key.scheme != L1_KEY_SCHEME_LD) {
+			close(fd);
+			continue;
+		}
+
+		/*
+		 * A version 1 key file holds a single key, whose size has already
+		 * been checked.  Raw key files may hold any number of keys.
+		 */
+		if (key.format == L1_KEY_FORMAT_V1) {
+			nkeys = 1;
+		} else if (st.st_size % ring->key_nbytes
+				|| st.st_size / ring->key_nbytes >= UINT32_MAX) {
+			close(fd);
+			continue;
+		} else {
+			nkeys = st.st_size / ring->key_nbytes;
+		}
+
+		uint32_t file_idx = build.nfiles;
+
+		old_idx = keyring_find_file(ring, order, entry->d_name);
+
+		if (old_idx != L1_KEYRING_EMPTY_SLOT
+				&& file_unchanged(&ring->files[old_idx], &st)) {
+			keep = ring->files[old_idx].nkeys;
+			file_map[old_idx] = file_idx;
+			file_keep[old_idx] = keep;
+		}
+
+		if (!build_add_file(&build, entry->d_name, &st, nkeys, key.offset)
+				|| !build_index_keys(&build, ring, fd, file_idx, keep, nkeys,
+					key.offset)) {
+			fprintf(stderr, "Failed to index keyring file %s\n", entry->d_name);
+			ret = false;
+		}
+
+		close(fd);
+	}
+
+	closedir(dir);
+
+	if (!ret) {
+		goto out;
+	}
+
+	for (uint32_t i = 0; ring->header && i < ring->header->nslots; ++i) {
+		struct l1_keyring_slot *slot = &ring->slots[i];
+
+		if (slot->file_idx == L1_KEYRING_EMPTY_SLOT
+				|| file_map[slot->file_idx] == L1_KEYRING_EMPTY_SLOT
+				|| slot->key_idx >= file_keep[slot->file_idx]) {
+			continue;
+		}
+
+		if (!build_add_entry(&build, slot->tag, file_map[slot->file_idx],
+					slot->key_idx)) {
+			ret = false;
+			goto out;
+		}
+	}
+
+	size_t nbytes;
+	struct l1_keyring_header *index = build_serialize(&build, ring,
+			&dir_st, &nbytes);
+
+	if (!index) {
+		fprintf(stderr, "Failed to allocate memory\n");
+		ret = false;
+		goto out;
+	}
+
+	if (!keyring_write(ring, index, nbytes)) {
+		fprintf(stderr, "Warning: Failed to save keyring index\n");
+	}
+
+	if (ring->header) {
+		keyring_release_index(ring);
+	}
+
+	keyring_set_index(ring, index);
+	ring->fresh = true;
+
+out:
+	build_free(&build);
+	free(order);
+	free(file_map);
+	free(file_keep);
+	return ret;
+}
+
+/*
+ * Open the keyring of keys for message digest 'digest' and hash algorithm
+ * 'algo' with 'hash_nbytes'-byte blocks in directory 'dirname'.  The index is
+ * updated if it is missing, if the directory has changed since it was last
+ * updated, or if 'update' is true.
+ */
+struct l1_keyring *l1_keyring_open(const char *dirname, int digest,
+		int algo, unsigned int hash_nbytes, bool update) {
+	struct l1_keyring *ring = calloc(1, sizeof *ring);
+	struct stat dir_st;
+
+	if (!ring || !(ring->dirname = strdup(dirname))) {
+		fprintf(stderr, "Failed to allocate memory\n");
+		free(ring);
+		return NULL;
+	}
+
+	ring->digest = digest;
+	ring->algo = algo;
+	ring->hash_nbytes = hash_nbytes;
+	ring->key_nbytes = l1_gcry_key_nbytes(
+			l1_gcry_digest_nbytes(digest, algo, hash_nbytes), hash_nbytes);
+
+	if (keyring_load(ring) && !update && !stat(dirname, &dir_st)
+			&& ring->header->dir_mtime_sec == dir_st.st_mtim.tv_sec
+			&& ring->header->dir_mtime_nsec == dir_st.st_mtim.tv_nsec) {
+		return ring;
+	}
+
+	if (!l1_keyring_update(ring)) {
+		l1_keyring_close(ring);
+		return NULL;
+	}
+
+	return ring;
+}
+
+void l1_keyring_close(struct l1_keyring *ring) {
+	if (ring->header) {
+		keyring_release_index(ring);
+	}
+
+	free(ring->dirname);
+	free(ring);
+}
+
+static bool keyring_search(struct l1_keyring *ring, uint64_t tag,
+		l1_keyring_match_fn match, void *arg) {
+	uint32_t mask = ring->header->nslots - 1;
+	uint32_t i = tag & mask;
+
+	for (uint32_t n = 0; n < ring->header->nslots
+			&& ring->slots[i].file_idx != L1_KEYRING_EMPTY_SLOT;
+			++n, i = (i + 1) & mask) {
+		struct l1_keyring_slot *slot = &ring->slots[i];
+		const struct l1_keyring_file *file = &ring->files[slot->file_idx];
+		char *path;
+		bool found;
+
+		if (slot->tag != tag) {
+			continue;
+		}
+
+		if (!(path = path_join(ring->dirname,
+						ring->names + file->name_offset))) {
+			return false;
+		}
+
+		found = match(path, file->data_offset
+				+ (off_t) slot->key_idx * ring->key_nbytes, arg);
+		free(path);
+
+		if (found) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+ * Find the keys whose first or second block starts like 'block' and pass
+ * them to 'match' until it accepts one.  If none does and the index has not
+ * been updated since it was loaded, a key may have been added to an existing
+ * file, so the index is updated and searched again.  Callers that search
+ * from several threads must update the index beforehand.
+ */
+bool l1_keyring_find(struct l1_keyring *ring, const unsigned char *block,
+		l1_keyring_match_fn match, void *arg) {
+	uint64_t tag = block_tag(block, ring->hash_nbytes);
+
+	if (keyring_search(ring, tag, match, arg)) {
+		return true;
+	}
+
+	return !ring->fresh && l1_keyring_update(ring)
+		&& keyring_search(ring, tag, match, arg);
+}
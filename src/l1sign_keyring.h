@@ -0,0 +1,111 @@
+/*
+ * l1sign - Implementation of the Lamport-Diffie one-time signature scheme
+ * Copyright (c) 2019  Janik Rabe <info@janikrabe.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef L1SIGN_KEYRING_H
+#define L1SIGN_KEYRING_H
+
+#include <config.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define L1_KEYRING_MAGIC "L1KRINDX"
+#define L1_KEYRING_VERSION 4
+#define L1_KEYRING_INDEX_NAME ".l1sign-index"
+
+#define L1_KEYRING_EMPTY_SLOT UINT32_MAX
+
+/*
+ * The index of a keyring directory consists of a header, an open-addressing
+ * hash table of 'nslots' slots, a table of 'nfiles' files, and the file names.
+ * All integers are stored in host byte order.  The keys of a file start at
+ * 'data_offset', which is non-zero for version 1 key files.
+ *
+ * Each public key is indexed by its first two blocks: the first block of a
+ * signature hashes to one of them, depending on the first bit of the message
+ * digest, which allows finding the key that corresponds to a signature.
+ */
+struct l1_keyring_header {
+	char magic[8];
+	uint32_t version;
+	int32_t digest;
+	int32_t algo;
+	uint32_t hash_nbytes;
+	uint32_t nslots;
+	uint32_t nfiles;
+	uint32_t names_nbytes;
+	int64_t dir_mtime_sec;
+	int64_t dir_mtime_nsec;
+};
+
+struct l1_keyring_slot {
+	uint64_t tag;
+	uint32_t file_idx;
+	uint32_t key_idx;
+};
+
+/*
+ * The inode, size, and modification time of a file when it was indexed.  Its
+ * entries are only reused if all of them are unchanged.
+ */
+struct l1_keyring_file {
+	uint64_t ino;
+	int64_t size;
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	uint32_t name_offset;
+	uint32_t nkeys;
+	uint32_t data_offset;
+	uint32_t reserved;
+};
+
+struct l1_keyring {
+	char *dirname;
+	int digest;
+	int algo;
+	unsigned int hash_nbytes;
+	unsigned int key_nbytes;
+
+	void *map;
+	size_t map_nbytes;
+
+	struct l1_keyring_header *header;
+	struct l1_keyring_slot *slots;
+	struct l1_keyring_file *files;
+	char *names;
+
+	bool fresh;
+};
+
+/*
+ * Invoked for each key whose index tag matches.  Returning true stops the
+ * search.
+ */
+typedef bool (*l1_keyring_match_fn)(const char *filename, off_t offset,
+		void *arg);
+
+struct l1_keyring *l1_keyring_open(const char *dirname, int digest,
+		int algo, unsigned int hash_nbytes, bool update);
+void l1_keyring_close(struct l1_keyring *ring);
+bool l1_keyring_update(struct l1_keyring *ring);
+bool l1_keyring_find(struct l1_keyring *ring, const unsigned char *block,
+		l1_keyring_match_fn match, void *arg);
+
+#endif
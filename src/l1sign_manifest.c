@@ -0,0 +1,620 @@
+/*
+ * l1sign - Implementation of the Lamport-Diffie one-time signature scheme
+ * Copyright (c) 2019  Janik Rabe <info@janikrabe.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "l1sign_manifest.h"
+
+#include "l1sign_gcrypt.h"
+#include "l1sign_pool.h"
+#include "l1sign_stats.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * Files are hashed in large chunks, since many of them are read at once.
+ */
+#define MANIFEST_BUFFER_LEN (1 << 20)
+
+#define MANIFEST_HEADER_LEN 128
+
+struct hash_ctx {
+	struct l1_manifest *manifest;
+	int root_fd;
+	bool verify;
+};
+
+void l1_manifest_init(struct l1_manifest *manifest, int digest) {
+	memset(manifest, 0, sizeof *manifest);
+	manifest->digest = digest;
+	manifest->digest_nbytes = digest ? l1_gcry_hash_nbytes(digest) : 0;
+}
+
+void l1_manifest_free(struct l1_manifest *manifest) {
+	for (size_t i = 0; i < manifest->nentries; ++i) {
+		free(manifest->entries[i].path);
+		free(manifest->entries[i].digest);
+	}
+
+	free(manifest->entries);
+	manifest->entries = NULL;
+	manifest->nentries = 0;
+	manifest->capacity = 0;
+}
+
+/*
+ * Leave the file 'filename' out of the tree if it exists, so that the
+ * manifest and the signature can be stored in the tree they describe.
+ */
+void l1_manifest_exclude(struct l1_manifest *manifest, const char *filename) {
+	struct stat st;
+	unsigned int n = manifest->nexclude;
+
+	if (!filename || n >= sizeof manifest->exclude_dev
+			/ sizeof *manifest->exclude_dev || stat(filename, &st)) {
+		return;
+	}
+
+	manifest->exclude_dev[n] = st.st_dev;
+	manifest->exclude_ino[n] = st.st_ino;
+	++manifest->nexclude;
+}
+
+static bool is_excluded(const struct l1_manifest *manifest,
+		const struct stat *st) {
+	for (unsigned int i = 0; i < manifest->nexclude; ++i) {
+		if (manifest->exclude_dev[i] == st->st_dev
+				&& manifest->exclude_ino[i] == st->st_ino) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+ * Append an entry that takes ownership of 'path'.
+ */
+static struct l1_manifest_entry *append_entry(struct l1_manifest *manifest,
+		char *path) {
+	struct l1_manifest_entry *entry;
+
+	if (manifest->nentries == manifest->capacity) {
+		size_t capacity = manifest->capacity ? manifest->capacity * 2 : 64;
+		struct l1_manifest_entry *entries = realloc(manifest->entries,
+				capacity * sizeof *entries);
+
+		if (!entries) {
+			fprintf(stderr, "Failed to allocate memory\n");
+			free(path);
+			return NULL;
+		}
+
+		manifest->entries = entries;
+		manifest->capacity = capacity;
+	}
+
+	entry = &manifest->entries[manifest->nentries++];
+	entry->path = path;
+	entry->size = 0;
+	entry->digest = NULL;
+	return entry;
+}
+
+bool l1_manifest_add(struct l1_manifest *manifest, const char *path) {
+	char *copy;
+
+	if (!*path || strchr(path, '\n')) {
+		fprintf(stderr, "Unsupported file name: '%s'\n", path);
+		return false;
+	}
+
+	if (!(copy = strdup(path))) {
+		fprintf(stderr, "Failed to allocate memory\n");
+		return false;
+	}
+
+	return append_entry(manifest, copy) != NULL;
+}
+
+static char *join_path(const char *prefix, const char *name) {
+	size_t len = strlen(prefix) + strlen(name) + 2;
+	char *path = malloc(len);
+
+	if (path) {
+		snprintf(path, len, "%s%s%s", prefix, *prefix ? "/" : "", name);
+	}
+
+	return path;
+}
+
+/*
+ * Add the regular files below the directory 'dir_fd', which is closed.
+ * Symbolic links are not followed.
+ */
+static bool walk_dir(struct l1_manifest *manifest, int dir_fd,
+		const char *prefix) {
+	DIR *dir = fdopendir(dir_fd);
+	struct dirent *ent;
+	bool ret = true;
+
+	if (!dir) {
+		fprintf(stderr, "Failed to open directory %s: %s\n",
+				*prefix ? prefix : ".", strerror(errno));
+		close(dir_fd);
+		return false;
+	}
+
+	while (ret && (errno = 0, ent = readdir(dir))) {
+		struct stat st;
+		char *path;
+		int fd;
+
+		if (!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, "..")) {
+			continue;
+		}
+
+		if (!(path = join_path(prefix, ent->d_name))) {
+			fprintf(stderr, "Failed to allocate memory\n");
+			ret = false;
+			break;
+		}
+
+		if (fstatat(dirfd(dir), ent->d_name, &st, AT_SYMLINK_NOFOLLOW)) {
+			fprintf(stderr, "Failed to stat %s: %s\n", path, strerror(errno));
+			ret = false;
+		} else if (is_excluded(manifest, &st)) {
+			/* not part of the tree */
+		} else if (S_ISREG(st.st_mode)) {
+			ret = l1_manifest_add(manifest, path);
+		} else if (S_ISDIR(st.st_mode)) {
+			if ((fd = openat(dirfd(dir), ent->d_name,
+						O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC)) < 0) {
+				fprintf(stderr, "Failed to open directory %s: %s\n", path,
+						strerror(errno));
+				ret = false;
+			} else {
+				ret = walk_dir(manifest, fd, path);
+			}
+		}
+
+		free(path);
+	}
+
+	if (ret && errno) {
+		fprintf(stderr, "Failed to read directory %s: %s\n",
+				*prefix ? prefix : ".", strerror(errno));
+		ret = false;
+	}
+
+	closedir(dir);
+	return ret;
+}
+
+/*
+ * Add all regular files below the directory 'dirname'.
+ */
+bool l1_manifest_walk(struct l1_manifest *manifest, const char *dirname) {
+	int fd = open(dirname, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+	if (fd < 0) {
+		fprintf(stderr, "Failed to open directory %s: %s\n", dirname,
+				strerror(errno));
+		return false;
+	}
+
+	return walk_dir(manifest, fd, "");
+}
+
+/*
+ * Add the files listed in 'in', one path per line.  Empty lines are ignored.
+ */
+bool l1_manifest_read_list(struct l1_manifest *manifest, FILE *in) {
+	char *line = NULL;
+	size_t line_nbytes = 0;
+	ssize_t len;
+	bool ret = true;
+
+	while (ret && (len = getline(&line, &line_nbytes, in)) > 0) {
+		l1_stats_read(len);
+
+		if (line[len - 1] == '\n') {
+			line[--len] = '\0';
+		}
+
+		if (len) {
+			ret = l1_manifest_add(manifest, line);
+		}
+	}
+
+	if (ret && ferror(in)) {
+		perror("Failed to read file list");
+		ret = false;
+	}
+
+	free(line);
+	return ret;
+}
+
+/*
+ * Collect the files of the tree 'dirname', or the files listed on standard
+ * input if 'dirname' is "-", and open the directory that their paths are
+ * relative to.  Returns -1 on failure.
+ */
+int l1_manifest_collect(struct l1_manifest *manifest, const char *dirname) {
+	int root_fd;
+
+	if (!strcmp(dirname, "-")) {
+		return l1_manifest_read_list(manifest, stdin) ? AT_FDCWD : -1;
+	}
+
+	if (!l1_manifest_walk(manifest, dirname)) {
+		return -1;
+	}
+
+	if ((root_fd = open(dirname, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+		fprintf(stderr, "Failed to open directory %s: %s\n", dirname,
+				strerror(errno));
+	}
+
+	return root_fd;
+}
+
+static int compare_entries(const void *a, const void *b) {
+	const struct l1_manifest_entry *entry_a = a;
+	const struct l1_manifest_entry *entry_b = b;
+
+	return strcmp(entry_a->path, entry_b->path);
+}
+
+/*
+ * Sort the entries by path, which makes the manifest canonical.  Returns
+ * false if a path is listed more than once.
+ */
+bool l1_manifest_sort(struct l1_manifest *manifest) {
+	if (manifest->nentries) {
+		qsort(manifest->entries, manifest->nentries,
+				sizeof *manifest->entries, compare_entries);
+	}
+
+	for (size_t i = 1; i < manifest->nentries; ++i) {
+		if (!strcmp(manifest->entries[i - 1].path, manifest->entries[i].path)) {
+			fprintf(stderr, "Duplicate file: %s\n", manifest->entries[i].path);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Report every path that is only listed in one of two sorted manifests.
+ */
+bool l1_manifest_compare_paths(const struct l1_manifest *expected,
+		const struct l1_manifest *actual) {
+	size_t i = 0;
+	size_t j = 0;
+	bool ret = true;
+
+	while (i < expected->nentries || j < actual->nentries) {
+		int cmp = i == expected->nentries ? 1
+			: j == actual->nentries ? -1
+			: strcmp(expected->entries[i].path, actual->entries[j].path);
+
+		if (cmp < 0) {
+			fprintf(stderr, "Missing file: %s\n", expected->entries[i].path);
+			ret = false;
+		} else if (cmp > 0) {
+			fprintf(stderr, "Unexpected file: %s\n", actual->entries[j].path);
+			ret = false;
+		}
+
+		i += cmp <= 0;
+		j += cmp >= 0;
+	}
+
+	return ret;
+}
+
+/*
+ * Hash entry 'idx' of the manifest, or compare it to the file if verifying.
+ * Files of the wrong size are rejected without being read.
+ */
+static bool hash_entry(size_t idx, void *arg) {
+	struct hash_ctx *ctx = arg;
+	struct l1_manifest_entry *entry = &ctx->manifest->entries[idx];
+	unsigned int digest_nbytes = ctx->manifest->digest_nbytes;
+
+	unsigned char digest[L1_MAX_HASH_NBYTES];
+	unsigned char *buf = NULL;
+	gcry_md_hd_t hd = NULL;
+	uint64_t size = 0;
+	struct stat st;
+	bool ret = false;
+	int fd;
+
+	if ((fd = openat(ctx->root_fd, entry->path, O_RDONLY | O_CLOEXEC)) < 0) {
+		fprintf(stderr, "Failed to open %s: %s\n", entry->path,
+				strerror(errno));
+		return false;
+	}
+
+	if (fstat(fd, &st)) {
+		fprintf(stderr, "Failed to stat %s: %s\n", entry->path,
+				strerror(errno));
+		goto out;
+	}
+
+	if (!S_ISREG(st.st_mode)) {
+		fprintf(stderr, "Not a regular file: %s\n", entry->path);
+		goto out;
+	}
+
+	if (ctx->verify && (uint64_t) st.st_size != entry->size) {
+		fprintf(stderr, "File does not match manifest: %s\n", entry->path);
+		goto out;
+	}
+
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	if (!(buf = malloc(MANIFEST_BUFFER_LEN))) {
+		fprintf(stderr, "Failed to allocate memory\n");
+		goto out;
+	}
+
+	if (!(hd = l1_gcry_hash_hd_create(ctx->manifest->digest, false))) {
+		goto out;
+	}
+
+	for (;;) {
+		ssize_t len = read(fd, buf, MANIFEST_BUFFER_LEN);
+
+		if (len < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if (len < 0) {
+			fprintf(stderr, "Failed to read %s: %s\n", entry->path,
+					strerror(errno));
+			goto out;
+		}
+
+		if (!len) {
+			break;
+		}
+
+		l1_stats_read(len);
+		gcry_md_write(hd, buf, len);
+		size += len;
+	}
+
+	l1_gcry_hash_read(hd, digest, digest_nbytes);
+
+	if (ctx->verify) {
+		if (size != entry->size
+				|| memcmp(digest, entry->digest, digest_nbytes)) {
+			fprintf(stderr, "File does not match manifest: %s\n",
+					entry->path);
+			goto out;
+		}
+	} else {
+		if (!(entry->digest = malloc(digest_nbytes))) {
+			fprintf(stderr, "Failed to allocate memory\n");
+			goto out;
+		}
+
+		memcpy(entry->digest, digest, digest_nbytes);
+		entry->size = size;
+	}
+
+	ret = true;
+
+out:
+	if (hd) {
+		l1_gcry_hash_hd_destroy(hd);
+	}
+
+	free(buf);
+	close(fd);
+	return ret;
+}
+
+/*
+ * Hash all files of the manifest relative to 'root_fd' on up to 'njobs'
+ * threads.  If 'verify' is set, the files are compared to the manifest
+ * instead, and no further files are read after the first mismatch.
+ */
+bool l1_manifest_hash(struct l1_manifest *manifest, int root_fd,
+		unsigned int njobs, bool verify) {
+	struct hash_ctx ctx = { manifest, root_fd, verify };
+
+	return l1_pool_run(njobs, manifest->nentries, hash_entry, &ctx);
+}
+
+/*
+ * Format the manifest as text.  The entries must be sorted and hashed.
+ */
+char *l1_manifest_format(const struct l1_manifest *manifest, size_t *len) {
+	const char *algo_name = gcry_md_algo_name(manifest->digest);
+	size_t nbytes = strlen(L1_MANIFEST_MAGIC) + strlen(algo_name) + 16;
+	size_t pos;
+	char *buf;
+
+	for (size_t i = 0; i < manifest->nentries; ++i) {
+		nbytes += manifest->digest_nbytes * 2 + 24
+			+ strlen(manifest->entries[i].path);
+	}
+
+	if (!(buf = malloc(nbytes))) {
+		fprintf(stderr, "Failed to allocate memory\n");
+		return NULL;
+	}
+
+	pos = snprintf(buf, nbytes, "%s %d %s\n", L1_MANIFEST_MAGIC,
+			L1_MANIFEST_VERSION, algo_name);
+
+	for (size_t i = 0; i < manifest->nentries; ++i) {
+		const struct l1_manifest_entry *entry = &manifest->entries[i];
+
+		for (unsigned int j = 0; j < manifest->digest_nbytes; ++j) {
+			pos += snprintf(buf + pos, nbytes - pos, "%02x", entry->digest[j]);
+		}
+
+		pos += snprintf(buf + pos, nbytes - pos, " %" PRIu64 " %s\n",
+				entry->size, entry->path);
+	}
+
+	*len = pos;
+	return buf;
+}
+
+static int hex_value(char c) {
+	if (c >= '0' && c <= '9') {
+		return c - '0';
+	}
+
+	if (c >= 'a' && c <= 'f') {
+		return c - 'a' + 10;
+	}
+
+	return -1;
+}
+
+/*
+ * Parse an entry line of 'len' bytes, excluding the newline.
+ */
+static bool parse_entry(struct l1_manifest *manifest, const char *line,
+		size_t len) {
+	size_t hex_len = manifest->digest_nbytes * 2;
+	struct l1_manifest_entry *entry;
+	const char *end = line + len;
+	const char *pos = line + hex_len;
+	uint64_t size = 0;
+	char *path;
+
+	if (len < hex_len + 4 || *pos++ != ' ' || *pos < '0' || *pos > '9') {
+		return false;
+	}
+
+	while (pos < end && *pos >= '0' && *pos <= '9') {
+		if (size > (UINT64_MAX - 9) / 10) {
+			return false;
+		}
+
+		size = size * 10 + (*pos++ - '0');
+	}
+
+	if (pos >= end || *pos++ != ' ' || pos == end
+			|| memchr(pos, '\0', end - pos)) {
+		return false;
+	}
+
+	if (!(path = strndup(pos, end - pos))) {
+		fprintf(stderr, "Failed to allocate memory\n");
+		return false;
+	}
+
+	if (manifest->nentries && strcmp(path,
+				manifest->entries[manifest->nentries - 1].path) <= 0) {
+		free(path);
+		return false;
+	}
+
+	if (!(entry = append_entry(manifest, path))) {
+		return false;
+	}
+
+	entry->size = size;
+
+	if (!(entry->digest = malloc(manifest->digest_nbytes))) {
+		fprintf(stderr, "Failed to allocate memory\n");
+		return false;
+	}
+
+	for (size_t i = 0; i < manifest->digest_nbytes; ++i) {
+		int hi = hex_value(line[2 * i]);
+		int lo = hex_value(line[2 * i + 1]);
+
+		if (hi < 0 || lo < 0) {
+			return false;
+		}
+
+		entry->digest[i] = (hi << 4) | lo;
+	}
+
+	return true;
+}
+
+/*
+ * Parse the text of a manifest into 'manifest', which must be initialized
+ * without a digest algorithm.  Manifests that are not canonical are rejected.
+ */
+bool l1_manifest_parse(struct l1_manifest *manifest, const char *buf,
+		size_t len) {
+	const char *end = buf + len;
+	const char *line = buf;
+	const char *nl = memchr(buf, '\n', len);
+	char header[MANIFEST_HEADER_LEN];
+	char algo_name[MANIFEST_HEADER_LEN];
+	size_t lineno = 1;
+	int version;
+	int pos = 0;
+
+	if (!nl || (size_t) (nl - buf) >= sizeof header) {
+		fprintf(stderr, "Malformed manifest header\n");
+		return false;
+	}
+
+	memcpy(header, buf, nl - buf);
+	header[nl - buf] = '\0';
+
+	if (sscanf(header, L1_MANIFEST_MAGIC " %d %127s%n", &version, algo_name,
+				&pos) != 2 || header[pos] || version != L1_MANIFEST_VERSION) {
+		fprintf(stderr, "Malformed manifest header\n");
+		return false;
+	}
+
+	if (!(manifest->digest = gcry_md_map_name(algo_name))) {
+		fprintf(stderr, "Unknown hash algorithm in manifest: %s\n",
+				algo_name);
+		return false;
+	}
+
+	manifest->digest_nbytes = l1_gcry_hash_nbytes(manifest->digest);
+
+	if (l1_gcry_check_hash(manifest->digest, manifest->digest_nbytes)) {
+		return false;
+	}
+
+	for (line = nl + 1; line < end; line = nl + 1) {
+		++lineno;
+
+		if (!(nl = memchr(line, '\n', end - line))
+				|| !parse_entry(manifest, line, nl - line)) {
+			fprintf(stderr, "Malformed manifest entry (line %zu)\n", lineno);
+			return false;
+		}
+	}
+
+	return true;
+}
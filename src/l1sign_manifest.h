@@ -0,0 +1,76 @@
+/*
+ * l1sign - Implementation of the Lamport-Diffie one-time signature scheme
+ * Copyright (c) 2019  Janik Rabe <info@janikrabe.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef L1SIGN_MANIFEST_H
+#define L1SIGN_MANIFEST_H
+
+#include <config.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#define L1_MANIFEST_MAGIC "l1sign-manifest"
+#define L1_MANIFEST_VERSION 1
+
+/*
+ * A manifest lists the regular files of a tree, sorted by path, along with
+ * their sizes and message digests.  Its text form is canonical, so that the
+ * same tree always produces the same manifest:
+ *
+ *     l1sign-manifest 1 <digest algorithm>
+ *     <hex digest> <size> <path>
+ *     ...
+ *
+ * Paths are relative to the root of the tree and must not contain newlines.
+ */
+struct l1_manifest_entry {
+	char *path;
+	uint64_t size;
+	unsigned char *digest;
+};
+
+struct l1_manifest {
+	int digest;
+	unsigned int digest_nbytes;
+	struct l1_manifest_entry *entries;
+	size_t nentries;
+	size_t capacity;
+	dev_t exclude_dev[2];
+	ino_t exclude_ino[2];
+	unsigned int nexclude;
+};
+
+void l1_manifest_init(struct l1_manifest *manifest, int digest);
+void l1_manifest_free(struct l1_manifest *manifest);
+void l1_manifest_exclude(struct l1_manifest *manifest, const char *filename);
+bool l1_manifest_add(struct l1_manifest *manifest, const char *path);
+bool l1_manifest_walk(struct l1_manifest *manifest, const char *dirname);
+bool l1_manifest_read_list(struct l1_manifest *manifest, FILE *in);
+int l1_manifest_collect(struct l1_manifest *manifest, const char *dirname);
+bool l1_manifest_sort(struct l1_manifest *manifest);
+bool l1_manifest_compare_paths(const struct l1_manifest *expected,
+		const struct l1_manifest *actual);
+bool l1_manifest_hash(struct l1_manifest *manifest, int root_fd,
+		unsigned int njobs, bool verify);
+char *l1_manifest_format(const struct l1_manifest *manifest, size_t *len);
+bool l1_manifest_parse(struct l1_manifest *manifest, const char *buf,
+		size_t len);
+
+#endif
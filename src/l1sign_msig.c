@@ -0,0 +1,93 @@
+/*
+ * l1sign - Implementation of the Lamport-Diffie one-time signature scheme
+ * Copyright (c) 2019  Janik Rabe <info@janikrabe.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "l1sign_msig.h"
+
+#include "l1sign_gcrypt.h"
+#include "l1sign_util.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define OFF_VERSION 8
+#define OFF_NSIGS 12
+#define OFF_SIG_NBYTES 16
+#define OFF_ALGO 20
+#define OFF_DIGEST (OFF_ALGO + L1_MSIG_ALGO_NAME_LEN)
+
+/*
+ * Encode the header of a multi-signature file into 'buf', which must hold
+ * L1_MSIG_HEADER_NBYTES bytes.
+ */
+void l1_msig_encode_header(const struct l1_msig *msig, unsigned char *buf) {
+	memset(buf, 0, L1_MSIG_HEADER_NBYTES);
+	memcpy(buf, L1_MSIG_MAGIC, strlen(L1_MSIG_MAGIC));
+
+	l1_put_le32(buf + OFF_VERSION, L1_MSIG_VERSION);
+	l1_put_le32(buf + OFF_NSIGS, msig->nsigs);
+	l1_put_le32(buf + OFF_SIG_NBYTES, msig->sig_nbytes);
+	strncpy((char *) buf + OFF_ALGO, gcry_md_algo_name(msig->algo),
+			L1_MSIG_ALGO_NAME_LEN - 1);
+	strncpy((char *) buf + OFF_DIGEST, gcry_md_algo_name(msig->digest),
+			L1_MSIG_ALGO_NAME_LEN - 1);
+}
+
+/*
+ * Map the NUL-padded algorithm name at 'name' to an algorithm.
+ */
+static int decode_algo(const unsigned char *name, const char *desc) {
+	char algo_name[L1_MSIG_ALGO_NAME_LEN + 1] = { 0 };
+	int algo;
+
+	memcpy(algo_name, name, L1_MSIG_ALGO_NAME_LEN);
+
+	if (!(algo = gcry_md_map_name(algo_name))) {
+		fprintf(stderr, "Unknown hash algorithm in %s: %s\n", desc, algo_name);
+	}
+
+	return algo;
+}
+
+bool l1_msig_decode_header(struct l1_msig *msig, const unsigned char *buf,
+		const char *desc) {
+	if (memcmp(buf, L1_MSIG_MAGIC, strlen(L1_MSIG_MAGIC))) {
+		fprintf(stderr, "The %s is not a multi-signature file\n", desc);
+		return false;
+	}
+
+	if (l1_get_le32(buf + OFF_VERSION) != L1_MSIG_VERSION) {
+		fprintf(stderr, "Unsupported format version %u of %s\n",
+				l1_get_le32(buf + OFF_VERSION), desc);
+		return false;
+	}
+
+	if (!(msig->algo = decode_algo(buf + OFF_ALGO, desc))
+			|| !(msig->digest = decode_algo(buf + OFF_DIGEST, desc))) {
+		return false;
+	}
+
+	msig->nsigs = l1_get_le32(buf + OFF_NSIGS);
+	msig->sig_nbytes = l1_get_le32(buf + OFF_SIG_NBYTES);
+
+	if (!msig->nsigs || msig->nsigs > L1_MSIG_MAX_NSIGS) {
+		fprintf(stderr, "Invalid number of signatures in %s\n", desc);
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,59 @@
+/*
+ * l1sign - Implementation of the Lamport-Diffie one-time signature scheme
+ * Copyright (c) 2019  Janik Rabe <info@janikrabe.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef L1SIGN_MSIG_H
+#define L1SIGN_MSIG_H
+
+#include <config.h>
+
+#include <stdbool.h>
+
+#define L1_MSIG_MAGIC "L1MULSIG"
+#define L1_MSIG_VERSION 1
+#define L1_MSIG_HEADER_NBYTES 96
+#define L1_MSIG_ALGO_NAME_LEN 32
+#define L1_MSIG_MAX_NSIGS 4096
+
+/*
+ * A multi-signature file holds the signatures of several keys for the same
+ * message.  It consists of a header of L1_MSIG_HEADER_NBYTES bytes followed by
+ * 'nsigs' signatures of 'sig_nbytes' bytes each.  All integers in the header
+ * are stored in little-endian byte order:
+ *
+ *     0  magic                 8 bytes
+ *     8  version               uint32
+ *    12  number of signatures  uint32
+ *    16  signature size        uint32
+ *    20  hash algorithm        L1_MSIG_ALGO_NAME_LEN bytes, NUL-padded name
+ *    52  message digest        L1_MSIG_ALGO_NAME_LEN bytes, NUL-padded name
+ *
+ * The remainder of the header is zero.  Signatures are not tied to keys in
+ * the file; the first block of a signature identifies the key.
+ */
+struct l1_msig {
+	int digest;
+	int algo;
+	unsigned int nsigs;
+	unsigned int sig_nbytes;
+};
+
+void l1_msig_encode_header(const struct l1_msig *msig, unsigned char *buf);
+bool l1_msig_decode_header(struct l1_msig *msig, const unsigned char *buf,
+		const char *desc);
+
+#endif
@@ -0,0 +1,248 @@
+/*
+ * l1sign - Implementation of the Lamport-Diffie one-time signature scheme
+ * Copyright (c) 2019  Janik Rabe <info@janikrabe.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "l1sign_ots.h"
+
+#include "l1sign_probe.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef HAVE_AVX2_DISPATCH
+#	include <immintrin.h>
+#elif defined(__SSE2__)
+#	include <emmintrin.h>
+#endif
+
+/*
+ * Hash a single key or signature block into 'out'.
+ */
+bool l1_ots_hash_block(struct l1_hash *hash, const void *block,
+		unsigned int hash_nbytes, void *out) {
+	return l1_hash_digest(hash, block, hash_nbytes, out);
+}
+
+/*
+ * Derive 'nblocks' public key blocks from the secret key blocks in 'sec'.
+ */
+bool l1_ots_pubkey(struct l1_hash *hash, const unsigned char *sec,
+		unsigned char *pub, unsigned int hash_nbytes, unsigned int nblocks) {
+	for (unsigned int i = 0; i < nblocks; ++i) {
+		size_t offset = (size_t) hash_nbytes * i;
+
+		if (!l1_ots_hash_block(hash, sec + offset, hash_nbytes,
+					pub + offset)) {
+			return false;
+		}
+
+		L1_PROBE1(pubkey_block, i);
+	}
+
+	return true;
+}
+
+/*
+ * Mask of all ones if bit 'i' of 'digest' is set and all zeros otherwise.
+ */
+static inline unsigned char digest_mask(const unsigned char *digest,
+		unsigned int i) {
+	return -((digest[i / 8] >> (7 - i % 8)) & 1);
+}
+
+/*
+ * Select the first or (if 'mask' is all ones) the second of the two blocks at
+ * 'pair' into 'dst', eight bytes at a time.  Blocks that are not a multiple of
+ * eight bytes long end with a word that overlaps the one before it.
+ */
+static inline void select_words(const unsigned char *pair, unsigned char *dst,
+		unsigned int hash_nbytes, unsigned char mask) {
+	uint64_t wmask = -(uint64_t) (mask & 1);
+
+	if (hash_nbytes < 8) {
+		for (unsigned int j = 0; j < hash_nbytes; ++j) {
+			dst[j] = pair[j] ^ ((pair[j] ^ pair[hash_nbytes + j]) & mask);
+		}
+
+		return;
+	}
+
+	for (unsigned int j = 0; j < hash_nbytes; j += 8) {
+		uint64_t a, b;
+
+		if (j + 8 > hash_nbytes) {
+			j = hash_nbytes - 8;
+		}
+
+		memcpy(&a, pair + j, 8);
+		memcpy(&b, pair + hash_nbytes + j, 8);
+		a ^= (a ^ b) & wmask;
+		memcpy(dst + j, &a, 8);
+	}
+}
+
+#ifdef __SSE2__
+static void select_sse2(const unsigned char *key,
+		const unsigned char *digest, unsigned int hash_nbytes,
+		unsigned int nbits, unsigned char *out) {
+	for (unsigned int i = 0; i < nbits; ++i) {
+		const unsigned char *pair = key + (size_t) hash_nbytes * 2 * i;
+		unsigned char *dst = out + (size_t) hash_nbytes * i;
+		unsigned char mask = digest_mask(digest, i);
+		__m128i vmask = _mm_set1_epi8((char) mask);
+
+		if (hash_nbytes < 16) {
+			select_words(pair, dst, hash_nbytes, mask);
+			continue;
+		}
+
+		for (unsigned int j = 0; j < hash_nbytes; j += 16) {
+			if (j + 16 > hash_nbytes) {
+				j = hash_nbytes - 16;
+			}
+
+			__m128i a = _mm_loadu_si128((const __m128i *) (pair + j));
+			__m128i b = _mm_loadu_si128(
+					(const __m128i *) (pair + hash_nbytes + j));
+
+			a = _mm_xor_si128(a, _mm_and_si128(_mm_xor_si128(a, b), vmask));
+			_mm_storeu_si128((__m128i *) (dst + j), a);
+		}
+	}
+}
+#else
+static void select_generic(const unsigned char *key,
+		const unsigned char *digest, unsigned int hash_nbytes,
+		unsigned int nbits, unsigned char *out) {
+	for (unsigned int i = 0; i < nbits; ++i) {
+		select_words(key + (size_t) hash_nbytes * 2 * i,
+				out + (size_t) hash_nbytes * i, hash_nbytes,
+				digest_mask(digest, i));
+	}
+}
+#endif
+
+#ifdef HAVE_AVX2_DISPATCH
+/*
+ * Only called for blocks of at least 32 bytes.
+ */
+__attribute__((target("avx2")))
+static void select_avx2(const unsigned char *key,
+		const unsigned char *digest, unsigned int hash_nbytes,
+		unsigned int nbits, unsigned char *out) {
+	for (unsigned int i = 0; i < nbits; ++i) {
+		const unsigned char *pair = key + (size_t) hash_nbytes * 2 * i;
+		unsigned char *dst = out + (size_t) hash_nbytes * i;
+		__m256i vmask = _mm256_set1_epi8((char) digest_mask(digest, i));
+
+		for (unsigned int j = 0; j < hash_nbytes; j += 32) {
+			if (j + 32 > hash_nbytes) {
+				j = hash_nbytes - 32;
+			}
+
+			__m256i a = _mm256_loadu_si256((const __m256i *) (pair + j));
+			__m256i b = _mm256_loadu_si256(
+					(const __m256i *) (pair + hash_nbytes + j));
+
+			a = _mm256_xor_si256(a,
+					_mm256_and_si256(_mm256_xor_si256(a, b), vmask));
+			_mm256_storeu_si256((__m256i *) (dst + j), a);
+		}
+	}
+}
+#endif
+
+/*
+ * Copy the key block selected by each of the 'nbits' bits of 'digest' from
+ * the in-memory key 'key' to consecutive slots of 'out'.  The i-th bit selects
+ * block 2 * i + bit.
+ *
+ * Both blocks of every pair are read and combined with a mask derived from
+ * the digest bit, so neither the branches taken nor the memory accessed
+ * depend on the digest.  The widest kernel the CPU supports is picked at run
+ * time.
+ */
+void l1_ots_select(const unsigned char *key, const unsigned char *digest,
+		unsigned int hash_nbytes, unsigned int nbits, unsigned char *out) {
+#ifdef HAVE_AVX2_DISPATCH
+	if (hash_nbytes >= 32 && __builtin_cpu_supports("avx2")) {
+		select_avx2(key, digest, hash_nbytes, nbits, out);
+		return;
+	}
+#endif
+#ifdef __SSE2__
+	select_sse2(key, digest, hash_nbytes, nbits, out);
+#else
+	select_generic(key, digest, hash_nbytes, nbits, out);
+#endif
+}
+
+/*
+ * Check whether each signature block in 'sig' hashes to the corresponding
+ * selected public key block in 'pub'.  A block that cannot be hashed is
+ * invalid.
+ */
+bool l1_ots_verify(struct l1_hash *hash, const unsigned char *sig,
+		const unsigned char *pub, unsigned int hash_nbytes,
+		unsigned int nbits) {
+	unsigned char block[L1_MAX_HASH_NBYTES];
+	bool valid = true;
+
+	for (unsigned int i = 0; i < nbits; ++i) {
+		size_t offset = (size_t) hash_nbytes * i;
+
+		if (!l1_ots_hash_block(hash, sig + offset, hash_nbytes, block)
+				|| memcmp(block, pub + offset, hash_nbytes)) {
+			valid = false;
+		}
+
+		L1_PROBE2(verify_block, i, valid);
+	}
+
+	return valid;
+}
+
+/*
+ * Recover the message digest that signature 'sig' was created for from the
+ * complete public key 'pub', without the message.  The digest is written to
+ * 'digest' (nbits / 8 bytes).  Returns false if the signature is invalid or
+ * cannot be hashed.
+ */
+bool l1_ots_recover(struct l1_hash *hash, const unsigned char *sig,
+		const unsigned char *pub, unsigned int hash_nbytes,
+		unsigned int nbits, unsigned char *digest) {
+	unsigned char block[L1_MAX_HASH_NBYTES];
+
+	memset(digest, 0, nbits / 8);
+
+	for (unsigned int i = 0; i < nbits; ++i) {
+		const unsigned char *pair = pub + (size_t) hash_nbytes * 2 * i;
+
+		if (!l1_ots_hash_block(hash, sig + (size_t) hash_nbytes * i,
+					hash_nbytes, block)) {
+			return false;
+		}
+
+		if (!memcmp(block, pair + hash_nbytes, hash_nbytes)) {
+			digest[i / 8] |= 1 << (7 - i % 8);
+		} else if (memcmp(block, pair, hash_nbytes)) {
+			return false;
+		}
+	}
+
+	return true;
+}
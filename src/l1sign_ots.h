@@ -0,0 +1,40 @@
+/*
+ * l1sign - Implementation of the Lamport-Diffie one-time signature scheme
+ * Copyright (c) 2019  Janik Rabe <info@janikrabe.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef L1SIGN_OTS_H
+#define L1SIGN_OTS_H
+
+#include "l1sign_gcrypt.h"
+#include "l1sign_hash.h"
+
+#include <stdbool.h>
+
+bool l1_ots_hash_block(struct l1_hash *hash, const void *block,
+		unsigned int hash_nbytes, void *out);
+bool l1_ots_pubkey(struct l1_hash *hash, const unsigned char *sec,
+		unsigned char *pub, unsigned int hash_nbytes, unsigned int nblocks);
+void l1_ots_select(const unsigned char *key, const unsigned char *digest,
+		unsigned int hash_nbytes, unsigned int nbits, unsigned char *out);
+bool l1_ots_verify(struct l1_hash *hash, const unsigned char *sig,
+		const unsigned char *pub, unsigned int hash_nbytes,
+		unsigned int nbits);
+bool l1_ots_recover(struct l1_hash *hash, const unsigned char *sig,
+		const unsigned char *pub, unsigned int hash_nbytes,
+		unsigned int nbits, unsigned char *digest);
+
+#endif
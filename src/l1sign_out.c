@@ -0,0 +1,224 @@
+/*
+ * l1sign - Implementation of the Lamport-Diffie one-time signature scheme
+ * Copyright (c) 2019  Janik Rabe <info@janikrabe.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "l1sign_out.h"
+
+#include "l1sign_stats.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+/*
+ * Open 'filename' for writing, or standard output if 'filename' is NULL.  The
+ * file is created with the permissions allowed by the current umask.
+ */
+bool l1_out_open(struct l1_out *out, const char *filename) {
+	struct stat st;
+	mode_t mask;
+
+	out->filename = NULL;
+	out->tmp_filename = NULL;
+	out->fd = STDOUT_FILENO;
+
+	if (!filename) {
+		return true;
+	}
+
+	if (!(out->filename = strdup(filename))) {
+		return false;
+	}
+
+	if (!lstat(filename, &st) && !S_ISREG(st.st_mode)) {
+		if ((out->fd = open(filename, O_WRONLY | O_TRUNC | O_CLOEXEC)) < 0) {
+			int err = errno;
+
+			free(out->filename);
+			errno = err;
+			return false;
+		}
+
+		return true;
+	}
+
+	size_t len = strlen(filename) + sizeof ".XXXXXX";
+
+	if (!(out->tmp_filename = malloc(len))) {
+		free(out->filename);
+		return false;
+	}
+
+	snprintf(out->tmp_filename, len, "%s.XXXXXX", filename);
+
+	mask = umask(0);
+	umask(mask);
+
+	if ((out->fd = mkstemp(out->tmp_filename)) < 0) {
+		free(out->filename);
+		free(out->tmp_filename);
+		return false;
+	}
+
+	if (fchmod(out->fd, 0666 & ~mask)) {
+		int err = errno;
+
+		l1_out_abort(out);
+		errno = err;
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Write to the open descriptor 'fd', which is left open when the output is
+ * committed or discarded, like standard output.
+ */
+void l1_out_open_fd(struct l1_out *out, int fd) {
+	out->filename = NULL;
+	out->tmp_filename = NULL;
+	out->fd = fd;
+}
+
+bool l1_out_write(struct l1_out *out, const void *buf, size_t nbytes) {
+	struct iovec iov = { (void *) buf, nbytes };
+
+	return l1_out_writev(out, &iov, 1);
+}
+
+/*
+ * Write up to L1_OUT_MAX_IOV buffers with a single call unless the system
+ * performs a partial write.
+ */
+bool l1_out_writev(struct l1_out *out, const struct iovec *iov, int iovcnt) {
+	struct iovec vec[L1_OUT_MAX_IOV];
+	struct iovec *pos = vec;
+	size_t nbytes = 0;
+	bool ret = true;
+
+	if (iovcnt > L1_OUT_MAX_IOV) {
+		errno = EINVAL;
+		return false;
+	}
+
+	memcpy(vec, iov, iovcnt * sizeof *iov);
+
+	while (iovcnt && !pos->iov_len) {
+		++pos;
+		--iovcnt;
+	}
+
+	while (iovcnt) {
+		ssize_t len = writev(out->fd, pos, iovcnt);
+
+		if (len < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if (len <= 0) {
+			ret = false;
+			break;
+		}
+
+		nbytes += len;
+
+		while (iovcnt && (size_t) len >= pos->iov_len) {
+			len -= pos->iov_len;
+			++pos;
+			--iovcnt;
+		}
+
+		if (iovcnt) {
+			pos->iov_base = (char *) pos->iov_base + len;
+			pos->iov_len -= len;
+		}
+	}
+
+	l1_stats_write(nbytes);
+	return ret;
+}
+
+/*
+ * Flush the output to disk and move it into place.  The output is discarded
+ * if this fails.  Files that are written to directly are only flushed if they
+ * are regular files.
+ */
+bool l1_out_commit(struct l1_out *out) {
+	struct stat st;
+	bool ret;
+
+	if (!out->filename) {
+		return true;
+	}
+
+	if (!out->tmp_filename) {
+		ret = fstat(out->fd, &st) || !S_ISREG(st.st_mode) || !fsync(out->fd);
+
+		if (close(out->fd)) {
+			ret = false;
+		}
+
+		free(out->filename);
+		return ret;
+	}
+
+	ret = !fsync(out->fd);
+
+	if (close(out->fd)) {
+		ret = false;
+	}
+
+	if (ret && rename(out->tmp_filename, out->filename)) {
+		ret = false;
+	}
+
+	if (!ret) {
+		int err = errno;
+
+		unlink(out->tmp_filename);
+		errno = err;
+	}
+
+	free(out->filename);
+	free(out->tmp_filename);
+	return ret;
+}
+
+/*
+ * Discard the output.  The named file, if any, is left unchanged unless it is
+ * written to directly.
+ */
+void l1_out_abort(struct l1_out *out) {
+	if (!out->filename) {
+		return;
+	}
+
+	close(out->fd);
+
+	if (out->tmp_filename) {
+		unlink(out->tmp_filename);
+	}
+
+	free(out->filename);
+	free(out->tmp_filename);
+}
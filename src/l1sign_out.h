@@ -0,0 +1,48 @@
+/*
+ * l1sign - Implementation of the Lamport-Diffie one-time signature scheme
+ * Copyright (c) 2019  Janik Rabe <info@janikrabe.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef L1SIGN_OUT_H
+#define L1SIGN_OUT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+#define L1_OUT_MAX_IOV 4
+
+/*
+ * An output file that is written with a single call to l1_out_write().
+ * Named files that do not exist yet or are regular files are written to a
+ * temporary file in the same directory, which replaces the named file when
+ * the output is committed.  Other files, such as FIFOs, devices, and symbolic
+ * links, are written to directly; 'tmp_filename' is NULL for them.
+ */
+struct l1_out {
+	char *filename;
+	char *tmp_filename;
+	int fd;
+};
+
+bool l1_out_open(struct l1_out *out, const char *filename);
+void l1_out_open_fd(struct l1_out *out, int fd);
+bool l1_out_write(struct l1_out *out, const void *buf, size_t nbytes);
+bool l1_out_writev(struct l1_out *out, const struct iovec *iov, int iovcnt);
+bool l1_out_commit(struct l1_out *out);
+void l1_out_abort(struct l1_out *out);
+
+#endif
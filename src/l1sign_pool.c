@@ -0,0 +1,104 @@
+/*
+ * l1sign - Implementation of the Lamport-Diffie one-time signature scheme
+ * Copyright (c) 2019  Janik Rabe <info@janikrabe.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "l1sign_pool.h"
+
+#include <unistd.h>
+
+#ifdef HAVE_PTHREAD
+#	include <pthread.h>
+#	include <stdlib.h>
+#endif
+
+struct pool {
+	size_t next;
+	size_t ntasks;
+	l1_pool_task_fn task;
+	void *arg;
+	bool ok;
+};
+
+/*
+ * Take tasks from the pool until there are none left or a task fails.
+ */
+static void *pool_worker(void *arg) {
+	struct pool *pool = arg;
+
+	while (__atomic_load_n(&pool->ok, __ATOMIC_RELAXED)) {
+		size_t idx = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED);
+
+		if (idx >= pool->ntasks) {
+			break;
+		}
+
+		if (!pool->task(idx, pool->arg)) {
+			__atomic_store_n(&pool->ok, false, __ATOMIC_RELAXED);
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * The number of jobs used if --jobs is not specified.
+ */
+unsigned int l1_pool_default_jobs(void) {
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return ncpus > 0 ? ncpus : 1;
+}
+
+/*
+ * Run 'ntasks' tasks on up to 'njobs' threads, including the calling thread.
+ * Tasks are started in order of their index.  Returns false if any task
+ * failed.  Without thread support, all tasks run on the calling thread.
+ */
+bool l1_pool_run(unsigned int njobs, size_t ntasks, l1_pool_task_fn task,
+		void *arg) {
+	struct pool pool = { 0, ntasks, task, arg, true };
+
+#ifdef HAVE_PTHREAD
+	pthread_t *threads = NULL;
+	size_t nthreads = 0;
+
+	if (njobs > ntasks) {
+		njobs = ntasks;
+	}
+
+	if (njobs > 1 && (threads = calloc(njobs - 1, sizeof *threads))) {
+		while (nthreads < njobs - 1 && !pthread_create(&threads[nthreads],
+					NULL, pool_worker, &pool)) {
+			++nthreads;
+		}
+	}
+
+	pool_worker(&pool);
+
+	for (size_t i = 0; i < nthreads; ++i) {
+		pthread_join(threads[i], NULL);
+	}
+
+	free(threads);
+#else
+	(void) njobs;
+
+	pool_worker(&pool);
+#endif
+
+	return pool.ok;
+}
@@ -0,0 +1,37 @@
+/*
+ * l1sign - Implementation of the Lamport-Diffie one-time signature scheme
+ * Copyright (c) 2019  Janik Rabe <info@janikrabe.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef L1SIGN_POOL_H
+#define L1SIGN_POOL_H
+
+#include <config.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Invoked once for each task index.  Returning false stops the pool from
+ * starting further tasks; tasks that are already running are completed.
+ */
+typedef bool (*l1_pool_task_fn)(size_t idx, void *arg);
+
+unsigned int l1_pool_default_jobs(void);
+bool l1_pool_run(unsigned int njobs, size_t ntasks, l1_pool_task_fn task,
+		void *arg);
+
+#endif
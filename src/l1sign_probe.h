@@ -0,0 +1,42 @@
+/*
+ * l1sign - Implementation of the Lamport-Diffie one-time signature scheme
+ * Copyright (c) 2019  Janik Rabe <info@janikrabe.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef L1SIGN_PROBE_H
+#define L1SIGN_PROBE_H
+
+#include <config.h>
+
+/*
+ * Static tracepoints (USDT probes) of provider "l1sign", which tools such as
+ * bpftrace and SystemTap can attach to.  They are built with --enable-usdt,
+ * in which case each probe is a single no-op instruction until a tracer
+ * attaches to it, and expand to nothing otherwise.
+ */
+#ifdef ENABLE_USDT
+#	include <sys/sdt.h>
+
+#	define L1_PROBE1(name, a) STAP_PROBE1(l1sign, name, a)
+#	define L1_PROBE2(name, a, b) STAP_PROBE2(l1sign, name, a, b)
+#	define L1_PROBE3(name, a, b, c) STAP_PROBE3(l1sign, name, a, b, c)
+#else
+#	define L1_PROBE1(name, a) do { } while (0)
+#	define L1_PROBE2(name, a, b) do { } while (0)
+#	define L1_PROBE3(name, a, b, c) do { } while (0)
+#endif
+
+#endif
@@ -0,0 +1,335 @@
+/*
+ * l1sign - Implementation of the Lamport-Diffie one-time signature scheme
+ * Copyright (c) 2019  Janik Rabe <info@janikrabe.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "l1sign_stats.h"
+
+#include "l1sign_probe.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct l1_stats l1_stats;
+
+static const char *phase_names[L1_PHASE_COUNT] = {
+	"setup",
+	"random",
+	"message_hash",
+	"key_read",
+	"block_hash",
+	"write",
+};
+
+static double elapsed(const struct timespec *from, const struct timespec *to) {
+	return (to->tv_sec - from->tv_sec) + (to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+void l1_stats_start(void) {
+	l1_stats.enabled = true;
+	l1_stats.phase = L1_PHASE_SETUP;
+
+	clock_gettime(CLOCK_MONOTONIC, &l1_stats.phase_wall);
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &l1_stats.phase_cpu);
+}
+
+/*
+ * Attribute the time since the last phase change to the current phase and
+ * switch to 'phase'.  Returns the previous phase, so that nested operations
+ * can switch back to it.
+ */
+enum l1_stats_phase l1_stats_phase(enum l1_stats_phase phase) {
+	enum l1_stats_phase prev = l1_stats.phase;
+	struct timespec wall;
+	struct timespec cpu;
+
+	L1_PROBE2(phase, phase_names[prev], phase_names[phase]);
+
+	if (!l1_stats.enabled) {
+		l1_stats.phase = phase;
+		return prev;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &wall);
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu);
+
+	l1_stats.phases[prev].wall += elapsed(&l1_stats.phase_wall, &wall);
+	l1_stats.phases[prev].cpu += elapsed(&l1_stats.phase_cpu, &cpu);
+
+	l1_stats.phase = phase;
+	l1_stats.phase_wall = wall;
+	l1_stats.phase_cpu = cpu;
+
+	return prev;
+}
+
+/*
+ * I/O may be performed by several threads at once, so the I/O counters are
+ * updated atomically.  Phase changes are only made by the main thread.
+ */
+void l1_stats_read(size_t nbytes) {
+	__atomic_add_fetch(&l1_stats.bytes_read, nbytes, __ATOMIC_RELAXED);
+}
+
+void l1_stats_write(size_t nbytes) {
+	__atomic_add_fetch(&l1_stats.bytes_written, nbytes, __ATOMIC_RELAXED);
+}
+
+void l1_stats_secmem(size_t alloc_nbytes, size_t free_nbytes) {
+	l1_stats.secmem_nbytes += alloc_nbytes;
+	l1_stats.secmem_nbytes -= free_nbytes;
+
+	if (l1_stats.secmem_nbytes > l1_stats.secmem_high_water) {
+		l1_stats.secmem_high_water = l1_stats.secmem_nbytes;
+	}
+}
+
+/*
+ * Resource usage of the process, collected before any statistics are
+ * written so that the report does not count itself.
+ */
+struct report_usage {
+	struct rusage rusage;
+	bool syscalls;
+	unsigned long long syscr;
+	unsigned long long syscw;
+};
+
+/*
+ * Count the read and write system calls of the process from /proc/self/io,
+ * which includes those made by libraries and the C library's buffering.
+ * Returns false if the counters are not available.
+ */
+static bool read_syscalls(unsigned long long *syscr,
+		unsigned long long *syscw) {
+	FILE *in = fopen("/proc/self/io", "r");
+	char line[64];
+	int found = 0;
+
+	if (!in) {
+		return false;
+	}
+
+	while (fgets(line, sizeof line, in)) {
+		found += sscanf(line, "syscr: %llu", syscr) == 1;
+		found += sscanf(line, "syscw: %llu", syscw) == 1;
+	}
+
+	fclose(in);
+	return found == 2;
+}
+
+/*
+ * Write 's' as a JSON string, escaping quotes, backslashes, and control
+ * characters.
+ */
+static void json_string(FILE *out, const char *s) {
+	fputc('"', out);
+
+	for (; *s; ++s) {
+		unsigned char c = *s;
+
+		if (c == '"' || c == '\\') {
+			fprintf(out, "\\%c", c);
+		} else if (c < 0x20) {
+			fprintf(out, "\\u%04x", c);
+		} else {
+			fputc(c, out);
+		}
+	}
+
+	fputc('"', out);
+}
+
+/*
+ * Write 's' as a Prometheus label value, escaping quotes, backslashes, and
+ * line feeds.
+ */
+static void label_value(FILE *out, const char *s) {
+	fputc('"', out);
+
+	for (; *s; ++s) {
+		if (*s == '"' || *s == '\\') {
+			fprintf(out, "\\%c", *s);
+		} else if (*s == '\n') {
+			fputs("\\n", out);
+		} else {
+			fputc(*s, out);
+		}
+	}
+
+	fputc('"', out);
+}
+
+static void report_json(FILE *out, const char *command, const char *hash,
+		const struct report_usage *usage) {
+
+	fputs("{\"command\":", out);
+	json_string(out, command);
+	fputs(",\"hash\":", out);
+	json_string(out, hash);
+	fputs(",\"phases\":{", out);
+
+	for (int i = 0; i < L1_PHASE_COUNT; ++i) {
+		fprintf(out, "%s\"%s\":{\"wall_seconds\":%.9f,\"cpu_seconds\":%.9f}",
+				i ? "," : "", phase_names[i],
+				l1_stats.phases[i].wall, l1_stats.phases[i].cpu);
+	}
+
+	fprintf(out, "},\"bytes_read\":%llu,\"bytes_written\":%llu,",
+			(unsigned long long) l1_stats.bytes_read,
+			(unsigned long long) l1_stats.bytes_written);
+
+	if (usage->syscalls) {
+		fprintf(out, "\"read_syscalls\":%llu,\"write_syscalls\":%llu,",
+				usage->syscr, usage->syscw);
+	}
+
+	fprintf(out, "\"block_hashes\":%llu,\"secmem_high_water_bytes\":%zu,"
+			"\"max_rss_kib\":%ld}\n",
+			(unsigned long long) l1_stats.block_hashes,
+			l1_stats.secmem_high_water,
+			usage->rusage.ru_maxrss);
+}
+
+static void report_metric(FILE *out, const char *name, const char *help,
+		const char *command, const char *hash, double value) {
+	fprintf(out, "# HELP l1sign_%s %s\n", name, help);
+	fprintf(out, "# TYPE l1sign_%s gauge\n", name);
+	fprintf(out, "l1sign_%s{command=", name);
+	label_value(out, command);
+	fputs(",hash=", out);
+	label_value(out, hash);
+	fprintf(out, "} %.9g\n", value);
+}
+
+static void report_prometheus(FILE *out, const char *command,
+		const char *hash, const struct report_usage *usage) {
+	const char *kinds[] = { "wall", "cpu" };
+
+	for (int k = 0; k < 2; ++k) {
+		fprintf(out, "# HELP l1sign_phase_%s_seconds "
+				"%s time spent in each phase of the last run\n",
+				kinds[k], k ? "CPU" : "Wall clock");
+		fprintf(out, "# TYPE l1sign_phase_%s_seconds gauge\n", kinds[k]);
+
+		for (int i = 0; i < L1_PHASE_COUNT; ++i) {
+			fprintf(out, "l1sign_phase_%s_seconds{command=", kinds[k]);
+			label_value(out, command);
+			fputs(",hash=", out);
+			label_value(out, hash);
+			fprintf(out, ",phase=\"%s\"} %.9f\n", phase_names[i],
+					k ? l1_stats.phases[i].cpu : l1_stats.phases[i].wall);
+		}
+	}
+
+	report_metric(out, "read_bytes", "Bytes read in the last run",
+			command, hash, l1_stats.bytes_read);
+	report_metric(out, "written_bytes", "Bytes written in the last run",
+			command, hash, l1_stats.bytes_written);
+
+	if (usage->syscalls) {
+		report_metric(out, "read_syscalls",
+				"Read system calls in the last run", command, hash,
+				usage->syscr);
+		report_metric(out, "write_syscalls",
+				"Write system calls in the last run", command, hash,
+				usage->syscw);
+	}
+
+	report_metric(out, "block_hashes", "Block hashes in the last run",
+			command, hash, l1_stats.block_hashes);
+	report_metric(out, "secmem_high_water_bytes",
+			"Peak secure memory used for buffers in the last run",
+			command, hash, l1_stats.secmem_high_water);
+	report_metric(out, "max_rss_bytes",
+			"Peak resident set size of the last run",
+			command, hash, usage->rusage.ru_maxrss * 1024.0);
+}
+
+/*
+ * Write the statistics to 'filename', or to standard error if it is "-".
+ * Regular files are replaced atomically, so that collectors never see partial
+ * output; other files, such as FIFOs, are written to directly.
+ */
+bool l1_stats_report(const char *filename, enum l1_stats_format format,
+		const char *command, const char *hash) {
+	struct report_usage usage = { 0 };
+	char *tmp_filename = NULL;
+	FILE *out = stderr;
+	struct stat st;
+	bool ret = true;
+
+	l1_stats_phase(l1_stats.phase);
+	getrusage(RUSAGE_SELF, &usage.rusage);
+	usage.syscalls = read_syscalls(&usage.syscr, &usage.syscw);
+
+	if (strcmp(filename, "-") && !lstat(filename, &st)
+			&& !S_ISREG(st.st_mode)) {
+		if (!(out = fopen(filename, "w"))) {
+			perror("Failed to open statistics file");
+			return false;
+		}
+	} else if (strcmp(filename, "-")) {
+		size_t len = strlen(filename) + sizeof ".XXXXXX";
+		int fd;
+
+		if (!(tmp_filename = malloc(len))) {
+			fprintf(stderr, "Failed to allocate memory\n");
+			return false;
+		}
+
+		snprintf(tmp_filename, len, "%s.XXXXXX", filename);
+
+		if ((fd = mkstemp(tmp_filename)) < 0 || fchmod(fd, 0644)
+				|| !(out = fdopen(fd, "w"))) {
+			perror("Failed to open statistics file");
+
+			if (fd >= 0) {
+				close(fd);
+				unlink(tmp_filename);
+			}
+
+			free(tmp_filename);
+			return false;
+		}
+	}
+
+	if (format == L1_STATS_FORMAT_PROMETHEUS) {
+		report_prometheus(out, command, hash, &usage);
+	} else {
+		report_json(out, command, hash, &usage);
+	}
+
+	if (tmp_filename) {
+		if (fclose(out) || rename(tmp_filename, filename)) {
+			perror("Failed to write statistics file");
+			unlink(tmp_filename);
+			ret = false;
+		}
+
+		free(tmp_filename);
+	} else if (out != stderr && fclose(out)) {
+		perror("Failed to write statistics file");
+		ret = false;
+	}
+
+	return ret;
+}
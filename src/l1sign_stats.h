@@ -0,0 +1,84 @@
+/*
+ * l1sign - Implementation of the Lamport-Diffie one-time signature scheme
+ * Copyright (c) 2019  Janik Rabe <info@janikrabe.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef L1SIGN_STATS_H
+#define L1SIGN_STATS_H
+
+#include <config.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+enum l1_stats_phase {
+	L1_PHASE_SETUP,
+	L1_PHASE_RANDOM,
+	L1_PHASE_MESSAGE_HASH,
+	L1_PHASE_KEY_READ,
+	L1_PHASE_BLOCK_HASH,
+	L1_PHASE_WRITE,
+	L1_PHASE_COUNT,
+};
+
+enum l1_stats_format {
+	L1_STATS_FORMAT_JSON,
+	L1_STATS_FORMAT_PROMETHEUS,
+};
+
+struct l1_stats_time {
+	double wall;
+	double cpu;
+};
+
+/*
+ * Statistics are only collected if 'enabled' is set.  Time is attributed to
+ * exactly one phase at any time, so the phase times add up to the total.
+ */
+struct l1_stats {
+	bool enabled;
+
+	/*
+	 * The hash function of the key in use if it differs from --hash.
+	 */
+	const char *hash;
+
+	enum l1_stats_phase phase;
+	struct timespec phase_wall;
+	struct timespec phase_cpu;
+	struct l1_stats_time phases[L1_PHASE_COUNT];
+
+	uint64_t bytes_read;
+	uint64_t bytes_written;
+	uint64_t block_hashes;
+
+	size_t secmem_nbytes;
+	size_t secmem_high_water;
+};
+
+extern struct l1_stats l1_stats;
+
+void l1_stats_start(void);
+enum l1_stats_phase l1_stats_phase(enum l1_stats_phase phase);
+void l1_stats_read(size_t nbytes);
+void l1_stats_write(size_t nbytes);
+void l1_stats_secmem(size_t alloc_nbytes, size_t free_nbytes);
+bool l1_stats_report(const char *filename, enum l1_stats_format format,
+		const char *command, const char *hash);
+
+#endif
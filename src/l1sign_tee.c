@@ -0,0 +1,163 @@
+/*
+ * l1sign - Implementation of the Lamport-Diffie one-time signature scheme
+ * Copyright (c) 2019  Janik Rabe <info@janikrabe.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include "l1sign_tee.h"
+
+#include "l1sign_stats.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define TEE_BUFFER_LEN 65536
+
+/*
+ * Read exactly 'nbytes' bytes that are known to be available.
+ */
+static bool read_full(int fd, unsigned char *buf, size_t nbytes) {
+	while (nbytes) {
+		ssize_t len = read(fd, buf, nbytes);
+
+		if (len < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if (len <= 0) {
+			return false;
+		}
+
+		l1_stats_read(len);
+		buf += len;
+		nbytes -= len;
+	}
+
+	return true;
+}
+
+#ifdef HAVE_TEE
+static bool is_pipe(int fd) {
+	struct stat st;
+
+	return !fstat(fd, &st) && S_ISFIFO(st.st_mode);
+}
+#endif
+
+/*
+ * Hash everything that can be read from 'in_fd' and copy it to 'out'.  If
+ * both are pipes, the data is duplicated into the output pipe with tee(2)
+ * before it is consumed for hashing, so that it is not copied through user
+ * space on its way out.
+ */
+bool l1_tee_hash(gcry_md_hd_t hd, int in_fd, struct l1_out *out) {
+	unsigned char *buf = gcry_malloc(TEE_BUFFER_LEN);
+	bool zero_copy = false;
+	bool ret = false;
+
+	if (!buf) {
+		return false;
+	}
+
+#ifdef HAVE_TEE
+	zero_copy = is_pipe(in_fd) && is_pipe(out->fd);
+#endif
+
+	for (;;) {
+		ssize_t len;
+
+#ifdef HAVE_TEE
+		if (zero_copy) {
+			len = tee(in_fd, out->fd, TEE_BUFFER_LEN, 0);
+
+			/*
+			 * Nothing has been duplicated if the pipes do not support tee(2).
+			 */
+			if (len < 0 && errno == EINVAL) {
+				zero_copy = false;
+				continue;
+			}
+
+			if (len > 0) {
+				l1_stats_write(len);
+
+				if (!read_full(in_fd, buf, len)) {
+					break;
+				}
+			}
+		} else
+#endif
+		{
+			len = read(in_fd, buf, TEE_BUFFER_LEN);
+
+			if (len > 0) {
+				l1_stats_read(len);
+
+				if (!l1_out_write(out, buf, len)) {
+					break;
+				}
+			}
+		}
+
+		if (len < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if (len <= 0) {
+			ret = !len;
+			break;
+		}
+
+		gcry_md_write(hd, buf, len);
+	}
+
+	gcry_free(buf);
+	return ret;
+}
+
+/*
+ * Hash the file 'in' while passing it through to the open descriptor 'fd' if
+ * it is not negative, or else to 'filename', or standard output if 'filename'
+ * is "-".  Errors are reported.
+ */
+bool l1_tee_hash_file(gcry_md_hd_t hd, FILE *in, const char *filename,
+		int fd) {
+	struct l1_out out;
+
+	if (fd >= 0) {
+		l1_out_open_fd(&out, fd);
+	} else if (!l1_out_open(&out, strcmp(filename, "-") ? filename : NULL)) {
+		perror("Failed to open message output file");
+		return false;
+	}
+
+	if (!l1_tee_hash(hd, fileno(in), &out)) {
+		perror("Failed to pass message through");
+		l1_out_abort(&out);
+		return false;
+	}
+
+	if (!l1_out_commit(&out)) {
+		perror("Failed to save message output file");
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,34 @@
+/*
+ * l1sign - Implementation of the Lamport-Diffie one-time signature scheme
+ * Copyright (c) 2019  Janik Rabe <info@janikrabe.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef L1SIGN_TEE_H
+#define L1SIGN_TEE_H
+
+#include <config.h>
+
+#include "l1sign_gcrypt.h"
+#include "l1sign_out.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+
+bool l1_tee_hash(gcry_md_hd_t hd, int in_fd, struct l1_out *out);
+bool l1_tee_hash_file(gcry_md_hd_t hd, FILE *in, const char *filename,
+		int fd);
+
+#endif
@@ -18,6 +18,9 @@
 
 #include "l1sign_util.h"
 
+#include <sys/mman.h>
+#include <unistd.h>
+
 /*
  * Get the bit with index 'bit' from data buffer 'data' of size 'len' bytes.
  * If the bit is out of bounds, 0xff is returned.
@@ -31,3 +34,63 @@ unsigned char l1_bit_get(unsigned char *data, size_t len, size_t bit) {
 
 	return 0 != (data[byte_idx] & (1 << (7 - (bit % 8))));
 }
+
+void l1_put_le32(unsigned char *buf, uint32_t val) {
+	for (int i = 0; i < 4; ++i) {
+		buf[i] = val >> (8 * i);
+	}
+}
+
+uint32_t l1_get_le32(const unsigned char *buf) {
+	uint32_t val = 0;
+
+	for (int i = 0; i < 4; ++i) {
+		val |= (uint32_t) buf[i] << (8 * i);
+	}
+
+	return val;
+}
+
+void l1_put_le64(unsigned char *buf, uint64_t val) {
+	for (int i = 0; i < 8; ++i) {
+		buf[i] = val >> (8 * i);
+	}
+}
+
+uint64_t l1_get_le64(const unsigned char *buf) {
+	uint64_t val = 0;
+
+	for (int i = 0; i < 8; ++i) {
+		val |= (uint64_t) buf[i] << (8 * i);
+	}
+
+	return val;
+}
+
+/*
+ * Map 'nbytes' bytes at 'offset' of file 'fd' read-only and return a pointer
+ * to the first byte.  Pages are only read from disk when they are accessed.
+ * Returns NULL if the range cannot be mapped.
+ */
+unsigned char *l1_map_range(int fd, off_t offset, size_t nbytes,
+		struct l1_map *map) {
+	off_t page_offset = offset % sysconf(_SC_PAGESIZE);
+
+	map->nbytes = nbytes + page_offset;
+	map->addr = mmap(NULL, map->nbytes, PROT_READ, MAP_SHARED, fd,
+			offset - page_offset);
+
+	if (map->addr == MAP_FAILED) {
+		map->addr = NULL;
+		return NULL;
+	}
+
+	return (unsigned char *) map->addr + page_offset;
+}
+
+void l1_unmap(struct l1_map *map) {
+	if (map->addr) {
+		munmap(map->addr, map->nbytes);
+		map->addr = NULL;
+	}
+}
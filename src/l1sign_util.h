@@ -20,7 +20,21 @@
 #define L1SIGN_UTIL_H
 
 #include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+struct l1_map {
+	void *addr;
+	size_t nbytes;
+};
 
 unsigned char l1_bit_get(unsigned char *data, size_t len, size_t bit);
+void l1_put_le32(unsigned char *buf, uint32_t val);
+uint32_t l1_get_le32(const unsigned char *buf);
+void l1_put_le64(unsigned char *buf, uint64_t val);
+uint64_t l1_get_le64(const unsigned char *buf);
+unsigned char *l1_map_range(int fd, off_t offset, size_t nbytes,
+		struct l1_map *map);
+void l1_unmap(struct l1_map *map);
 
 #endif